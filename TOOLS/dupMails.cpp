@@ -39,6 +39,7 @@
 #include <gak/md5.h>
 #include <gak/map.h>
 #include <gak/cmdlineParser.h>
+#include <gak/exception.h>
 
 // --------------------------------------------------------------------- //
 // ----- includes ------------------------------------------------------ //
@@ -46,6 +47,8 @@
 
 #include <iostream>
 
+#include "mboxReader.h"
+
 // --------------------------------------------------------------------- //
 // ----- imported datas ------------------------------------------------ //
 // --------------------------------------------------------------------- //
@@ -114,40 +117,45 @@ public:
 	}
 	void process( const gak::DirectoryEntry &entry, const gak::STRING &file )
 	{
-		Mails	theMails;
+		MboxReader	reader;
 		std::cout << "process: " << file << std::endl;
 
-		gak::mail::loadMboxFile( file, theMails );
-		m_mailCount += theMails.size();
+		if( !reader.open( file ) && entry.fileSize )
+		{
+			throw gak::OpenReadError( file ).addCerror();
+		}
 
-		for( 
-			Mails::iterator it = theMails.begin(), endIT = theMails.end();
-			it != endIT;
-			++it
-		)
+		while( true )
 		{
+			gak::mail::MAIL	theMail;
+			if( !reader.next( &theMail ) )
+			{
+				break;
+			}
+
 			MD5	hash;
-			gak::STRING &text = it->body;
+			gak::STRING &text = theMail.body;
 
 			if( m_cmdLine.flags & FLAG_USE_META )
 			{
-				text += it->from;
-				text += it->to;
-				text += it->subject;
-				text += it->date.getOriginalTime();
+				text += theMail.from;
+				text += theMail.to;
+				text += theMail.subject;
+				text += theMail.date.getOriginalTime();
 			}
 
 			md5( (unsigned char *)((const char *)text), int(text.strlen()), hash.output );
 			text = "";
-			m_theMap[hash].addElement(*it);
+			m_theMap[hash].addElement(theMail);
 		}
+		m_mailCount += reader.getMailCount();
 
 			if(!(m_cmdLine.flags & FLAG_CROSS_TREE) )
 			{
 				showResult();
 			}
 
-		std::cout << "found: " << theMails.size() << '/' 
+		std::cout << "found: " << reader.getMailCount() << '/' 
 				<< m_theMap.size() << '/' << m_mailCount << std::endl;
 	}
 	void end( const gak::STRING &path )
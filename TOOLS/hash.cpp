@@ -33,18 +33,71 @@
 // ----- switches ------------------------------------------------------ //
 // --------------------------------------------------------------------- //
 
+#if defined( __GNUC__ ) && (defined( __x86_64__ ) || defined( __i386__ ))
+#	define SHA_NI_KERNEL	1		// Intel SHA extensions
+#else
+#	define SHA_NI_KERNEL	0
+#endif
+
+#if defined( __GNUC__ ) && defined( __aarch64__ ) && defined( __linux__ )
+#	define ARM_SHA2_KERNEL	1		// ARMv8 cryptography extension
+#else
+#	define ARM_SHA2_KERNEL	0
+#endif
+
 // --------------------------------------------------------------------- //
 // ----- includes ------------------------------------------------------ //
 // --------------------------------------------------------------------- //
 
 #include <iostream>
 #include <iomanip>
+#include <fstream>
+#include <memory>
+#include <vector>
+#include <map>
+#include <sstream>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdio>
+#include <cstring>
+#include <cctype>
+#include <cerrno>
+#include <cstdint>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+
+#ifndef _Windows
+#	include <fcntl.h>
+#	include <unistd.h>
+#	include <sys/stat.h>
+#endif
+
+#if SHA_NI_KERNEL
+#	include <immintrin.h>
+#	include <cpuid.h>
+#endif
+
+#if ARM_SHA2_KERNEL
+#	include <arm_neon.h>
+#	include <sys/auxv.h>
+#	include <asm/hwcap.h>
+#endif
 
 #include <gak/arrayFile.h>
 #include <gak/cmdlineParser.h>
 #include <gak/hash.h>
 #include <gak/map.h>
 #include <gak/directory.h>
+#include <gak/thread.h>
+#include <gak/condQueue.h>
+#include <gak/shared.h>
+#include <gak/threadPool.h>
+#include <gak/eta.h>
+
+#include "mappedFile.h"
 
 // --------------------------------------------------------------------- //
 // ----- imported datas ------------------------------------------------ //
@@ -73,9 +126,56 @@ static const int HASH_FILE		= 0x040;
 static const int EXECUTABLES	= 0x080;
 static const int FORCE_UPDATE	= 0x100;
 static const int TOUCH_CHANGED	= 0x200;
+static const int PARALLEL		= 0x400;
+static const int QUICK			= 0x800;
+static const int VERIFY_RATE	= 0x1000;
+static const int DIGEST_SET		= 0x2000;
+static const int COMPACT		= 0x4000;
+static const int COMPARE		= 0x8000;
+static const int DIRECT_IO		= 0x10000;
+static const int PRE_COUNT		= 0x20000;
 
 static const uint32 magic = ('h'<<24) | ('a'<<16) | ('s'<<8) | 'h';
-static const uint16 version = 2;
+static const uint16 legacyVersion = 2;		// version 2 has all five digests
+
+static const uint32 dbMagic = ('h'<<24) | ('s'<<16) | ('d'<<8) | 'b';
+static const uint16 dbVersion = 2;						// version 2 has the Merkle trees
+static const char DB_LOG_EXT[] = ".log";
+static const char DB_TEMP_EXT[] = ".tmp";
+static const char DB_PATHS_EXT[] = ".paths";
+static const std::size_t DB_BLOCK_ENTRIES	= 64;			// paths per prefix compressed block
+static const std::size_t DB_COMPACT_RATIO	= 8;			// compact, if the log exceeds 1/8 of the database
+static const char DB_LEAVES_EXT[] = ".leaves";
+
+static const std::size_t TREE_LEAF_SIZE		= 1024*1024;	// bytes per leaf of the Merkle tree
+static const uint64 MAX_TREE_LEAVES			= uint64(1) << 32;
+static const uint8 TREE_LEAF_PREFIX			= 0x00;
+static const uint8 TREE_NODE_PREFIX			= 0x01;
+static const std::size_t MAX_CHANGED_RANGES	= 16;			// reported per changed file
+
+static const std::size_t SHA256_BLOCK_SIZE	= 64;
+
+static const std::size_t NUM_DIGESTS		= 5;
+static const std::size_t CHUNK_SIZE			= 4*1024*1024;	// bytes read at once
+static const std::size_t MAX_PENDING_CHUNKS	= 4;			// per hash thread, limits the memory
+static const std::size_t MAX_JOBS_PER_THREAD	= 64;			// files in flight in parallel mode
+static const std::size_t IO_ALIGNMENT		= 4096;			// buffers and offsets for direct I/O
+static const std::size_t READ_AHEAD_CHUNKS	= 4;			// reads in flight for large files
+static const int PROGRESS_MILLIS			= 1000;			// status line update
+static const std::size_t MAX_LISTED_WORKERS	= 8;			// more are shown as average and minimum
+static const std::size_t STATUS_DIR_WIDTH	= 30;
+
+static const uint32 s_sha256K[64] =
+{
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
 
 // --------------------------------------------------------------------- //
 // ----- macros -------------------------------------------------------- //
@@ -85,10 +185,53 @@ static const uint16 version = 2;
 // ----- type definitions ---------------------------------------------- //
 // --------------------------------------------------------------------- //
 
+enum DigestBits
+{
+	dbMD5		= 0x01,
+	dbSHA224	= 0x02,
+	dbSHA256	= 0x04,
+	dbSHA384	= 0x08,
+	dbSHA512	= 0x10,
+	dbAll		= 0x1F,
+	dbTree		= 0x20,		// SHA-256 Merkle tree, not part of all
+	dbDirectory	= 0x40		// aggregate of a directory in sha256Digest
+};
+
+typedef std::vector<SHA256Hash::Digest>	LeafDigests;
+
+/*
+	the record of version 2 hash files
+*/
+struct LegacyDigests
+{
+	uint64				fileSize;
+	uint64				modifyUTC;
+
+	MD5Hash::Digest		md5Digest;
+	SHA224Hash::Digest	sha224Digest;
+	SHA256Hash::Digest	sha256Digest;
+	SHA384Hash::Digest	sha384Digest;
+	SHA512Hash::Digest	sha512Digest;
+
+	void toBinaryStream( std::ostream &stream ) const
+	{
+		binaryToBinaryStream( stream, *this );
+	}
+	void fromBinaryStream( std::istream &stream )
+	{
+		binaryFromBinaryStream( stream, this );
+	}
+};
+
+/*
+	present tells, which of the digests have been calculated, only
+	these are stored in the database
+*/
 struct Digests
 {
 	uint64				fileSize;
 	uint64				modifyUTC;
+	uint8				present;
 
 	MD5Hash::Digest		md5Digest;
 	SHA224Hash::Digest	sha224Digest;
@@ -96,27 +239,61 @@ struct Digests
 	SHA384Hash::Digest	sha384Digest;
 	SHA512Hash::Digest	sha512Digest;
 
+	SHA256Hash::Digest	treeDigest;
+	LeafDigests			leaves;
+
+	Digests() : fileSize( 0 ), modifyUTC( 0 ), present( 0 )
+	{
+	}
+	Digests( const LegacyDigests &legacy )
+	: fileSize( legacy.fileSize ), modifyUTC( legacy.modifyUTC ), present( dbAll ),
+	  md5Digest( legacy.md5Digest ), sha224Digest( legacy.sha224Digest ),
+	  sha256Digest( legacy.sha256Digest ), sha384Digest( legacy.sha384Digest ),
+	  sha512Digest( legacy.sha512Digest )
+	{
+	}
+
+	// compares the size and the digests both have
+	bool sameContent( const Digests &oper ) const
+	{
+		const unsigned	common = present & oper.present;
+
+		return fileSize == oper.fileSize												&&
+			(!(common & dbMD5) || md5Digest == oper.md5Digest)							&&
+			(!(common & dbSHA224) || sha224Digest == oper.sha224Digest)					&&
+			(!(common & (dbSHA256|dbDirectory)) || sha256Digest == oper.sha256Digest)	&&
+			(!(common & dbSHA384) || sha384Digest == oper.sha384Digest)					&&
+			(!(common & dbSHA512) || sha512Digest == oper.sha512Digest)					&&
+			(!(common & dbTree) || treeDigest == oper.treeDigest);
+	}
 	bool operator == ( const Digests &oper )
 	{
-		return fileSize == oper.fileSize		&&
-			modifyUTC == oper.modifyUTC			&&
-			md5Digest == oper.md5Digest			&&
-			sha224Digest == oper.sha224Digest	&&
-			sha256Digest == oper.sha256Digest	&&
-			sha384Digest == oper.sha384Digest	&&
-			sha512Digest == oper.sha512Digest;
+		return modifyUTC == oper.modifyUTC && sameContent( oper );
 	}
 	bool operator != ( const Digests &oper )
 	{
 		return !(*this == oper);
 	}
-	void toBinaryStream( std::ostream &stream ) const
-	{
-		binaryToBinaryStream( stream, *this );
-	}
-	void fromBinaryStream( std::istream &stream )
+	void addMissing( const Digests &other )
 	{
-		binaryFromBinaryStream( stream, this );
+		const unsigned	missing = other.present & ~present;
+
+		if( missing & dbMD5 )
+			md5Digest = other.md5Digest;
+		if( missing & dbSHA224 )
+			sha224Digest = other.sha224Digest;
+		if( missing & dbSHA256 )
+			sha256Digest = other.sha256Digest;
+		if( missing & dbSHA384 )
+			sha384Digest = other.sha384Digest;
+		if( missing & dbSHA512 )
+			sha512Digest = other.sha512Digest;
+		if( missing & dbTree )
+		{
+			treeDigest = other.treeDigest;
+			leaves = other.leaves;
+		}
+		present |= other.present;
 	}
 };
 
@@ -128,265 +305,2993 @@ enum UpdateMode
 	umTouch		// also update modified date
 };
 
-typedef TreeMap<F_STRING, Digests>	AllDigestdMap;
+typedef TreeMap<F_STRING, LegacyDigests>	LegacyDigestMap;
 
-// --------------------------------------------------------------------- //
-// ----- class definitions --------------------------------------------- //
-// --------------------------------------------------------------------- //
+/*
+	the hash database is a sorted file, read via memory mapping:
+	DbHeader, DbRecord[numEntries], uint64 blockOffsets[numBlocks],
+	SHA256Hash::Digest leaves[numLeaves], path blocks.
+	Each path block holds blockEntries paths, every path is stored as
+	varint length of the prefix shared with the previous path, varint
+	length of the suffix and the suffix. The first path of a block is
+	stored completely, so that the blocks can be searched binary.
+	Paths are sorted bytewise.
+*/
+struct DbHeader
+{
+	uint32	magic;
+	uint16	version;
+	uint16	blockEntries;
+	uint32	recordSize;
+	uint32	reserved;
+	uint64	numEntries;
+	uint64	numBlocks;
+	uint64	numLeaves;
+	uint64	blockOffset;		// start of the block table
+	uint64	leafOffset;			// start of the leaf digests of all trees
+	uint64	pathOffset;			// start of the path blocks, the block offsets are relative to this
+};
 
-// --------------------------------------------------------------------- //
-// ----- exported datas ------------------------------------------------ //
-// --------------------------------------------------------------------- //
+/*
+	the fixed size record of the hash database and of the append log
+*/
+struct DbRecord
+{
+	uint64				fileSize;
+	uint64				modifyUTC;
+	uint8				present;
+	uint8				reserved[7];
 
-// --------------------------------------------------------------------- //
-// ----- module static data -------------------------------------------- //
-// --------------------------------------------------------------------- //
+	MD5Hash::Digest		md5Digest;
+	SHA224Hash::Digest	sha224Digest;
+	SHA256Hash::Digest	sha256Digest;
+	SHA384Hash::Digest	sha384Digest;
+	SHA512Hash::Digest	sha512Digest;
 
-static gak::CommandLine::Options options[] =
-{
-	{ 'U', "update",		0, 1, UPDATE,			"update the hash file if hash and time has changed" },
-	{ 'F', "force",			0, 1, FORCE_UPDATE,		"allow update the hash file entry if hash has changed, only" },
-	{ 'T', "touch",			0, 1, TOUCH_CHANGED,	"touch modified files" },
-	{ 'S', "silent",		0, 1, SILENT },
-	{ 'E', "excecutables",	0, 1, EXECUTABLES },
-	{ 'H', "hashFile",		0, 1, HASH_FILE|gak::CommandLine::needArg, "hash file" },
-	{ 0 }
-};
+	SHA256Hash::Digest	treeDigest;
+	uint64				firstLeaf;		// index in the leaves of the base file
+	uint64				leafCount;
 
-// --------------------------------------------------------------------- //
-// ----- class static data --------------------------------------------- //
-// --------------------------------------------------------------------- //
+	DbRecord()
+	{
+	}
+	explicit DbRecord( const Digests &digests, uint64 firstLeaf=0 )
+	{
+		// the padding bytes are written, too, the file must not depend on the memory
+		std::memset( this, 0, sizeof( *this ) );
+		fileSize = digests.fileSize;
+		modifyUTC = digests.modifyUTC;
+		present = digests.present;
+		md5Digest = digests.md5Digest;
+		sha224Digest = digests.sha224Digest;
+		sha256Digest = digests.sha256Digest;
+		sha384Digest = digests.sha384Digest;
+		sha512Digest = digests.sha512Digest;
+		treeDigest = digests.treeDigest;
+		this->firstLeaf = firstLeaf;
+		leafCount = digests.leaves.size();
+	}
+	void toDigests( Digests *digests ) const
+	{
+		digests->fileSize = fileSize;
+		digests->modifyUTC = modifyUTC;
+		digests->present = present;
+		digests->md5Digest = md5Digest;
+		digests->sha224Digest = sha224Digest;
+		digests->sha256Digest = sha256Digest;
+		digests->sha384Digest = sha384Digest;
+		digests->sha512Digest = sha512Digest;
+		digests->treeDigest = treeDigest;
+	}
+};
 
-// --------------------------------------------------------------------- //
-// ----- prototypes ---------------------------------------------------- //
-// --------------------------------------------------------------------- //
+typedef std::chrono::steady_clock	ProgressClock;
 
-// --------------------------------------------------------------------- //
-// ----- module functions ---------------------------------------------- //
-// --------------------------------------------------------------------- //
+typedef void (*Sha256BlockFunc)( uint32 state[8], const uint8 *data, std::size_t numBlocks );
 
-static void hash( 
-	const STRING &fileName, bool silent, UpdateMode mode, AllDigestdMap &allDigests 
-)
+struct DataChunk
 {
-	ArrayOfData	buffer;
-	readFromFile( &buffer, fileName );
-	DirectoryEntry	dirEntry( fileName );
+	std::unique_ptr<char[]>	buffer;
+	char					*data;		// aligned for direct I/O
+	std::size_t				size;
+
+	DataChunk( std::size_t capacity=CHUNK_SIZE ) : buffer( new char[capacity + IO_ALIGNMENT] ), size( 0 )
+	{
+		const std::size_t	misalignment = std::size_t( reinterpret_cast<std::uintptr_t>( buffer.get() ) % IO_ALIGNMENT );
+		data = buffer.get() + (misalignment ? IO_ALIGNMENT - misalignment : 0);
+	}
 
-	Digests	digests;
+	private:
+	DataChunk( const DataChunk & );
+	DataChunk &operator = ( const DataChunk & );
+};
 
-	digests.fileSize = dirEntry.fileSize;
-	digests.modifyUTC = dirEntry.modifiedDate.getUtcUnixSeconds();
+typedef SharedPointer<DataChunk>	DataChunkPtr;
 
-	{
-		MD5Hash	md5;
+class ReadAheadThread;
 
-		md5.hash_data( buffer );
+struct HashJob;
+typedef SharedPointer<HashJob>		HashJobPtr;
 
-		digests.md5Digest = md5.getDigest();
-	}
+/*
+	one file hashed by the worker pool, the results are stored in the
+	order of the scan
+*/
+struct HashJob
+{
+	STRING					fileName;
+	std::size_t				sequence;
+	unsigned				digestSet;
+	Digests					digests;
+	STRING					error;
+	CondQueue<HashJobPtr>	*results;
+
+	bool						directIO;
+	bool						directory;
+	std::vector<std::string>	children;		// files and subdirectories with delimiter
+
+	HashJob(
+		const STRING &fileName, std::size_t sequence, unsigned digestSet, bool directIO,
+		CondQueue<HashJobPtr> *results
+	)
+	: fileName( fileName ), sequence( sequence ), digestSet( digestSet ), results( results ),
+	  directIO( directIO ), directory( false )
 	{
-		SHA224Hash	sha224;
+	}
+};
 
-		sha224.hash_data( buffer );
+// --------------------------------------------------------------------- //
+// ----- class definitions --------------------------------------------- //
+// --------------------------------------------------------------------- //
 
-		digests.sha224Digest = sha224.getDigest();
-	}
+/*
+	one of the five algorithms, feed the data chunk by chunk
+*/
+class ChunkHasher
+{
+	public:
+	virtual ~ChunkHasher()
 	{
-		SHA256Hash	sha256;
+	}
+	virtual void start() = 0;
+	virtual void update( const DataChunk &chunk ) = 0;
+	virtual void finish( Digests *digests ) = 0;
+};
 
-		sha256.hash_data( buffer );
+template <class HashT, typename HashT::Digest Digests::*DIGEST>
+class ChunkHasherT : public ChunkHasher
+{
+	std::unique_ptr<HashT>	m_hash;
 
-		digests.sha256Digest = sha256.getDigest();
+	public:
+	virtual void start()
+	{
+		m_hash.reset( new HashT );
 	}
+	virtual void update( const DataChunk &chunk )
 	{
-		SHA384Hash	sha384;
-
-		sha384.hash_data( buffer );
-
-		digests.sha384Digest = sha384.getDigest();
+		m_hash->hash_data( chunk.data, chunk.size );
 	}
+	virtual void finish( Digests *digests )
 	{
-		SHA512Hash	sha512;
-
-		sha512.hash_data( buffer );
-
-		digests.sha512Digest = sha512.getDigest();
+		digests->*DIGEST = m_hash->getDigest();
 	}
+};
 
-	if( !silent )
+/*
+	SHA-256 and SHA-224 on top of the block function of the CPU
+*/
+class SHA256Accel
+{
+	uint32		m_state[8];
+	uint8		m_buffer[SHA256_BLOCK_SIZE];
+	std::size_t	m_fill;
+	uint64		m_length;
+
+	public:
+	static bool isAvailable();
+	void start( bool sha224 )
 	{
-		std::cout << fileName << ':' << std::endl;
-		std::cout << "MD5   : " << digests.md5Digest << std::endl;
-		std::cout << "SHA224: " << digests.sha224Digest << std::endl;
-		std::cout << "SHA256: " << digests.sha256Digest << std::endl;
-		std::cout << "SHA384: " << digests.sha384Digest << std::endl;
-		std::cout << "SHA512: " << digests.sha512Digest << std::endl;
+		static const uint32 sha224Init[8] =
+		{
+			0xc1059ed8, 0x367cd507, 0x3070dd17, 0xf70e5939, 0xffc00b31, 0x68581511, 0x64f98fa7, 0xbefa4fa4
+		};
+		static const uint32 sha256Init[8] =
+		{
+			0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+		};
+		std::memcpy( m_state, sha224 ? sha224Init : sha256Init, sizeof(m_state) );
+		m_fill = 0;
+		m_length = 0;
 	}
+	void update( const void *data, std::size_t size );
+	void finish( uint8 *digest, std::size_t digestSize );
+};
+
+template <typename DigestT, DigestT Digests::*DIGEST, bool SHA224>
+class AccelHasherT : public ChunkHasher
+{
+	SHA256Accel	m_hash;
 
-	if( allDigests.hasElement( fileName ) )
+	public:
+	virtual void start()
 	{
-		if( allDigests[fileName] != digests )
-		{
-			std::cerr << "File has changed hash, date or time " << fileName << std::endl;
-			if( mode != umNone && (allDigests[fileName].modifyUTC != digests.modifyUTC || mode > umUpdate) )
-			{
-				allDigests[fileName] = digests;
-				std::cerr << "\t\t... updated" << std::endl;
-				if( mode == umTouch && allDigests[fileName].modifyUTC == digests.modifyUTC )
-				{
-#ifdef _Windows
-					unsigned long attr = GetFileAttributes( fileName );
-					attr &= ~FILE_ATTRIBUTE_READONLY;
-					SetFileAttributes( fileName, attr );
-#endif
-					setModTime(fileName, time(nullptr));
-				}
-			}
-		}
+		m_hash.start( SHA224 );
 	}
-	else
+	virtual void update( const DataChunk &chunk )
 	{
-		allDigests[fileName] = digests;
+		m_hash.update( chunk.data, chunk.size );
 	}
-}
+	virtual void finish( Digests *digests )
+	{
+		static_assert( sizeof(DigestT) == (SHA224 ? 28 : 32), "unexpected digest layout" );
+		m_hash.finish( reinterpret_cast<uint8 *>( &(digests->*DIGEST) ), sizeof(DigestT) );
+	}
+};
 
-static void hashDirectory( const STRING &directoryName, bool silent, UpdateMode mode, bool executables, AllDigestdMap &allDigests )
+/*
+	counts the work done for the status line and the final summary. The
+	byte and time counters are updated by the worker threads, everything
+	else by the main thread.
+*/
+class HashProgress
 {
-	DirectoryList	dirList;
-	F_STRING	path = directoryName;
-	if( !path.endsWith( DIRECTORY_DELIMITER ) )
+	ProgressClock::time_point				m_start, m_lastPrint;
+	uint64									m_totalFiles, m_totalBytes;		// 0: unknown
+	unsigned								m_passes;						// times a file is read
+	uint64									m_files, m_skippedBytes;
+	std::atomic<uint64>						m_bytes;
+	std::atomic<int64>						m_ioNanos, m_hashNanos;
+	std::size_t								m_numWorkers;
+	std::unique_ptr< std::atomic<int64>[] >	m_busyNanos;
+	Eta<uint64>								m_eta;
+	STRING									m_directory;
+
+	static int64 toNanos( ProgressClock::duration duration )
 	{
-		path += DIRECTORY_DELIMITER;
+		return std::chrono::duration_cast<std::chrono::nanoseconds>( duration ).count();
+	}
+	double getSeconds() const
+	{
+		return double( toNanos( ProgressClock::now() - m_start ) ) / 1e9;
 	}
 
-	std::cout << std::left << std::setw( 70 ) << (directoryName.strlen() < 70 ? directoryName : directoryName.leftString( 67 ) + "...") << "   \r";
-	std::cout.flush();
+	public:
+	HashProgress()
+	: m_totalFiles( 0 ), m_totalBytes( 0 ), m_passes( 1 ), m_files( 0 ), m_skippedBytes( 0 ),
+	  m_bytes( 0 ), m_ioNanos( 0 ), m_hashNanos( 0 ), m_numWorkers( 0 )
+	{
+	}
 
-	try
+	void start( std::size_t numWorkers, unsigned digestSet );
+	void setTotal( uint64 files, uint64 bytes )
 	{
-		dirList.dirlist( path );
+		m_totalFiles = files;
+		m_totalBytes = bytes * m_passes;
 	}
-	catch( std::exception &e )
+	void setDirectory( const STRING &directory )
 	{
-		std::cerr << "Cannot read directory " << path << ": " << e.what() << std::endl;
+		m_directory = directory;
 	}
-	catch( ... )
+
+	void addRead( std::size_t bytes )
 	{
-		std::cerr << "Cannot read directory " << path << std::endl;
+		m_bytes += bytes;
 	}
-	for( 
-		DirectoryList::const_iterator it = dirList.cbegin(), endIT = dirList.cend();
-		it != endIT;
-		++it
-	)
+	void addIO( ProgressClock::duration duration )
 	{
-		if( it->fileName == "." || it->fileName == ".." )
-			continue;
+		m_ioNanos += toNanos( duration );
+	}
+	void addHash( ProgressClock::duration duration )
+	{
+		m_hashNanos += toNanos( duration );
+	}
+	void addBusy( ProgressClock::duration duration );
+	void fileDone()
+	{
+		++m_files;
+	}
+	void fileSkipped( uint64 fileSize )
+	{
+		++m_files;
+		m_skippedBytes += fileSize * m_passes;
+	}
 
-		F_STRING	fileName = path + it->fileName;
+	void print( bool force=false );
+	void printSummary() const;
+};
 
-		if( isFile( fileName ) )
-		{
-			F_STRING	extension = fsplit( fileName );
+static HashProgress	s_progress;
 
-			if( !executables 
-			|| extension == "exe" || extension == "dll" || extension == "com" || extension == "sys" 
-			|| extension == "cmd" || extension == "bat" 
-			|| extension == "ttf" || extension == "fon" )
-			{
-				hash( fileName,  silent, mode, allDigests );
-			}
-		}
-		else
-		{
-			hashDirectory( fileName, silent, mode, executables, allDigests );
-		}
+/*
+	the I/O layer: reads a file in aligned blocks, optionally bypassing the
+	page cache. Large files are read ahead by a thread of its own.
+*/
+class InputFile
+{
+#ifdef _Windows
+	HANDLE					m_handle;
+#else
+	int						m_handle;
+#endif
+	STRING					m_fileName;
+	bool					m_direct;			// reads must be aligned
+	bool					m_dropCache;		// direct I/O emulated by dropping the pages read
+	uint64					m_size, m_offset;
+	SharedObjectPointer<ReadAheadThread>	m_readAhead;
+
+	InputFile( const InputFile & );
+	InputFile &operator = ( const InputFile & );
+
+	public:
+	InputFile( const STRING &fileName, bool direct );
+	~InputFile();
+
+	void seek( uint64 offset );
+	std::size_t read( char *buffer, std::size_t size );
+
+	void startReadAhead();
+	bool isReadingAhead() const
+	{
+		return m_readAhead;
 	}
-}
+	// an empty chunk marks the end of the file
+	DataChunkPtr nextChunk();
 
-static int hash( const CommandLine &cmdLine )
-{
-	const char	**argv = cmdLine.argv + 1;
-	const char	*arg;
-	F_STRING	fileArg;
+	uint64 getSize() const
+	{
+		return m_size;
+	}
+};
 
-	const bool	silent = cmdLine.flags & SILENT;
-	UpdateMode	mode;
-	if( cmdLine.flags & TOUCH_CHANGED )
-		mode = umTouch;
-	else if( cmdLine.flags & FORCE_UPDATE )
-		mode = umForce;
-	else if( cmdLine.flags & UPDATE )
-		mode = umUpdate;
-	else
-		mode = umNone;
-	const bool	executables = cmdLine.flags & EXECUTABLES;
+/*
+	keeps up to READ_AHEAD_CHUNKS chunks of a file in memory
+*/
+class ReadAheadThread : public Thread
+{
+	InputFile				&m_file;
+	CondQueue<DataChunkPtr>	m_chunks;
+	STRING					m_error;
+	volatile bool			m_terminate;
 
-	F_STRING	hashFile = cmdLine.flags & HASH_FILE ? cmdLine.parameter['H'][0] : NULL_STRING;
+	std::mutex				m_queuedMutex;
+	std::condition_variable	m_queueFree;
+	std::size_t				m_queued;		// chunks read but not popped
 
-	AllDigestdMap	allDigests;
+	public:
+	ReadAheadThread( InputFile &file ) : m_file( file ), m_terminate( false ), m_queued( 0 )
+	{
+		StartThread( "ReadAheadThread" );
+	}
+	virtual void ExecuteThread();
 
-	if( !hashFile.isEmpty() && isFile( hashFile ) )
+	DataChunkPtr pop();
+	void terminate()
 	{
-		readFromBinaryFile( hashFile, &allDigests, magic, version, true );	// skip size comparision
+		std::lock_guard<std::mutex>	lock( m_queuedMutex );
+		m_terminate = true;
+		m_queueFree.notify_one();
 	}
+};
 
-	while( (arg = *argv++) != NULL )
+/*
+	runs one hasher in a pipeline, an empty chunk finishes the file
+*/
+class HashThread : public Thread
+{
+	ChunkHasher				&m_hasher;
+	CondQueue<DataChunkPtr>	m_chunks;
+	CondQueue<Digests*>		&m_doneQueue;
+	Digests					*m_digests;
+	volatile bool			m_terminate;
+
+	std::mutex				m_pendingMutex;
+	std::condition_variable	m_pendingDone;
+	std::size_t				m_pending;		// chunks pushed but not hashed
+
+	public:
+	HashThread( ChunkHasher &hasher, CondQueue<Digests*> &doneQueue )
+	: m_hasher( hasher ), m_doneQueue( doneQueue ), m_digests( nullptr ), m_terminate( false ), m_pending( 0 )
 	{
-		fileArg = fullPath( arg );
+		StartThread( "HashThread" );
+	}
+	virtual void ExecuteThread();
 
-		if( isFile( fileArg ) )
-		{
-			hash( fileArg, silent, mode, allDigests );
-		}
-		else
+	void setTarget( Digests *digests )
+	{
+		m_digests = digests;
+	}
+	void push( const DataChunkPtr &chunk )
+	{
 		{
-			hashDirectory( fileArg, silent, mode, executables, allDigests );
+			std::lock_guard<std::mutex>	lock( m_pendingMutex );
+			++m_pending;
 		}
+		m_chunks.push( chunk );
 	}
-
-	if( fileArg.isEmpty() )
+	/// blocks until less than maxPending chunks are waiting for the hasher
+	void waitPending( std::size_t maxPending )
 	{
-		throw CmdlineError();
+		std::unique_lock<std::mutex>	lock( m_pendingMutex );
+		m_pendingDone.wait( lock, [this, maxPending] { return m_pending < maxPending; } );
 	}
-
-	if( !hashFile.isEmpty() && allDigests.size() )
+	void terminate()
 	{
-		writeToBinaryFile( hashFile, allDigests, magic, version, owmOverwrite );
+		m_terminate = true;
 	}
+};
 
-	return EXIT_SUCCESS;
+/*
+	SHA-256 for the nodes of the Merkle tree
+*/
+class TreeNodeHash
+{
+	SHA256Accel					m_accel;
+	std::unique_ptr<SHA256Hash>	m_hash;
+
+	public:
+	void start()
+	{
+		if( SHA256Accel::isAvailable() )
+			m_accel.start( false );
+		else
+			m_hash.reset( new SHA256Hash );
+	}
+	void update( const void *data, std::size_t size )
+	{
+		if( m_hash )
+			m_hash->hash_data( data, size );
+		else
+			m_accel.update( data, size );
+	}
+	void finish( SHA256Hash::Digest *digest )
+	{
+		static_assert( sizeof(SHA256Hash::Digest) == 32, "unexpected digest layout" );
+		if( m_hash )
+			*digest = m_hash->getDigest();
+		else
+			m_accel.finish( reinterpret_cast<uint8 *>( digest ), sizeof(SHA256Hash::Digest) );
+	}
+};
+
+/*
+	hashes a contiguous range of leaves of one file
+*/
+class LeafThread : public Thread
+{
+	STRING			m_fileName;
+	uint64			m_firstLeaf, m_endLeaf;
+	bool			m_directIO;
+	LeafDigests		&m_leaves;
+	STRING			m_error;
+
+	public:
+	LeafThread( const STRING &fileName, uint64 firstLeaf, uint64 endLeaf, bool directIO, LeafDigests &leaves )
+	: m_fileName( fileName ), m_firstLeaf( firstLeaf ), m_endLeaf( endLeaf ), m_directIO( directIO ), m_leaves( leaves )
+	{
+		StartThread( "LeafThread" );
+	}
+	virtual void ExecuteThread();
+
+	const STRING &getError() const
+	{
+		return m_error;
+	}
+};
+
+/*
+	reads each file once and feeds all hashers from the same chunks.
+	Files larger than one chunk are hashed by one thread per algorithm
+	while the next chunk is read.
+	The Merkle tree is calculated in an extra pass, its leaves are hashed
+	by several threads.
+*/
+class DigestEngine
+{
+	unsigned							m_digestSet;
+	bool								m_pipelined;
+	bool								m_directIO;
+	std::size_t							m_numHashers;
+	std::unique_ptr<ChunkHasher>		m_hashers[NUM_DIGESTS];
+	SharedObjectPointer<HashThread>		m_threads[NUM_DIGESTS];
+	CondQueue<Digests*>					m_doneQueue;
+	std::size_t							m_treeThreads;
+	DataChunk							m_chunk;			// files read without read ahead
+
+	void hashSequential( InputFile &file, Digests *digests );
+	void hashPipelined( InputFile &file, Digests *digests );
+	void finishPipeline();
+	void hashTree( const STRING &fileName, uint64 fileSize, Digests *digests );
+
+	public:
+	DigestEngine( unsigned digestSet, bool pipelined, bool directIO );
+	~DigestEngine();
+
+	bool isSetup( unsigned digestSet, bool directIO ) const
+	{
+		return m_digestSet == digestSet && m_directIO == directIO;
+	}
+
+	void hashFile( const STRING &fileName, Digests *digests );
+};
+
+namespace gak
+{
+	template <>
+	struct ProcessorType<HashJobPtr>
+	{
+		typedef HashJobPtr object_type;
+
+		void process( const HashJobPtr &ptr, void *pool, void *mainData )
+		{
+			HashJobPtr	job = ptr;
+
+			const ProgressClock::time_point	start = ProgressClock::now();
+			try
+			{
+				// the pool hashes many files at once, no need for a pipeline.
+				// Each worker keeps its engine and the read buffer for all files
+				static thread_local std::unique_ptr<DigestEngine>	engine;
+				if( !engine || !engine->isSetup( job->digestSet, job->directIO ) )
+				{
+					engine.reset( new DigestEngine( job->digestSet, false, job->directIO ) );
+				}
+				DirectoryEntry	dirEntry( job->fileName );
+
+				engine->hashFile( job->fileName, &job->digests );
+				job->digests.fileSize = dirEntry.fileSize;
+				job->digests.modifyUTC = dirEntry.modifiedDate.getUtcUnixSeconds();
+			}
+			catch( std::exception &e )
+			{
+				job->error = e.what();
+			}
+			catch( ... )
+			{
+				job->error = "Unknown error";
+			}
+			s_progress.addBusy( ProgressClock::now() - start );
+			job->results->push( job );
+		}
+	};
 }
 
-// --------------------------------------------------------------------- //
-// ----- class inlines ------------------------------------------------- //
-// --------------------------------------------------------------------- //
+/*
+	the hash database. The sorted base file is mapped into memory, changes
+	are appended to a log, which is replayed when the database is opened.
+	If the log grows too large, base and log are merged into a new base.
+*/
+class HashDatabase
+{
+	public:
+	typedef std::map<std::string, Digests>	ChangeMap;
 
-// --------------------------------------------------------------------- //
-// ----- class constructors/destructors -------------------------------- //
-// --------------------------------------------------------------------- //
+	/*
+		reads the paths and records of the base file in sorted order
+	*/
+	class Cursor
+	{
+		const HashDatabase	&m_db;
+		const char			*m_pos, *m_end;
+		uint64				m_index, m_endIndex;
+		std::string			m_path;
+
+		public:
+		Cursor( const HashDatabase &db, uint64 block=0 );
+
+		void setBlock( uint64 block );
+		bool next();
+		const std::string &getPath() const
+		{
+			return m_path;
+		}
+		void getDigests( Digests *digests ) const
+		{
+			m_db.readDigests( m_index-1, digests );
+		}
+	};
+
+	/*
+		reads the base file merged with the changes in sorted order
+	*/
+	class Scanner
+	{
+		const HashDatabase			&m_db;
+		Cursor						m_cursor;
+		bool						m_baseValid;
+		ChangeMap::const_iterator	m_change;
+		std::string					m_path;
+		Digests						m_digests;
+
+		public:
+		Scanner( const HashDatabase &db );
+
+		// the next entry is the first one not less than path
+		void seek( const std::string &path );
+		bool next();
+		const std::string &getPath() const
+		{
+			return m_path;
+		}
+		const Digests &getDigests() const
+		{
+			return m_digests;
+		}
+	};
+
+	private:
+	STRING			m_fileName;
+	MappedFile		m_base;
+	DbHeader		m_header;
+	ChangeMap		m_changes;		// the replayed log and the changes of this run
+	std::ofstream	m_log;
+	std::size_t		m_logEntries;
+	bool			m_compact;
+
+	uint64 getBlockOffset( uint64 block ) const;
+	uint64 findBlock( const std::string &path ) const;
+	DbRecord getRecord( uint64 index ) const;
+	void readDigests( uint64 index, Digests *digests ) const;
+	void openBase();
+	void importLegacy();
+	void replayLog();
+	void compact();
+
+	public:
+	HashDatabase() : m_logEntries( 0 ), m_compact( false )
+	{
+		std::memset( &m_header, 0, sizeof( m_header ) );
+	}
+
+	void open( const STRING &fileName );
+	bool find( const STRING &path, Digests *digests ) const;
+	void store( const STRING &path, const Digests &digests );
+	void flush( bool forceCompact );
+};
+
+/*
+	writes a new base file of the hash database, the paths must be added
+	in sorted order
+*/
+class DbWriter
+{
+	STRING					m_fileName, m_pathsName, m_leavesName;
+	std::ofstream			m_out, m_paths, m_leaves;
+	std::vector<uint64>		m_blockOffsets;
+	std::string				m_lastPath;
+	uint64					m_numEntries, m_pathSize, m_numLeaves;
+
+	void writeVarint( uint64 value );
+	void appendFile( const STRING &fileName, uint64 size );
+
+	public:
+	DbWriter( const STRING &fileName );
+
+	void add( const std::string &path, const Digests &digests );
+	void finish();
+};
+
+/*
+	hashes the files either directly or with a pool of worker threads.
+	In both cases the digests are printed and stored in the order the
+	files were passed.
+*/
+class HashScheduler
+{
+	bool								m_silent;
+	UpdateMode							m_mode;
+	unsigned							m_digestSet;
+	bool								m_directIO;
+	HashDatabase						&m_database;
+
+	std::unique_ptr<DigestEngine>		m_engine;
+	std::unique_ptr< ThreadPool<HashJobPtr> >	m_pool;
+	std::size_t							m_maxJobs;
+	CondQueue<HashJobPtr>				m_results;
+	std::map<std::size_t, HashJobPtr>	m_finished;
+	std::size_t							m_nextSequence, m_nextStore;
+
+	bool								m_quick;
+	unsigned							m_verifyRate;
+	std::size_t							m_unchangedCount, m_sampleCount;
+
+	bool isUnchanged( const STRING &fileName, const DirectoryEntry &dirEntry );
+	void storeDirectory( const STRING &path, const std::vector<std::string> &children );
+	void storeFinished();
+	void waitForResult();
+
+	public:
+	HashScheduler(
+		bool silent, UpdateMode mode, unsigned digestSet, bool directIO, std::size_t numThreads,
+		HashDatabase &database
+	);
+	~HashScheduler();
+
+	void setQuickMode( unsigned verifyRate )
+	{
+		m_quick = true;
+		m_verifyRate = verifyRate;
+	}
+	void hashFile( const STRING &fileName, const DirectoryEntry &dirEntry );
+	void addDirectory( const STRING &path, std::vector<std::string> &children );
+	void flush();
+
+	std::size_t getUnchangedCount() const
+	{
+		return m_unchangedCount;
+	}
+	std::size_t getSampleCount() const
+	{
+		return m_sampleCount;
+	}
+};
 
 // --------------------------------------------------------------------- //
-// ----- class static functions ---------------------------------------- //
+// ----- exported datas ------------------------------------------------ //
 // --------------------------------------------------------------------- //
 
 // --------------------------------------------------------------------- //
-// ----- class privates ------------------------------------------------ //
+// ----- module static data -------------------------------------------- //
 // --------------------------------------------------------------------- //
 
+static gak::CommandLine::Options options[] =
+{
+	{ 'U', "update",		0, 1, UPDATE,			"update the hash file if hash and time has changed" },
+	{ 'F', "force",			0, 1, FORCE_UPDATE,		"allow update the hash file entry if hash has changed, only" },
+	{ 'T', "touch",			0, 1, TOUCH_CHANGED,	"touch modified files" },
+	{ 'S', "silent",		0, 1, SILENT },
+	{ 'E', "excecutables",	0, 1, EXECUTABLES },
+	{ 'H', "hashFile",		0, 1, HASH_FILE|gak::CommandLine::needArg, "hash file" },
+	{ 'P', "parallel",		0, 1, PARALLEL|gak::CommandLine::needArg, "number of threads hashing files concurrently" },
+	{ 'Q', "quick",			0, 1, QUICK,			"do not hash files with unchanged size and modification time" },
+	{ 'V', "verifyRate",	0, 1, VERIFY_RATE|gak::CommandLine::needArg, "percent of unchanged files hashed anyway in quick mode" },
+	{ 'D', "digests",		0, 1, DIGEST_SET|gak::CommandLine::needArg, "digests to calculate, e.g. md5,sha256,tree (default all)" },
+	{ 'C', "compact",		0, 1, COMPACT,			"rewrite the hash file and merge the update log" },
+	{ 'O', "direct",		0, 1, DIRECT_IO,		"read without filling the page cache (O_DIRECT)" },
+	{ 'N', "count",			0, 1, PRE_COUNT,		"count the files first to show the remaining time" },
+	{ 'X', "compare",		0, 1, COMPARE,			"compare two hash files: <a.hash> <b.hash> [<prefixA> <prefixB>]" },
+	{ 0 }
+};
+
+static Sha256BlockFunc	s_sha256Blocks = nullptr;
+
 // --------------------------------------------------------------------- //
-// ----- class protected ----------------------------------------------- //
+// ----- class static data --------------------------------------------- //
 // --------------------------------------------------------------------- //
 
 // --------------------------------------------------------------------- //
-// ----- class virtuals ------------------------------------------------ //
+// ----- prototypes ---------------------------------------------------- //
 // --------------------------------------------------------------------- //
-   
+
 // --------------------------------------------------------------------- //
-// ----- class publics ------------------------------------------------- //
+// ----- module functions ---------------------------------------------- //
 // --------------------------------------------------------------------- //
 
+#if SHA_NI_KERNEL
+/*
+	Intel SHA extensions, the state is kept as ABEF/CDGH
+*/
+__attribute__((target("sha,sse4.1")))
+static void sha256BlocksX86( uint32 state[8], const uint8 *data, std::size_t numBlocks )
+{
+	const __m128i	byteSwap = _mm_set_epi64x( 0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL );
+
+	__m128i	tmp = _mm_shuffle_epi32( _mm_loadu_si128( (const __m128i*)&state[0] ), 0xB1 );	// CDAB
+	__m128i	state1 = _mm_shuffle_epi32( _mm_loadu_si128( (const __m128i*)&state[4] ), 0x1B );	// EFGH
+	__m128i	state0 = _mm_alignr_epi8( tmp, state1, 8 );									// ABEF
+	state1 = _mm_blend_epi16( state1, tmp, 0xF0 );										// CDGH
+
+	for( ; numBlocks; --numBlocks, data += SHA256_BLOCK_SIZE )
+	{
+		const __m128i	abefSave = state0;
+		const __m128i	cdghSave = state1;
+		__m128i			w[4];
+
+		for( int i=0; i<16; ++i )
+		{
+			__m128i	&wi = w[i&3];
+			if( i < 4 )
+			{
+				wi = _mm_shuffle_epi8( _mm_loadu_si128( (const __m128i*)(data + 16*i) ), byteSwap );
+			}
+			else
+			{
+				// w[i&3] is the oldest of the last four words
+				__m128i	x = _mm_sha256msg1_epu32( wi, w[(i+1)&3] );
+				x = _mm_add_epi32( x, _mm_alignr_epi8( w[(i+3)&3], w[(i+2)&3], 4 ) );
+				wi = _mm_sha256msg2_epu32( x, w[(i+3)&3] );
+			}
+			__m128i	msg = _mm_add_epi32( wi, _mm_loadu_si128( (const __m128i*)&s_sha256K[4*i] ) );
+			state1 = _mm_sha256rnds2_epu32( state1, state0, msg );
+			state0 = _mm_sha256rnds2_epu32( state0, state1, _mm_shuffle_epi32( msg, 0x0E ) );
+		}
+
+		state0 = _mm_add_epi32( state0, abefSave );
+		state1 = _mm_add_epi32( state1, cdghSave );
+	}
+
+	tmp = _mm_shuffle_epi32( state0, 0x1B );					// FEBA
+	state1 = _mm_shuffle_epi32( state1, 0xB1 );					// DCHG
+	_mm_storeu_si128( (__m128i*)&state[0], _mm_blend_epi16( tmp, state1, 0xF0 ) );	// DCBA
+	_mm_storeu_si128( (__m128i*)&state[4], _mm_alignr_epi8( state1, tmp, 8 ) );	// HGFE
+}
+
+static bool hasShaExtensions()
+{
+	unsigned	eax, ebx, ecx, edx;
+
+	if( !__get_cpuid( 1, &eax, &ebx, &ecx, &edx )
+	|| !(ecx & bit_SSSE3) || !(ecx & bit_SSE4_1) )
+	{
+		return false;
+	}
+	if( __get_cpuid_max( 0, nullptr ) < 7 )
+	{
+		return false;
+	}
+	__cpuid_count( 7, 0, eax, ebx, ecx, edx );
+	return (ebx & bit_SHA) != 0;
+}
+#endif	// SHA_NI_KERNEL
+
+#if ARM_SHA2_KERNEL
+/*
+	ARMv8 cryptography extension
+*/
+__attribute__((target("+crypto")))
+static void sha256BlocksArm( uint32 state[8], const uint8 *data, std::size_t numBlocks )
+{
+	uint32x4_t	state0 = vld1q_u32( &state[0] );
+	uint32x4_t	state1 = vld1q_u32( &state[4] );
+
+	for( ; numBlocks; --numBlocks, data += SHA256_BLOCK_SIZE )
+	{
+		const uint32x4_t	abcdSave = state0;
+		const uint32x4_t	efghSave = state1;
+		uint32x4_t			w[4];
+
+		for( int i=0; i<16; ++i )
+		{
+			uint32x4_t	&wi = w[i&3];
+			if( i < 4 )
+			{
+				wi = vreinterpretq_u32_u8( vrev32q_u8( vld1q_u8( data + 16*i ) ) );
+			}
+			else
+			{
+				wi = vsha256su1q_u32( vsha256su0q_u32( wi, w[(i+1)&3] ), w[(i+2)&3], w[(i+3)&3] );
+			}
+			uint32x4_t	msg = vaddq_u32( wi, vld1q_u32( &s_sha256K[4*i] ) );
+			uint32x4_t	abcd = state0;
+			state0 = vsha256hq_u32( state0, state1, msg );
+			state1 = vsha256h2q_u32( state1, abcd, msg );
+		}
+
+		state0 = vaddq_u32( state0, abcdSave );
+		state1 = vaddq_u32( state1, efghSave );
+	}
+
+	vst1q_u32( &state[0], state0 );
+	vst1q_u32( &state[4], state1 );
+}
+
+static bool hasShaExtensions()
+{
+	return (getauxval( AT_HWCAP ) & HWCAP_SHA2) != 0;
+}
+#endif	// ARM_SHA2_KERNEL
+
+static void selectSha256Kernel()
+{
+#if SHA_NI_KERNEL
+	if( hasShaExtensions() )
+		s_sha256Blocks = sha256BlocksX86;
+#elif ARM_SHA2_KERNEL
+	if( hasShaExtensions() )
+		s_sha256Blocks = sha256BlocksArm;
+#endif
+}
+
+static unsigned parseDigestSet( const char *list )
+{
+	std::istringstream	stream( list );
+	std::string			name;
+	unsigned			digestSet = 0;
+
+	while( std::getline( stream, name, ',' ) )
+	{
+		std::transform( name.begin(), name.end(), name.begin(), ::tolower );
+
+		if( name == "md5" )
+			digestSet |= dbMD5;
+		else if( name == "sha224" )
+			digestSet |= dbSHA224;
+		else if( name == "sha256" )
+			digestSet |= dbSHA256;
+		else if( name == "sha384" )
+			digestSet |= dbSHA384;
+		else if( name == "sha512" )
+			digestSet |= dbSHA512;
+		else if( name == "tree" )
+			digestSet |= dbTree;
+		else if( name == "all" )
+			digestSet |= dbAll;
+		else
+			throw CmdlineError( "Unknown digest, use md5, sha224, sha256, sha384, sha512, tree or all." );
+	}
+	if( !digestSet )
+	{
+		throw CmdlineError( "No digest selected." );
+	}
+
+	return digestSet;
+}
+
+static std::string toPath( const STRING &fileName )
+{
+	return std::string( fileName.c_str(), fileName.strlen() );
+}
+
+static int comparePath( const std::string &path1, const char *path2, std::size_t len2 )
+{
+	const std::size_t	len1 = path1.size();
+	const int			result = std::memcmp( path1.data(), path2, std::min( len1, len2 ) );
+
+	return result ? result : len1 < len2 ? -1 : len1 > len2 ? 1 : 0;
+}
+
+static uint64 readVarint( const char *&pos, const char *end )
+{
+	uint64		value = 0;
+	unsigned	shift = 0;
+
+	while( pos < end && shift < 64 )
+	{
+		const uint8	byte = uint8(*pos++);
+
+		value |= uint64(byte & 0x7F) << shift;
+		if( !(byte & 0x80) )
+		{
+			return value;
+		}
+		shift += 7;
+	}
+	throw std::runtime_error( "Corrupt hash database" );
+}
+
+static void hashLeaves(
+	const STRING &fileName, uint64 firstLeaf, uint64 endLeaf, bool directIO, LeafDigests *leaves
+)
+{
+	InputFile		file( fileName, directIO );
+	DataChunk		buffer( TREE_LEAF_SIZE );
+	TreeNodeHash	hash;
+
+	file.seek( firstLeaf * TREE_LEAF_SIZE );
+	for( uint64 leaf = firstLeaf; leaf < endLeaf; ++leaf )
+	{
+		const ProgressClock::time_point	readStart = ProgressClock::now();
+		buffer.size = file.read( buffer.data, TREE_LEAF_SIZE );
+		const ProgressClock::time_point	hashStart = ProgressClock::now();
+
+		hash.start();
+		hash.update( &TREE_LEAF_PREFIX, 1 );
+		hash.update( buffer.data, buffer.size );
+		hash.finish( &(*leaves)[std::size_t(leaf)] );
+
+		s_progress.addIO( hashStart - readStart );
+		s_progress.addHash( ProgressClock::now() - hashStart );
+	}
+}
+
+static void treeRoot( const LeafDigests &leaves, SHA256Hash::Digest *root )
+{
+	LeafDigests		level = leaves, nextLevel;
+	TreeNodeHash	hash;
+
+	while( level.size() > 1 )
+	{
+		nextLevel.clear();
+		for( std::size_t i=0; i<level.size(); i += 2 )
+		{
+			if( i+1 < level.size() )
+			{
+				nextLevel.push_back( SHA256Hash::Digest() );
+				hash.start();
+				hash.update( &TREE_NODE_PREFIX, 1 );
+				hash.update( &level[i], sizeof(SHA256Hash::Digest) );
+				hash.update( &level[i+1], sizeof(SHA256Hash::Digest) );
+				hash.finish( &nextLevel.back() );
+			}
+			else
+			{
+				nextLevel.push_back( level[i] );		// odd node moves up
+			}
+		}
+		level.swap( nextLevel );
+	}
+	*root = level[0];
+}
+
+/*
+	hashes the content digests of a file or directory, the modification
+	time is ignored
+*/
+static void hashContent( TreeNodeHash &hash, const Digests &digests )
+{
+	hash.update( &digests.present, sizeof( digests.present ) );
+	hash.update( &digests.fileSize, sizeof( digests.fileSize ) );
+	if( digests.present & dbMD5 )
+		hash.update( &digests.md5Digest, sizeof( digests.md5Digest ) );
+	if( digests.present & dbSHA224 )
+		hash.update( &digests.sha224Digest, sizeof( digests.sha224Digest ) );
+	if( digests.present & (dbSHA256|dbDirectory) )
+		hash.update( &digests.sha256Digest, sizeof( digests.sha256Digest ) );
+	if( digests.present & dbSHA384 )
+		hash.update( &digests.sha384Digest, sizeof( digests.sha384Digest ) );
+	if( digests.present & dbSHA512 )
+		hash.update( &digests.sha512Digest, sizeof( digests.sha512Digest ) );
+	if( digests.present & dbTree )
+		hash.update( &digests.treeDigest, sizeof( digests.treeDigest ) );
+}
+
+/*
+	reports the ranges of leaves that differ
+*/
+static void printChangedLeaves( const LeafDigests &oldLeaves, const LeafDigests &newLeaves )
+{
+	const std::size_t	numLeaves = std::max( oldLeaves.size(), newLeaves.size() );
+	std::size_t			numRanges = 0;
+
+	std::cerr << "\t\tchanged MiB blocks:";
+	for( std::size_t i=0; i<numLeaves; )
+	{
+		if( i < oldLeaves.size() && i < newLeaves.size() && oldLeaves[i] == newLeaves[i] )
+		{
+			++i;
+			continue;
+		}
+
+		const std::size_t	first = i;
+		while( i < numLeaves
+		&& (i >= oldLeaves.size() || i >= newLeaves.size() || oldLeaves[i] != newLeaves[i]) )
+		{
+			++i;
+		}
+		if( ++numRanges > MAX_CHANGED_RANGES )
+		{
+			std::cerr << " ...";
+			break;
+		}
+		std::cerr << ' ' << first;
+		if( i-1 > first )
+		{
+			std::cerr << '-' << i-1;
+		}
+	}
+	std::cerr << std::endl;
+}
+
+static void storeDigests( 
+	const STRING &fileName, const Digests &digests, bool silent, UpdateMode mode, HashDatabase &database 
+)
+{
+	if( !silent )
+	{
+		std::cout << fileName << ':' << std::endl;
+		if( digests.present & dbMD5 )
+			std::cout << "MD5   : " << digests.md5Digest << std::endl;
+		if( digests.present & dbSHA224 )
+			std::cout << "SHA224: " << digests.sha224Digest << std::endl;
+		if( digests.present & dbSHA256 )
+			std::cout << "SHA256: " << digests.sha256Digest << std::endl;
+		if( digests.present & dbSHA384 )
+			std::cout << "SHA384: " << digests.sha384Digest << std::endl;
+		if( digests.present & dbSHA512 )
+			std::cout << "SHA512: " << digests.sha512Digest << std::endl;
+		if( digests.present & dbTree )
+			std::cout << "TREE  : " << digests.treeDigest << std::endl;
+	}
+
+	Digests	stored;
+	if( database.find( fileName, &stored ) )
+	{
+		if( stored != digests )
+		{
+			std::cerr << "File has changed hash, date or time " << fileName << std::endl;
+			if( (stored.present & digests.present & dbTree) && stored.treeDigest != digests.treeDigest )
+			{
+				printChangedLeaves( stored.leaves, digests.leaves );
+			}
+			if( mode != umNone && (stored.modifyUTC != digests.modifyUTC || mode > umUpdate) )
+			{
+				database.store( fileName, digests );
+				std::cerr << "\t\t... updated" << std::endl;
+				if( mode == umTouch )
+				{
+#ifdef _Windows
+					unsigned long attr = GetFileAttributes( fileName );
+					attr &= ~FILE_ATTRIBUTE_READONLY;
+					SetFileAttributes( fileName, attr );
+#endif
+					setModTime(fileName, time(nullptr));
+				}
+			}
+		}
+		else if( digests.present & ~stored.present )
+		{
+			stored.addMissing( digests );
+			database.store( fileName, stored );
+		}
+	}
+	else
+	{
+		database.store( fileName, digests );
+	}
+}
+
+/*
+	the key for detecting renamed files: the size and the strongest digest
+*/
+static std::string renameKey( const Digests &digests )
+{
+	std::string	key( reinterpret_cast<const char *>( &digests.fileSize ), sizeof( digests.fileSize ) );
+
+	if( digests.present & dbSHA512 )
+		key.append( "5" ).append( reinterpret_cast<const char *>( &digests.sha512Digest ), sizeof( digests.sha512Digest ) );
+	else if( digests.present & dbSHA384 )
+		key.append( "3" ).append( reinterpret_cast<const char *>( &digests.sha384Digest ), sizeof( digests.sha384Digest ) );
+	else if( digests.present & dbSHA256 )
+		key.append( "2" ).append( reinterpret_cast<const char *>( &digests.sha256Digest ), sizeof( digests.sha256Digest ) );
+	else if( digests.present & dbTree )
+		key.append( "T" ).append( reinterpret_cast<const char *>( &digests.treeDigest ), sizeof( digests.treeDigest ) );
+	else if( digests.present & dbSHA224 )
+		key.append( "4" ).append( reinterpret_cast<const char *>( &digests.sha224Digest ), sizeof( digests.sha224Digest ) );
+	else if( digests.present & dbMD5 )
+		key.append( "M" ).append( reinterpret_cast<const char *>( &digests.md5Digest ), sizeof( digests.md5Digest ) );
+
+	return key;
+}
+
+static bool nextInPrefix( HashDatabase::Scanner &scanner, const std::string &prefix )
+{
+	return scanner.next() && !scanner.getPath().compare( 0, prefix.size(), prefix );
+}
+
+/*
+	merge joins two hash databases in path order, below the prefixes only.
+	Subtrees with equal directory digests are skipped. Files only in one
+	of the databases are matched by their content to find renamed files.
+*/
+static int compareHashFiles( const CommandLine &cmdLine )
+{
+	typedef std::multimap<std::string, std::string>	RemovedMap;
+	typedef std::pair<std::string, std::string>		AddedEntry;
+
+	std::vector<const char *>	args;
+	for( const char **argv = cmdLine.argv + 1; *argv; ++argv )
+	{
+		args.push_back( *argv );
+	}
+	if( args.size() != 2 && args.size() != 4 )
+	{
+		throw CmdlineError( "Compare needs two hash files and optionally two path prefixes." );
+	}
+
+	std::string	prefixes[2];
+	if( args.size() == 4 )
+	{
+		for( std::size_t i=0; i<2; ++i )
+		{
+			prefixes[i] = toPath( fullPath( args[2+i] ) );
+			if( prefixes[i].empty() || prefixes[i][prefixes[i].size()-1] != DIRECTORY_DELIMITER )
+			{
+				prefixes[i] += DIRECTORY_DELIMITER;
+			}
+		}
+	}
+
+	HashDatabase	databaseA, databaseB;
+	databaseA.open( args[0] );
+	databaseB.open( args[1] );
+
+	HashDatabase::Scanner	scannerA( databaseA ), scannerB( databaseB );
+	scannerA.seek( prefixes[0] );
+	scannerB.seek( prefixes[1] );
+	bool	validA = nextInPrefix( scannerA, prefixes[0] );
+	bool	validB = nextInPrefix( scannerB, prefixes[1] );
+
+	RemovedMap				removed;
+	std::vector<AddedEntry>	added;
+	std::size_t				numChanged = 0, numSkipped = 0;
+
+	while( validA || validB )
+	{
+		const std::string	pathA = validA ? scannerA.getPath().substr( prefixes[0].size() ) : std::string();
+		const std::string	pathB = validB ? scannerB.getPath().substr( prefixes[1].size() ) : std::string();
+		const int			compareResult = !validA ? 1 : !validB ? -1 : pathA.compare( pathB );
+
+		if( compareResult < 0 )
+		{
+			if( !(scannerA.getDigests().present & dbDirectory) )
+			{
+				removed.insert( RemovedMap::value_type( renameKey( scannerA.getDigests() ), pathA ) );
+			}
+			validA = nextInPrefix( scannerA, prefixes[0] );
+		}
+		else if( compareResult > 0 )
+		{
+			if( !(scannerB.getDigests().present & dbDirectory) )
+			{
+				added.push_back( AddedEntry( pathB, renameKey( scannerB.getDigests() ) ) );
+			}
+			validB = nextInPrefix( scannerB, prefixes[1] );
+		}
+		else
+		{
+			const Digests	&digestsA = scannerA.getDigests();
+			const Digests	&digestsB = scannerB.getDigests();
+
+			if( (digestsA.present & digestsB.present & dbDirectory) && digestsA.sameContent( digestsB ) )
+			{
+				// continue behind the subtree, the path ends with the delimiter
+				std::string	behind = scannerA.getPath();
+				++behind[behind.size()-1];
+				scannerA.seek( behind );
+
+				behind = scannerB.getPath();
+				++behind[behind.size()-1];
+				scannerB.seek( behind );
+
+				++numSkipped;
+			}
+			else if( !(digestsA.present & dbDirectory) && !digestsA.sameContent( digestsB ) )
+			{
+				std::cout << "* " << pathA << std::endl;
+				++numChanged;
+			}
+			validA = nextInPrefix( scannerA, prefixes[0] );
+			validB = nextInPrefix( scannerB, prefixes[1] );
+		}
+	}
+
+	std::size_t	numAdded = 0, numRenamed = 0;
+	for(
+		std::vector<AddedEntry>::const_iterator it = added.cbegin(), endIT = added.cend();
+		it != endIT;
+		++it
+	)
+	{
+		RemovedMap::iterator	source = removed.find( it->second );
+		if( source != removed.end() )
+		{
+			std::cout << "> " << source->second << " -> " << it->first << std::endl;
+			removed.erase( source );
+			++numRenamed;
+		}
+		else
+		{
+			std::cout << "+ " << it->first << std::endl;
+			++numAdded;
+		}
+	}
+
+	std::vector<std::string>	removedPaths;
+	for(
+		RemovedMap::const_iterator it = removed.cbegin(), endIT = removed.cend();
+		it != endIT;
+		++it
+	)
+	{
+		removedPaths.push_back( it->second );
+	}
+	std::sort( removedPaths.begin(), removedPaths.end() );
+	for(
+		std::vector<std::string>::const_iterator it = removedPaths.cbegin(), endIT = removedPaths.cend();
+		it != endIT;
+		++it
+	)
+	{
+		std::cout << "- " << *it << std::endl;
+	}
+
+	std::cout << "\nAdded  : " << numAdded
+		<< "\nRemoved: " << removedPaths.size()
+		<< "\nChanged: " << numChanged
+		<< "\nRenamed: " << numRenamed
+		<< "\nSkipped: " << numSkipped << " unchanged directories" << std::endl;
+
+	return EXIT_SUCCESS;
+}
+
+static bool isSelected( const F_STRING &fileName, bool executables )
+{
+	if( !executables )
+	{
+		return true;
+	}
+
+	F_STRING	extension = fsplit( fileName );
+
+	return extension == "exe" || extension == "dll" || extension == "com" || extension == "sys" 
+		|| extension == "cmd" || extension == "bat" 
+		|| extension == "ttf" || extension == "fon";
+}
+
+/*
+	the pre count for the remaining time, errors are reported when hashing
+*/
+static void countDirectory( const STRING &directoryName, bool executables, uint64 *numFiles, uint64 *numBytes )
+{
+	DirectoryList	dirList;
+	F_STRING		path = directoryName;
+	if( !path.endsWith( DIRECTORY_DELIMITER ) )
+	{
+		path += DIRECTORY_DELIMITER;
+	}
+
+	try
+	{
+		dirList.dirlist( path );
+	}
+	catch( ... )
+	{
+		return;
+	}
+	for( 
+		DirectoryList::const_iterator it = dirList.cbegin(), endIT = dirList.cend();
+		it != endIT;
+		++it
+	)
+	{
+		if( it->fileName == "." || it->fileName == ".." )
+			continue;
+
+		F_STRING	fileName = path + it->fileName;
+
+		if( isFile( fileName ) )
+		{
+			if( isSelected( fileName, executables ) )
+			{
+				++*numFiles;
+				*numBytes += it->fileSize;
+			}
+		}
+		else
+		{
+			countDirectory( fileName, executables, numFiles, numBytes );
+		}
+	}
+}
+
+static void hashDirectory( const STRING &directoryName, bool executables, HashScheduler &scheduler )
+{
+	DirectoryList				dirList;
+	std::vector<std::string>	children;
+	F_STRING	path = directoryName;
+	if( !path.endsWith( DIRECTORY_DELIMITER ) )
+	{
+		path += DIRECTORY_DELIMITER;
+	}
+
+	s_progress.setDirectory( directoryName );
+	s_progress.print();
+
+	try
+	{
+		dirList.dirlist( path );
+	}
+	catch( std::exception &e )
+	{
+		std::cerr << "Cannot read directory " << path << ": " << e.what() << std::endl;
+		return;
+	}
+	catch( ... )
+	{
+		std::cerr << "Cannot read directory " << path << std::endl;
+		return;
+	}
+	for( 
+		DirectoryList::const_iterator it = dirList.cbegin(), endIT = dirList.cend();
+		it != endIT;
+		++it
+	)
+	{
+		if( it->fileName == "." || it->fileName == ".." )
+			continue;
+
+		F_STRING	fileName = path + it->fileName;
+
+		if( isFile( fileName ) )
+		{
+			if( isSelected( fileName, executables ) )
+			{
+				scheduler.hashFile( fileName, *it );
+				children.push_back( toPath( it->fileName ) );
+			}
+		}
+		else
+		{
+			hashDirectory( fileName, executables, scheduler );
+			children.push_back( toPath( it->fileName ) + DIRECTORY_DELIMITER );
+		}
+	}
+
+	// all children were passed to the scheduler before
+	scheduler.addDirectory( path, children );
+}
+
+static int hash( const CommandLine &cmdLine )
+{
+	if( cmdLine.flags & COMPARE )
+	{
+		return compareHashFiles( cmdLine );
+	}
+
+	const char	**argv = cmdLine.argv + 1;
+	const char	*arg;
+
+	const bool	silent = cmdLine.flags & SILENT;
+	UpdateMode	mode;
+	if( cmdLine.flags & TOUCH_CHANGED )
+		mode = umTouch;
+	else if( cmdLine.flags & FORCE_UPDATE )
+		mode = umForce;
+	else if( cmdLine.flags & UPDATE )
+		mode = umUpdate;
+	else
+		mode = umNone;
+	const bool	executables = cmdLine.flags & EXECUTABLES;
+	std::size_t	numThreads = 0;
+	if( cmdLine.flags & PARALLEL )
+	{
+		numThreads = getValueE<std::size_t>( cmdLine.parameter['P'][0] );
+	}
+	unsigned	verifyRate = 0;
+	if( cmdLine.flags & VERIFY_RATE )
+	{
+		verifyRate = getValueE<unsigned>( cmdLine.parameter['V'][0] );
+	}
+	if( verifyRate > 100 || (verifyRate && !(cmdLine.flags & QUICK)) )
+	{
+		throw CmdlineError( "Verify rate requires quick mode and must not exceed 100." );
+	}
+	const unsigned	digestSet = cmdLine.flags & DIGEST_SET
+		? parseDigestSet( cmdLine.parameter['D'][0] )
+		: unsigned(dbAll);
+
+	selectSha256Kernel();
+
+	F_STRING	hashFile = cmdLine.flags & HASH_FILE ? cmdLine.parameter['H'][0] : NULL_STRING;
+
+	HashDatabase	database;
+
+	if( !hashFile.isEmpty() )
+	{
+		database.open( hashFile );
+	}
+
+	std::vector<F_STRING>	fileArgs;
+	while( (arg = *argv++) != NULL )
+	{
+		fileArgs.push_back( fullPath( arg ) );
+	}
+	if( fileArgs.empty() )
+	{
+		throw CmdlineError();
+	}
+
+	s_progress.start( numThreads ? numThreads : 1, digestSet );
+	if( cmdLine.flags & PRE_COUNT )
+	{
+		uint64	numFiles = 0, numBytes = 0;
+		for( std::size_t i=0; i<fileArgs.size(); ++i )
+		{
+			if( isFile( fileArgs[i] ) )
+			{
+				++numFiles;
+				numBytes += DirectoryEntry( fileArgs[i] ).fileSize;
+			}
+			else
+			{
+				countDirectory( fileArgs[i], executables, &numFiles, &numBytes );
+			}
+		}
+		s_progress.setTotal( numFiles, numBytes );
+	}
+	else
+	{
+		// estimate from the directory digests of the previous run
+		uint64	numBytes = 0;
+		Digests	stored;
+		for( std::size_t i=0; i<fileArgs.size(); ++i )
+		{
+			F_STRING	path = fileArgs[i];
+			if( !isFile( path ) && !path.endsWith( DIRECTORY_DELIMITER ) )
+			{
+				path += DIRECTORY_DELIMITER;
+			}
+			if( !database.find( path, &stored ) )
+			{
+				numBytes = 0;
+				break;
+			}
+			numBytes += stored.fileSize;
+		}
+		s_progress.setTotal( 0, numBytes );
+	}
+
+	{
+		HashScheduler	scheduler( silent, mode, digestSet, cmdLine.flags & DIRECT_IO, numThreads, database );
+		if( cmdLine.flags & QUICK )
+		{
+			scheduler.setQuickMode( verifyRate );
+		}
+
+		for( std::size_t i=0; i<fileArgs.size(); ++i )
+		{
+			if( isFile( fileArgs[i] ) )
+			{
+				scheduler.hashFile( fileArgs[i], DirectoryEntry( fileArgs[i] ) );
+			}
+			else
+			{
+				hashDirectory( fileArgs[i], executables, scheduler );
+			}
+		}
+		scheduler.flush();
+		s_progress.print( true );
+		std::cout << std::endl;
+
+		if( cmdLine.flags & QUICK )
+		{
+			std::cout << "\nUnchanged: " << scheduler.getUnchangedCount()
+				<< "\nVerified : " << scheduler.getSampleCount() << std::endl;
+		}
+		if( !silent )
+		{
+			s_progress.printSummary();
+		}
+	}
+
+	database.flush( cmdLine.flags & COMPACT );
+
+	return EXIT_SUCCESS;
+}
+
+// --------------------------------------------------------------------- //
+// ----- class inlines ------------------------------------------------- //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- class constructors/destructors -------------------------------- //
+// --------------------------------------------------------------------- //
+
+DigestEngine::DigestEngine( unsigned digestSet, bool pipelined, bool directIO )
+: m_digestSet( digestSet ), m_pipelined( pipelined ), m_directIO( directIO ), m_numHashers( 0 ),
+  m_treeThreads( pipelined ? std::max( 1U, std::thread::hardware_concurrency() ) : 1 )
+{
+	const bool	sha2Accel = SHA256Accel::isAvailable();
+
+	if( digestSet & dbMD5 )
+	{
+		m_hashers[m_numHashers++].reset( new ChunkHasherT<MD5Hash, &Digests::md5Digest> );
+	}
+	if( digestSet & dbSHA224 )
+	{
+		if( sha2Accel )
+			m_hashers[m_numHashers++].reset( new AccelHasherT<SHA224Hash::Digest, &Digests::sha224Digest, true> );
+		else
+			m_hashers[m_numHashers++].reset( new ChunkHasherT<SHA224Hash, &Digests::sha224Digest> );
+	}
+	if( digestSet & dbSHA256 )
+	{
+		if( sha2Accel )
+			m_hashers[m_numHashers++].reset( new AccelHasherT<SHA256Hash::Digest, &Digests::sha256Digest, false> );
+		else
+			m_hashers[m_numHashers++].reset( new ChunkHasherT<SHA256Hash, &Digests::sha256Digest> );
+	}
+	if( digestSet & dbSHA384 )
+	{
+		m_hashers[m_numHashers++].reset( new ChunkHasherT<SHA384Hash, &Digests::sha384Digest> );
+	}
+	if( digestSet & dbSHA512 )
+	{
+		m_hashers[m_numHashers++].reset( new ChunkHasherT<SHA512Hash, &Digests::sha512Digest> );
+	}
+
+	// with one algorithm there is nothing to overlap
+	m_pipelined = pipelined && m_numHashers > 1;
+	if( m_pipelined )
+	{
+		for( std::size_t i=0; i<m_numHashers; ++i )
+		{
+			m_threads[i] = new HashThread( *m_hashers[i], m_doneQueue );
+		}
+	}
+}
+
+DigestEngine::~DigestEngine()
+{
+	if( m_pipelined )
+	{
+		for( std::size_t i=0; i<m_numHashers; ++i )
+		{
+			m_threads[i]->terminate();
+		}
+		for( std::size_t i=0; i<m_numHashers; ++i )
+		{
+			m_threads[i]->join();
+		}
+	}
+}
+
+HashScheduler::HashScheduler(
+	bool silent, UpdateMode mode, unsigned digestSet, bool directIO, std::size_t numThreads,
+	HashDatabase &database
+)
+: m_silent( silent ), m_mode( mode ), m_digestSet( digestSet ), m_directIO( directIO ), m_database( database ),
+  m_maxJobs( numThreads * MAX_JOBS_PER_THREAD ), m_nextSequence( 0 ), m_nextStore( 0 ),
+  m_quick( false ), m_verifyRate( 0 ), m_unchangedCount( 0 ), m_sampleCount( 0 )
+{
+	if( numThreads )
+	{
+		m_pool.reset( new ThreadPool<HashJobPtr>( numThreads, "HashPool" ) );
+		m_pool->start();
+	}
+	else
+	{
+		m_engine.reset( new DigestEngine( digestSet, true, directIO ) );
+	}
+}
+
+HashScheduler::~HashScheduler()
+{
+	if( m_pool )
+	{
+		m_pool->shutdown();
+	}
+}
+
+InputFile::InputFile( const STRING &fileName, bool direct )
+: m_fileName( fileName ), m_direct( false ), m_dropCache( false ), m_size( 0 ), m_offset( 0 )
+{
+#ifdef _Windows
+	m_handle = CreateFileA(
+		fileName, GENERIC_READ, FILE_SHARE_READ|FILE_SHARE_WRITE, NULL, OPEN_EXISTING,
+		FILE_FLAG_SEQUENTIAL_SCAN | (direct ? FILE_FLAG_NO_BUFFERING : 0), NULL
+	);
+	if( m_handle == INVALID_HANDLE_VALUE )
+	{
+		throw OpenReadError( fileName ).addCerror();
+	}
+	m_direct = direct;
+
+	LARGE_INTEGER	size;
+	if( GetFileSizeEx( m_handle, &size ) )
+	{
+		m_size = uint64(size.QuadPart);
+	}
+#else
+	int	flags = O_RDONLY;
+#	ifdef O_DIRECT
+	if( direct )
+	{
+		flags |= O_DIRECT;
+		m_direct = true;
+	}
+#	endif
+	m_handle = ::open( fileName, flags );
+	if( m_handle < 0 && m_direct && errno == EINVAL )
+	{
+		// the file system does not support direct I/O
+		m_handle = ::open( fileName, O_RDONLY );
+		m_direct = false;
+	}
+	if( m_handle < 0 )
+	{
+		throw OpenReadError( fileName ).addCerror();
+	}
+#	ifdef F_NOCACHE
+	if( direct )
+	{
+		fcntl( m_handle, F_NOCACHE, 1 );
+	}
+#	else
+	m_dropCache = direct && !m_direct;
+#	endif
+
+	struct stat	statBuff;
+	if( !fstat( m_handle, &statBuff ) )
+	{
+		m_size = uint64(statBuff.st_size);
+	}
+#	ifdef POSIX_FADV_SEQUENTIAL
+	posix_fadvise( m_handle, 0, 0, POSIX_FADV_SEQUENTIAL );
+#	endif
+#endif
+}
+
+InputFile::~InputFile()
+{
+	if( m_readAhead )
+	{
+		m_readAhead->terminate();
+		m_readAhead->join();
+	}
+#ifdef _Windows
+	CloseHandle( m_handle );
+#else
+	::close( m_handle );
+#endif
+}
+
+HashDatabase::Cursor::Cursor( const HashDatabase &db, uint64 block )
+: m_db( db )
+{
+	setBlock( block );
+}
+
+HashDatabase::Scanner::Scanner( const HashDatabase &db )
+: m_db( db ), m_cursor( db ), m_change( db.m_changes.cbegin() )
+{
+	m_baseValid = m_cursor.next();
+}
+
+DbWriter::DbWriter( const STRING &fileName )
+: m_fileName( fileName ), m_pathsName( fileName + DB_PATHS_EXT ), m_leavesName( fileName + DB_LEAVES_EXT ),
+  m_out( fileName, std::ios::binary ), m_paths( m_pathsName, std::ios::binary ),
+  m_leaves( m_leavesName, std::ios::binary ),
+  m_numEntries( 0 ), m_pathSize( 0 ), m_numLeaves( 0 )
+{
+	if( !m_out || !m_paths || !m_leaves )
+	{
+		throw OpenWriteError( fileName ).addCerror();
+	}
+
+	DbHeader	header;
+	std::memset( &header, 0, sizeof( header ) );
+	m_out.write( reinterpret_cast<const char *>( &header ), sizeof( header ) );
+}
+
+// --------------------------------------------------------------------- //
+// ----- class static functions ---------------------------------------- //
+// --------------------------------------------------------------------- //
+
+bool SHA256Accel::isAvailable()
+{
+	return s_sha256Blocks != nullptr;
+}
+
+// --------------------------------------------------------------------- //
+// ----- class privates ------------------------------------------------ //
+// --------------------------------------------------------------------- //
+
+uint64 HashDatabase::getBlockOffset( uint64 block ) const
+{
+	uint64	offset;
+	std::memcpy(
+		&offset, m_base.getData() + m_header.blockOffset + block * sizeof( uint64 ), sizeof( offset )
+	);
+	return offset;
+}
+
+DbRecord HashDatabase::getRecord( uint64 index ) const
+{
+	DbRecord	record;
+	std::memcpy(
+		&record, m_base.getData() + sizeof( DbHeader ) + index * sizeof( DbRecord ), sizeof( record )
+	);
+	return record;
+}
+
+void HashDatabase::readDigests( uint64 index, Digests *digests ) const
+{
+	const DbRecord	record = getRecord( index );
+
+	record.toDigests( digests );
+	digests->leaves.clear();
+	if( record.present & dbTree )
+	{
+		if( record.firstLeaf > m_header.numLeaves || record.leafCount > m_header.numLeaves - record.firstLeaf )
+		{
+			throw std::runtime_error( "Corrupt hash database" );
+		}
+		digests->leaves.resize( std::size_t(record.leafCount) );
+		if( record.leafCount )
+		{
+			std::memcpy(
+				&digests->leaves[0],
+				m_base.getData() + m_header.leafOffset + record.firstLeaf * sizeof( SHA256Hash::Digest ),
+				std::size_t(record.leafCount) * sizeof( SHA256Hash::Digest )
+			);
+		}
+	}
+}
+
+/*
+	returns the last block whose first path is not greater than path or
+	numBlocks, if there is none
+*/
+uint64 HashDatabase::findBlock( const std::string &path ) const
+{
+	const char	*end = m_base.getData() + m_base.getSize();
+	uint64		low = 0, high = m_header.numBlocks;
+
+	while( low < high )
+	{
+		const uint64	mid = (low + high) / 2;
+		const char		*pos = m_base.getData() + m_header.pathOffset + getBlockOffset( mid );
+
+		readVarint( pos, end );			// the first path shares nothing
+		const uint64	len = readVarint( pos, end );
+		if( len > uint64(end - pos) )
+		{
+			throw std::runtime_error( "Corrupt hash database" );
+		}
+		if( comparePath( path, pos, std::size_t(len) ) < 0 )
+			high = mid;
+		else
+			low = mid + 1;
+	}
+
+	return low ? low-1 : m_header.numBlocks;
+}
+
+/*
+	maps the base file and checks, whether the tables fit into the file
+*/
+void HashDatabase::openBase()
+{
+	if( !m_base.open( m_fileName ) )
+	{
+		return;
+	}
+	if( m_base.getSize() < sizeof( DbHeader ) )
+	{
+		throw std::runtime_error( std::string( "Corrupt hash database " ) + m_fileName.c_str() );
+	}
+	std::memcpy( &m_header, m_base.getData(), sizeof( m_header ) );
+	if( m_header.magic != dbMagic || m_header.version != dbVersion
+	|| m_header.recordSize != sizeof( DbRecord ) || !m_header.blockEntries
+	|| m_header.blockOffset != sizeof( DbHeader ) + m_header.numEntries * sizeof( DbRecord )
+	|| m_header.leafOffset != m_header.blockOffset + m_header.numBlocks * sizeof( uint64 )
+	|| m_header.pathOffset != m_header.leafOffset + m_header.numLeaves * sizeof( SHA256Hash::Digest )
+	|| m_header.pathOffset > m_base.getSize() )
+	{
+		throw std::runtime_error( std::string( "Corrupt hash database " ) + m_fileName.c_str() );
+	}
+	m_base.adviseRandom();
+}
+
+/*
+	converts a hash file of version 2, it is replaced by the database
+	when flushed
+*/
+void HashDatabase::importLegacy()
+{
+	LegacyDigestMap	legacyDigests;
+
+	readFromBinaryFile( m_fileName, &legacyDigests, magic, legacyVersion, true );	// skip size comparision
+	for(
+		LegacyDigestMap::const_iterator it = legacyDigests.cbegin(), endIT = legacyDigests.cend();
+		it != endIT;
+		++it
+	)
+	{
+		m_changes[toPath( it->getKey() )] = Digests( it->getValue() );
+	}
+	m_compact = true;
+}
+
+/*
+	reads the changes of the previous runs. A record, that was not written
+	completely, is ignored and the database is rewritten immediately,
+	since new entries cannot be appended behind it.
+*/
+void HashDatabase::replayLog()
+{
+	std::ifstream	log( m_fileName + DB_LOG_EXT, std::ios::binary );
+	if( !log )
+	{
+		return;
+	}
+
+	uint32		pathLen;
+	std::string	path;
+	DbRecord	record;
+	Digests		digests;
+	bool		truncated = false;
+
+	while( log.read( reinterpret_cast<char *>( &pathLen ), sizeof( pathLen ) ) )
+	{
+		path.resize( pathLen );
+		if( !log.read( &path[0], pathLen )
+		|| !log.read( reinterpret_cast<char *>( &record ), sizeof( record ) )
+		|| record.leafCount > MAX_TREE_LEAVES )
+		{
+			truncated = true;
+			break;
+		}
+		record.toDigests( &digests );
+		digests.leaves.resize( std::size_t(record.leafCount) );
+		if( record.leafCount && !log.read(
+			reinterpret_cast<char *>( &digests.leaves[0] ),
+			std::streamsize(record.leafCount * sizeof( SHA256Hash::Digest ))
+		) )
+		{
+			truncated = true;
+			break;
+		}
+		m_changes[path] = digests;
+		++m_logEntries;
+	}
+	if( log.gcount() )		// a part of the path length was read
+	{
+		truncated = true;
+	}
+	log.close();
+
+	if( truncated )
+	{
+		std::cerr << "Incomplete update log of " << m_fileName << " repaired" << std::endl;
+		compact();
+	}
+}
+
+/*
+	merges the base file and the changes into a new base file
+*/
+void HashDatabase::compact()
+{
+	const STRING	tempName = m_fileName + DB_TEMP_EXT;
+	{
+		DbWriter	writer( tempName );
+		Scanner		scanner( *this );
+
+		while( scanner.next() )
+		{
+			writer.add( scanner.getPath(), scanner.getDigests() );
+		}
+		writer.finish();
+	}
+
+	m_log.close();
+	m_base.close();
+	// replaces the base file at once, a crash leaves the old or the new one
+#ifdef _Windows
+	if( !MoveFileExA( tempName, m_fileName, MOVEFILE_REPLACE_EXISTING|MOVEFILE_WRITE_THROUGH ) )
+#else
+	if( std::rename( tempName, m_fileName ) )
+#endif
+	{
+		throw OpenWriteError( m_fileName ).addCerror();
+	}
+
+	const STRING	logName = m_fileName + DB_LOG_EXT;
+	if( exists( logName ) )
+	{
+		strRemove( logName );
+	}
+
+	m_changes.clear();
+	m_logEntries = 0;
+	m_compact = false;
+	std::memset( &m_header, 0, sizeof( m_header ) );
+	openBase();
+}
+
+void DbWriter::writeVarint( uint64 value )
+{
+	while( value >= 0x80 )
+	{
+		m_paths.put( char(value | 0x80) );
+		value >>= 7;
+		++m_pathSize;
+	}
+	m_paths.put( char(value) );
+	++m_pathSize;
+}
+
+/*
+	in quick mode, files with the same size and modification time as in
+	the hash file are trusted, except for a random sample
+*/
+bool HashScheduler::isUnchanged( const STRING &fileName, const DirectoryEntry &dirEntry )
+{
+	Digests	stored;
+	if( !m_quick || !m_database.find( fileName, &stored ) )
+	{
+		return false;
+	}
+
+	if( (stored.present & m_digestSet) != m_digestSet
+	|| stored.fileSize != uint64(dirEntry.fileSize)
+	|| stored.modifyUTC != uint64(dirEntry.modifiedDate.getUtcUnixSeconds()) )
+	{
+		return false;
+	}
+
+	if( m_verifyRate && unsigned(randomNumber( 100 )) < m_verifyRate )
+	{
+		++m_sampleCount;
+		return false;
+	}
+
+	++m_unchangedCount;
+	s_progress.fileSkipped( stored.fileSize );
+	return true;
+}
+
+/*
+	the digest of a directory covers the sorted names and the content
+	digests of its files and subdirectories. It is stored with the
+	delimiter appended to the path.
+*/
+void HashScheduler::storeDirectory( const STRING &path, const std::vector<std::string> &children )
+{
+	static const uint8	missing = 0;
+
+	TreeNodeHash	hash;
+	Digests			dirDigests, child;
+
+	hash.start();
+	for(
+		std::vector<std::string>::const_iterator it = children.cbegin(), endIT = children.cend();
+		it != endIT;
+		++it
+	)
+	{
+		hash.update( it->c_str(), it->size()+1 );
+		if( m_database.find( path + it->c_str(), &child ) )
+		{
+			hashContent( hash, child );
+			dirDigests.fileSize += child.fileSize;
+		}
+		else
+		{
+			hash.update( &missing, sizeof( missing ) );
+		}
+	}
+	hash.finish( &dirDigests.sha256Digest );
+	dirDigests.present = dbDirectory;
+
+	Digests	stored;
+	if( !m_database.find( path, &stored ) || stored.present != dbDirectory
+	|| stored.fileSize != dirDigests.fileSize || stored.sha256Digest != dirDigests.sha256Digest )
+	{
+		m_database.store( path, dirDigests );
+	}
+}
+
+/*
+	stores all finished files that are next in order
+*/
+void HashScheduler::storeFinished()
+{
+	std::map<std::size_t, HashJobPtr>::iterator	it;
+	while( (it = m_finished.find( m_nextStore )) != m_finished.end() )
+	{
+		const HashJob	&job = *it->second;
+
+		if( job.directory )
+		{
+			storeDirectory( job.fileName, job.children );
+		}
+		else if( job.error.isEmpty() )
+		{
+			storeDigests( job.fileName, job.digests, m_silent, m_mode, m_database );
+		}
+		else
+		{
+			std::cerr << "Cannot hash " << job.fileName << ": " << job.error << std::endl;
+		}
+		if( !job.directory )
+		{
+			s_progress.fileDone();
+		}
+		m_finished.erase( it );
+		++m_nextStore;
+	}
+}
+
+void HashScheduler::waitForResult()
+{
+	bool waited = false;
+	if( m_results.size() || (waited=m_results.wait( 2000 ))==true )
+	{
+		HashJobPtr	job = m_results.pop();
+		if( waited )
+		{
+			m_results.unlock();
+		}
+		m_finished[job->sequence] = job;
+		storeFinished();
+	}
+}
+
+void DigestEngine::hashSequential( InputFile &file, Digests *digests )
+{
+	for( std::size_t i=0; i<m_numHashers; ++i )
+	{
+		m_hashers[i]->start();
+	}
+	while( true )
+	{
+		const ProgressClock::time_point	readStart = ProgressClock::now();
+		DataChunkPtr					readAhead;
+		DataChunk						*chunk = &m_chunk;
+		if( file.isReadingAhead() )
+		{
+			readAhead = file.nextChunk();
+			chunk = &*readAhead;
+		}
+		else
+		{
+			m_chunk.size = file.read( m_chunk.data, CHUNK_SIZE );
+		}
+		const ProgressClock::time_point	hashStart = ProgressClock::now();
+		s_progress.addIO( hashStart - readStart );
+		if( !chunk->size )
+		{
+			break;
+		}
+		for( std::size_t i=0; i<m_numHashers; ++i )
+		{
+			m_hashers[i]->update( *chunk );
+		}
+		s_progress.addHash( ProgressClock::now() - hashStart );
+	}
+
+	for( std::size_t i=0; i<m_numHashers; ++i )
+	{
+		m_hashers[i]->finish( digests );
+	}
+}
+
+void DigestEngine::hashPipelined( InputFile &file, Digests *digests )
+{
+	for( std::size_t i=0; i<m_numHashers; ++i )
+	{
+		m_hashers[i]->start();
+		m_threads[i]->setTarget( digests );
+	}
+
+	bool	eof = false;
+	try
+	{
+		while( !eof )
+		{
+			// waiting for the hashers
+			const ProgressClock::time_point	hashStart = ProgressClock::now();
+			for( std::size_t i=0; i<m_numHashers; ++i )
+			{
+				m_threads[i]->waitPending( MAX_PENDING_CHUNKS );
+			}
+
+			const ProgressClock::time_point	readStart = ProgressClock::now();
+			DataChunkPtr					chunk = file.nextChunk();
+			eof = !chunk->size;
+			s_progress.addHash( readStart - hashStart );
+			s_progress.addIO( ProgressClock::now() - readStart );
+
+			if( chunk->size )
+			{
+				for( std::size_t i=0; i<m_numHashers; ++i )
+				{
+					m_threads[i]->push( chunk );
+				}
+			}
+		}
+	}
+	catch( ... )
+	{
+		// the hashers must be idle before the engine hashes the next file
+		finishPipeline();
+		throw;
+	}
+	finishPipeline();
+}
+
+/*
+	tells the hash threads to store their digest and waits for all of them
+*/
+void DigestEngine::finishPipeline()
+{
+	DataChunkPtr	endMarker = DataChunkPtr::makeShared();
+	for( std::size_t i=0; i<m_numHashers; ++i )
+	{
+		m_threads[i]->push( endMarker );
+	}
+	const ProgressClock::time_point	hashStart = ProgressClock::now();
+	for( std::size_t done=0; done<m_numHashers; )
+	{
+		bool waited = false;
+		if( m_doneQueue.size() || (waited=m_doneQueue.wait( 2000 ))==true )
+		{
+			m_doneQueue.pop();
+			if( waited )
+			{
+				m_doneQueue.unlock();
+			}
+			++done;
+		}
+	}
+	s_progress.addHash( ProgressClock::now() - hashStart );
+}
+
+/*
+	each thread hashes a contiguous range of leaves
+*/
+void DigestEngine::hashTree( const STRING &fileName, uint64 fileSize, Digests *digests )
+{
+	const uint64	numLeaves = fileSize ? (fileSize + TREE_LEAF_SIZE - 1) / TREE_LEAF_SIZE : 1;
+	const uint64	numThreads = std::min( uint64(m_treeThreads), numLeaves );
+
+	digests->leaves.resize( std::size_t(numLeaves) );
+	if( numThreads <= 1 )
+	{
+		hashLeaves( fileName, 0, numLeaves, m_directIO, &digests->leaves );
+	}
+	else
+	{
+		std::vector< SharedObjectPointer<LeafThread> >	threads;
+
+		for( uint64 i=0; i<numThreads; ++i )
+		{
+			threads.push_back(
+				new LeafThread(
+					fileName, numLeaves*i/numThreads, numLeaves*(i+1)/numThreads, m_directIO, digests->leaves
+				)
+			);
+		}
+		for( std::size_t i=0; i<threads.size(); ++i )
+		{
+			threads[i]->join();
+		}
+		for( std::size_t i=0; i<threads.size(); ++i )
+		{
+			if( !threads[i]->getError().isEmpty() )
+			{
+				throw std::runtime_error( threads[i]->getError().c_str() );
+			}
+		}
+	}
+	treeRoot( digests->leaves, &digests->treeDigest );
+}
+
+// --------------------------------------------------------------------- //
+// ----- class protected ----------------------------------------------- //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- class virtuals ------------------------------------------------ //
+// --------------------------------------------------------------------- //
+
+void ReadAheadThread::ExecuteThread()
+{
+	while( true )
+	{
+		{
+			std::unique_lock<std::mutex>	lock( m_queuedMutex );
+			m_queueFree.wait( lock, [this] { return m_terminate || m_queued < READ_AHEAD_CHUNKS; } );
+			if( m_terminate )
+			{
+				break;
+			}
+			++m_queued;
+		}
+
+		DataChunkPtr	chunk = DataChunkPtr::makeShared();
+		try
+		{
+			chunk->size = m_file.read( chunk->data, CHUNK_SIZE );
+		}
+		catch( std::exception &e )
+		{
+			m_error = e.what();
+			chunk->size = 0;
+		}
+		m_chunks.push( chunk );
+		if( !chunk->size )
+		{
+			break;
+		}
+	}
+}
+
+void LeafThread::ExecuteThread()
+{
+	try
+	{
+		hashLeaves( m_fileName, m_firstLeaf, m_endLeaf, m_directIO, &m_leaves );
+	}
+	catch( std::exception &e )
+	{
+		m_error = e.what();
+	}
+	catch( ... )
+	{
+		m_error = "Unknown error";
+	}
+}
+
+void HashThread::ExecuteThread()
+{
+	while( !m_terminate || m_chunks.size() )
+	{
+		bool waited = false;
+		if( m_chunks.size() || (waited=m_chunks.wait( 2000 ))==true )
+		{
+			DataChunkPtr	chunk = m_chunks.pop();
+			if( waited )
+			{
+				m_chunks.unlock();
+			}
+			if( chunk->size )
+			{
+				m_hasher.update( *chunk );
+			}
+			else
+			{
+				m_hasher.finish( m_digests );
+				m_doneQueue.push( m_digests );
+			}
+			{
+				std::lock_guard<std::mutex>	lock( m_pendingMutex );
+				--m_pending;
+			}
+			m_pendingDone.notify_one();
+		}
+	}
+}
+   
+// --------------------------------------------------------------------- //
+// ----- class publics ------------------------------------------------- //
+// --------------------------------------------------------------------- //
+
+void SHA256Accel::update( const void *data, std::size_t size )
+{
+	const uint8	*bytes = static_cast<const uint8 *>( data );
+
+	m_length += size;
+	if( m_fill )
+	{
+		std::size_t	count = std::min( size, SHA256_BLOCK_SIZE - m_fill );
+		std::memcpy( m_buffer + m_fill, bytes, count );
+		m_fill += count;
+		bytes += count;
+		size -= count;
+		if( m_fill < SHA256_BLOCK_SIZE )
+		{
+			return;
+		}
+		s_sha256Blocks( m_state, m_buffer, 1 );
+		m_fill = 0;
+	}
+	if( size >= SHA256_BLOCK_SIZE )
+	{
+		s_sha256Blocks( m_state, bytes, size / SHA256_BLOCK_SIZE );
+		bytes += size & ~(SHA256_BLOCK_SIZE-1);
+		size &= SHA256_BLOCK_SIZE-1;
+	}
+	std::memcpy( m_buffer, bytes, size );
+	m_fill = size;
+}
+
+void SHA256Accel::finish( uint8 *digest, std::size_t digestSize )
+{
+	const uint64	bitLength = m_length * 8;
+	uint8			padding[2*SHA256_BLOCK_SIZE] = { 0x80 };
+	std::size_t		padSize = (m_fill < SHA256_BLOCK_SIZE-8 ? SHA256_BLOCK_SIZE : 2*SHA256_BLOCK_SIZE) - m_fill;
+
+	for( int i=0; i<8; ++i )
+	{
+		padding[padSize-1-i] = uint8( bitLength >> (8*i) );
+	}
+	update( padding, padSize );
+
+	for( std::size_t i=0; i<digestSize; ++i )
+	{
+		digest[i] = uint8( m_state[i/4] >> (24 - 8*(i%4)) );
+	}
+}
+
+void HashProgress::start( std::size_t numWorkers, unsigned digestSet )
+{
+	m_start = m_lastPrint = ProgressClock::now();
+	m_passes = ((digestSet & dbAll) ? 1 : 0) + ((digestSet & dbTree) ? 1 : 0);
+	m_numWorkers = numWorkers;
+	m_busyNanos.reset( new std::atomic<int64>[numWorkers] );
+	for( std::size_t i=0; i<numWorkers; ++i )
+	{
+		m_busyNanos[i] = 0;
+	}
+}
+
+/*
+	every thread gets a slot for its utilization when it reports first
+*/
+void HashProgress::addBusy( ProgressClock::duration duration )
+{
+	static std::atomic<std::size_t>	s_nextSlot( 0 );
+	static thread_local std::size_t	slot = s_nextSlot++;
+
+	if( slot < m_numWorkers )
+	{
+		m_busyNanos[slot] += toNanos( duration );
+	}
+}
+
+void HashProgress::print( bool force )
+{
+	const ProgressClock::time_point	now = ProgressClock::now();
+	if( !force && now - m_lastPrint < std::chrono::milliseconds( PROGRESS_MILLIS ) )
+	{
+		return;
+	}
+	m_lastPrint = now;
+
+	const double	seconds = std::max( getSeconds(), 0.001 );
+	const uint64	bytes = m_bytes;
+	const uint64	done = bytes + m_skippedBytes;
+
+	std::cout << std::right << std::fixed << std::setprecision( 1 ) << m_files;
+	if( m_totalFiles )
+		std::cout << '/' << m_totalFiles;
+	std::cout << " files " << done / (1024*1024);
+	if( m_totalBytes )
+		std::cout << '/' << m_totalBytes / (1024*1024);
+	std::cout << " MB " << double(m_files) / seconds << " files/s "
+		<< double(bytes) / (1024.0*1024.0) / seconds << " MB/s busy";
+
+	const int64	elapsedNanos = std::max( toNanos( now - m_start ), int64(1) );
+	if( m_numWorkers <= MAX_LISTED_WORKERS )
+	{
+		for( std::size_t i=0; i<m_numWorkers; ++i )
+		{
+			std::cout << ' ' << m_busyNanos[i] * 100 / elapsedNanos;
+		}
+		std::cout << '%';
+	}
+	else
+	{
+		int64	sum = 0, minimum = elapsedNanos;
+		for( std::size_t i=0; i<m_numWorkers; ++i )
+		{
+			sum += m_busyNanos[i];
+			minimum = std::min( minimum, int64(m_busyNanos[i]) );
+		}
+		std::cout << " avg " << sum * 100 / elapsedNanos / int64(m_numWorkers)
+			<< "% min " << minimum * 100 / elapsedNanos << '%';
+	}
+
+	if( m_totalBytes && done <= m_totalBytes )
+	{
+		m_eta.addValue( m_totalBytes - done );
+		std::cout << " ETA " << m_eta;
+	}
+
+	STRING	directory = m_directory;
+	if( directory.strlen() > STATUS_DIR_WIDTH )
+	{
+		directory = "..." + directory.rightString( STATUS_DIR_WIDTH-3 );
+	}
+	std::cout << ' ' << std::left << std::setw( int(STATUS_DIR_WIDTH) ) << directory << " \r" << std::flush;
+}
+
+/*
+	the times are summed over all threads: waiting for data means the run
+	is limited by the disk, otherwise by the CPU
+*/
+void HashProgress::printSummary() const
+{
+	const double	seconds = std::max( getSeconds(), 0.001 );
+	const double	ioSeconds = double(m_ioNanos) / 1e9;
+	const double	hashSeconds = double(m_hashNanos) / 1e9;
+
+	std::cout << std::fixed << std::setprecision( 1 )
+		<< "\nFiles  : " << m_files
+		<< "\nRead   : " << double(m_bytes) / (1024.0*1024.0) << " MB in " << seconds << " s, "
+		<< double(m_bytes) / (1024.0*1024.0) / seconds << " MB/s"
+		<< "\nI/O    : " << ioSeconds << " s waiting for data"
+		<< "\nHashing: " << hashSeconds << " s"
+		<< "\nLimited by " << (ioSeconds > hashSeconds ? "disk" : "CPU") << std::endl;
+}
+
+void HashScheduler::hashFile( const STRING &fileName, const DirectoryEntry &dirEntry )
+{
+	if( isUnchanged( fileName, dirEntry ) )
+	{
+		return;
+	}
+
+	if( !m_pool )
+	{
+		Digests							digests;
+		const ProgressClock::time_point	start = ProgressClock::now();
+
+		m_engine->hashFile( fileName, &digests );
+		s_progress.addBusy( ProgressClock::now() - start );
+
+		digests.fileSize = dirEntry.fileSize;
+		digests.modifyUTC = dirEntry.modifiedDate.getUtcUnixSeconds();
+
+		storeDigests( fileName, digests, m_silent, m_mode, m_database );
+		s_progress.fileDone();
+		s_progress.print();
+		return;
+	}
+
+	while( m_nextSequence - m_nextStore >= m_maxJobs )
+	{
+		waitForResult();
+	}
+	m_pool->process( HashJobPtr::makeShared( fileName, m_nextSequence++, m_digestSet, m_directIO, &m_results ) );
+
+	while( m_results.size() )
+	{
+		waitForResult();
+	}
+	s_progress.print();
+}
+
+/*
+	the directory is stored after all its children
+*/
+void HashScheduler::addDirectory( const STRING &path, std::vector<std::string> &children )
+{
+	std::sort( children.begin(), children.end() );
+
+	if( !m_pool )
+	{
+		storeDirectory( path, children );
+		return;
+	}
+
+	HashJobPtr	job = HashJobPtr::makeShared( path, m_nextSequence++, 0U, false, &m_results );
+	job->directory = true;
+	job->children.swap( children );
+	m_finished[job->sequence] = job;
+	storeFinished();
+}
+
+void HashScheduler::flush()
+{
+	while( m_nextStore < m_nextSequence )
+	{
+		waitForResult();
+		s_progress.print();
+	}
+}
+
+void DigestEngine::hashFile( const STRING &fileName, Digests *digests )
+{
+	InputFile		file( fileName, m_directIO );
+	const uint64	size = file.getSize();
+
+	if( m_digestSet & dbTree )
+	{
+		hashTree( fileName, size, digests );
+	}
+
+	if( m_numHashers )
+	{
+		if( size > CHUNK_SIZE )
+		{
+			file.startReadAhead();
+		}
+		if( m_pipelined && size > CHUNK_SIZE )
+		{
+			hashPipelined( file, digests );
+		}
+		else
+		{
+			hashSequential( file, digests );
+		}
+	}
+	digests->present = uint8( m_digestSet );
+}
+
+void InputFile::seek( uint64 offset )
+{
+#ifdef _Windows
+	LARGE_INTEGER	position;
+	position.QuadPart = LONGLONG(offset);
+	if( !SetFilePointerEx( m_handle, position, NULL, FILE_BEGIN ) )
+#else
+	if( lseek( m_handle, off_t(offset), SEEK_SET ) == off_t(-1) )
+#endif
+	{
+		throw std::runtime_error( std::string( "Seek error " ) + m_fileName.c_str() );
+	}
+	m_offset = offset;
+}
+
+/*
+	fills the buffer unless the end of the file is reached. With direct
+	I/O buffer, size and file offset must be aligned to IO_ALIGNMENT.
+*/
+std::size_t InputFile::read( char *buffer, std::size_t size )
+{
+	const uint64	start = m_offset;
+	std::size_t		total = 0;
+
+	while( total < size )
+	{
+#ifdef _Windows
+		DWORD	count;
+		if( !ReadFile( m_handle, buffer + total, DWORD(size - total), &count, NULL ) )
+		{
+			throw std::runtime_error( std::string( "Read error " ) + m_fileName.c_str() );
+		}
+#else
+		const ssize_t	count = ::read( m_handle, buffer + total, size - total );
+		if( count < 0 )
+		{
+			if( errno == EINTR )
+				continue;
+			throw std::runtime_error( std::string( "Read error " ) + m_fileName.c_str() );
+		}
+#endif
+		if( !count )
+		{
+			break;
+		}
+		total += std::size_t(count);
+		s_progress.addRead( std::size_t(count) );
+		if( m_direct && total % IO_ALIGNMENT )
+		{
+			break;		// end of file, the offset is no longer aligned
+		}
+	}
+	m_offset += total;
+
+#if !defined( _Windows ) && defined( POSIX_FADV_DONTNEED )
+	if( m_dropCache && total )
+	{
+		posix_fadvise( m_handle, off_t(start), off_t(total), POSIX_FADV_DONTNEED );
+	}
+#else
+	(void)start;
+#endif
+
+	return total;
+}
+
+void InputFile::startReadAhead()
+{
+	if( !m_readAhead )
+	{
+		m_readAhead = new ReadAheadThread( *this );
+	}
+}
+
+DataChunkPtr InputFile::nextChunk()
+{
+	if( m_readAhead )
+	{
+		return m_readAhead->pop();
+	}
+
+	DataChunkPtr	chunk = DataChunkPtr::makeShared();
+	chunk->size = read( chunk->data, CHUNK_SIZE );
+	return chunk;
+}
+
+DataChunkPtr ReadAheadThread::pop()
+{
+	DataChunkPtr	chunk;
+	while( !chunk )
+	{
+		bool waited = false;
+		if( m_chunks.size() || (waited=m_chunks.wait( 2000 ))==true )
+		{
+			chunk = m_chunks.pop();
+			if( waited )
+			{
+				m_chunks.unlock();
+			}
+		}
+	}
+	{
+		std::lock_guard<std::mutex>	lock( m_queuedMutex );
+		--m_queued;
+		m_queueFree.notify_one();
+	}
+	if( !chunk->size && !m_error.isEmpty() )
+	{
+		throw std::runtime_error( m_error.c_str() );
+	}
+	return chunk;
+}
+
+void HashDatabase::Cursor::setBlock( uint64 block )
+{
+	m_path.clear();
+	if( block < m_db.m_header.numBlocks )
+	{
+		m_pos = m_db.m_base.getData() + m_db.m_header.pathOffset + m_db.getBlockOffset( block );
+		m_end = m_db.m_base.getData() + m_db.m_base.getSize();
+		m_index = block * m_db.m_header.blockEntries;
+		m_endIndex = m_db.m_header.numEntries;
+	}
+	else
+	{
+		m_pos = m_end = nullptr;
+		m_index = m_endIndex = 0;
+	}
+}
+
+bool HashDatabase::Cursor::next()
+{
+	if( m_index >= m_endIndex )
+	{
+		return false;
+	}
+
+	const uint64	shared = readVarint( m_pos, m_end );
+	const uint64	suffixLen = readVarint( m_pos, m_end );
+	if( shared > m_path.size() || suffixLen > uint64(m_end - m_pos) )
+	{
+		throw std::runtime_error( "Corrupt hash database" );
+	}
+	m_path.resize( std::size_t(shared) );
+	m_path.append( m_pos, std::size_t(suffixLen) );
+	m_pos += suffixLen;
+	++m_index;
+
+	return true;
+}
+
+void HashDatabase::Scanner::seek( const std::string &path )
+{
+	const uint64	block = m_db.findBlock( path );
+
+	m_cursor.setBlock( block < m_db.m_header.numBlocks ? block : 0 );
+	m_baseValid = m_cursor.next();
+	while( m_baseValid && comparePath( m_cursor.getPath(), path.data(), path.size() ) < 0 )
+	{
+		m_baseValid = m_cursor.next();
+	}
+	m_change = m_db.m_changes.lower_bound( path );
+}
+
+bool HashDatabase::Scanner::next()
+{
+	const ChangeMap::const_iterator	endChange = m_db.m_changes.cend();
+	if( !m_baseValid && m_change == endChange )
+	{
+		return false;
+	}
+
+	const int	compareResult = !m_baseValid
+		? 1
+		: m_change == endChange
+			? -1
+			: comparePath( m_cursor.getPath(), m_change->first.data(), m_change->first.size() );
+
+	if( compareResult < 0 )
+	{
+		m_path = m_cursor.getPath();
+		m_cursor.getDigests( &m_digests );
+		m_baseValid = m_cursor.next();
+	}
+	else
+	{
+		m_path = m_change->first;
+		m_digests = m_change->second;
+		if( !compareResult )
+		{
+			m_baseValid = m_cursor.next();
+		}
+		++m_change;
+	}
+
+	return true;
+}
+
+/*
+	the old hash files are converted, the update log is read into memory
+*/
+void HashDatabase::open( const STRING &fileName )
+{
+	m_fileName = fileName;
+
+	uint32	fileMagic = 0;
+	{
+		std::ifstream	stream( fileName, std::ios::binary );
+		stream.read( reinterpret_cast<char *>( &fileMagic ), sizeof( fileMagic ) );
+	}
+	if( fileMagic == dbMagic )
+	{
+		openBase();
+	}
+	else if( isFile( fileName ) )
+	{
+		importLegacy();
+	}
+	replayLog();
+}
+
+bool HashDatabase::find( const STRING &fileName, Digests *digests ) const
+{
+	const std::string	path = toPath( fileName );
+
+	ChangeMap::const_iterator	it = m_changes.find( path );
+	if( it != m_changes.cend() )
+	{
+		*digests = it->second;
+		return true;
+	}
+
+	const uint64	block = findBlock( path );
+	if( block >= m_header.numBlocks )
+	{
+		return false;
+	}
+
+	Cursor	cursor( *this, block );
+	for( std::size_t i=0; i<m_header.blockEntries && cursor.next(); ++i )
+	{
+		const int	compareResult = comparePath( cursor.getPath(), path.data(), path.size() );
+		if( !compareResult )
+		{
+			cursor.getDigests( digests );
+			return true;
+		}
+		if( compareResult > 0 )
+		{
+			break;
+		}
+	}
+
+	return false;
+}
+
+void HashDatabase::store( const STRING &fileName, const Digests &digests )
+{
+	const std::string	path = toPath( fileName );
+
+	m_changes[path] = digests;
+	if( m_fileName.isEmpty() )
+	{
+		return;
+	}
+
+	if( !m_log.is_open() )
+	{
+		const STRING	logName = m_fileName + DB_LOG_EXT;
+		m_log.open( logName, std::ios::binary|std::ios::app );
+		if( !m_log )
+		{
+			throw OpenWriteError( logName ).addCerror();
+		}
+	}
+
+	const uint32	pathLen = uint32( path.size() );
+	const DbRecord	record( digests );
+	m_log.write( reinterpret_cast<const char *>( &pathLen ), sizeof( pathLen ) );
+	m_log.write( path.data(), path.size() );
+	m_log.write( reinterpret_cast<const char *>( &record ), sizeof( record ) );
+	if( !digests.leaves.empty() )
+	{
+		m_log.write(
+			reinterpret_cast<const char *>( &digests.leaves[0] ),
+			digests.leaves.size() * sizeof( SHA256Hash::Digest )
+		);
+	}
+	++m_logEntries;
+}
+
+void HashDatabase::flush( bool forceCompact )
+{
+	if( m_fileName.isEmpty() )
+	{
+		return;
+	}
+	if( m_log.is_open() )
+	{
+		m_log.close();
+	}
+	if( forceCompact || m_compact || m_logEntries > m_header.numEntries / DB_COMPACT_RATIO )
+	{
+		compact();
+	}
+}
+
+void DbWriter::add( const std::string &path, const Digests &digests )
+{
+	std::size_t	shared = 0;
+
+	if( m_numEntries % DB_BLOCK_ENTRIES == 0 )
+	{
+		m_blockOffsets.push_back( m_pathSize );
+	}
+	else
+	{
+		const std::size_t	maxShared = std::min( path.size(), m_lastPath.size() );
+		while( shared < maxShared && path[shared] == m_lastPath[shared] )
+		{
+			++shared;
+		}
+	}
+
+	writeVarint( shared );
+	writeVarint( path.size() - shared );
+	m_paths.write( path.data() + shared, path.size() - shared );
+	m_pathSize += path.size() - shared;
+	m_lastPath = path;
+
+	const DbRecord	record( digests, m_numLeaves );
+	m_out.write( reinterpret_cast<const char *>( &record ), sizeof( record ) );
+	++m_numEntries;
+
+	if( !digests.leaves.empty() )
+	{
+		m_leaves.write(
+			reinterpret_cast<const char *>( &digests.leaves[0] ),
+			digests.leaves.size() * sizeof( SHA256Hash::Digest )
+		);
+		m_numLeaves += digests.leaves.size();
+	}
+}
+
+void DbWriter::appendFile( const STRING &fileName, uint64 size )
+{
+	if( size )
+	{
+		std::ifstream	stream( fileName, std::ios::binary );
+		m_out << stream.rdbuf();
+	}
+	strRemove( fileName );
+}
+
+/*
+	appends the block table, the leaves and the paths to the records and
+	writes the header
+*/
+void DbWriter::finish()
+{
+	DbHeader	header;
+	std::memset( &header, 0, sizeof( header ) );
+	header.magic = dbMagic;
+	header.version = dbVersion;
+	header.blockEntries = uint16( DB_BLOCK_ENTRIES );
+	header.recordSize = sizeof( DbRecord );
+	header.numEntries = m_numEntries;
+	header.numBlocks = m_blockOffsets.size();
+	header.numLeaves = m_numLeaves;
+	header.blockOffset = sizeof( DbHeader ) + m_numEntries * sizeof( DbRecord );
+	header.leafOffset = header.blockOffset + header.numBlocks * sizeof( uint64 );
+	header.pathOffset = header.leafOffset + header.numLeaves * sizeof( SHA256Hash::Digest );
+
+	if( !m_blockOffsets.empty() )
+	{
+		m_out.write(
+			reinterpret_cast<const char *>( &m_blockOffsets[0] ),
+			m_blockOffsets.size() * sizeof( uint64 )
+		);
+	}
+
+	m_leaves.close();
+	m_paths.close();
+	if( !m_leaves || !m_paths )
+	{
+		throw std::runtime_error( std::string( "Write error " ) + m_pathsName.c_str() );
+	}
+	appendFile( m_leavesName, m_numLeaves );
+	appendFile( m_pathsName, m_pathSize );
+
+	m_out.seekp( 0 );
+	m_out.write( reinterpret_cast<const char *>( &header ), sizeof( header ) );
+	m_out.close();
+	if( !m_out )
+	{
+		throw std::runtime_error( std::string( "Write error " ) + m_fileName.c_str() );
+	}
+}
+
 // --------------------------------------------------------------------- //
 // ----- entry points -------------------------------------------------- //
 // --------------------------------------------------------------------- //
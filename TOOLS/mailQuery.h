@@ -0,0 +1,908 @@
+/*
+		Project:		GAK_CLI
+		Module:			mailQuery.h
+		Description:	query engine of the mail index
+		Author:			Martin Gckler
+		Address:		Hofmannsthalweg 14, A-4030 Linz
+		Web:			https://www.gaeckler.at/
+
+		Copyright:		(c) 1988-2025 Martin Gckler
+
+		This program is free software: you can redistribute it and/or modify  
+		it under the terms of the GNU General Public License as published by  
+		the Free Software Foundation, version 3.
+
+		You should have received a copy of the GNU General Public License 
+		along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+		THIS SOFTWARE IS PROVIDED BY Martin Gckler, Austria, Linz ``AS IS''
+		AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+		TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+		PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR
+		CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+		SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+		LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+		USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+		ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+		OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+		OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+		SUCH DAMAGE.
+*/
+
+#ifndef MAIL_QUERY_H
+#define MAIL_QUERY_H
+
+// --------------------------------------------------------------------- //
+// ----- switches ------------------------------------------------------ //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- includes ------------------------------------------------------ //
+// --------------------------------------------------------------------- //
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <queue>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+
+#include <gak/types.h>
+
+#include "mailTokenizer.h"
+#include "mailSegment.h"
+
+// --------------------------------------------------------------------- //
+// ----- imported datas ------------------------------------------------ //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- module switches ----------------------------------------------- //
+// --------------------------------------------------------------------- //
+
+#ifdef __BORLANDC__
+#	pragma option -RT-
+#	pragma option -b
+#	pragma option -a4
+#	pragma option -pc
+#endif
+
+// --------------------------------------------------------------------- //
+// ----- constants ----------------------------------------------------- //
+// --------------------------------------------------------------------- //
+
+static const double BM25_K1 = 1.2;
+static const double BM25_B = 0.75;
+
+// --------------------------------------------------------------------- //
+// ----- macros -------------------------------------------------------- //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- type definitions ---------------------------------------------- //
+// --------------------------------------------------------------------- //
+
+enum QueryNodeType
+{
+	qnNone,			// a word without terms, it is ignored
+	qnPhrase,		// terms at the given distances, a single term is a phrase, too
+	qnAnd,
+	qnOr,
+	qnNot
+};
+
+struct QueryNode
+{
+	QueryNodeType				type;
+	std::vector<std::string>	terms;
+	std::vector<gak::uint32>	offsets;		// of the terms relative to the first one
+	gak::uint32					slop;			// extra words allowed in a phrase
+	std::vector<QueryNode>		children;
+
+	QueryNode( QueryNodeType type=qnNone ) : type(type), slop(0) {}
+};
+
+struct MailHit
+{
+	double		score;
+	std::string	mailbox;
+	gak::uint64	mailIndex;
+
+	MailHit( double score, const std::string &mailbox, gak::uint64 mailIndex )
+	: score(score), mailbox(mailbox), mailIndex(mailIndex) {}
+};
+
+typedef std::vector<MailHit>	MailHits;
+
+// --------------------------------------------------------------------- //
+// ----- class definitions --------------------------------------------- //
+// --------------------------------------------------------------------- //
+
+/*
+	query syntax:
+		words next to each other must all be found, AND is optional
+		a OR b			one of them
+		NOT a, -a		must not be found, +a is the same as a
+		"a b c"			a phrase, "a b c"~3 allows 3 other words in between
+		( ... )			grouping
+	A word that the tokenizer splits into several terms is a phrase.
+	The stop words of the index are dropped, their distances remain.
+*/
+class MailQueryParser
+{
+	const StopWordSet	*m_stopWords;
+	const char			*m_pos;
+
+	static bool isSpace( char c )
+	{
+		return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+	}
+	static bool isWordEnd( char c )
+	{
+		return !c || isSpace( c ) || c == '(' || c == ')' || c == '"';
+	}
+
+	void skipSpace()
+	{
+		while( isSpace( *m_pos ) )
+		{
+			++m_pos;
+		}
+	}
+	/// checks for an operator keyword, followed by a word end
+	bool isKeyword( const char *keyword ) const
+	{
+		const std::size_t	len = std::strlen( keyword );
+		return !std::strncmp( m_pos, keyword, len ) && isWordEnd( m_pos[len] );
+	}
+	bool atClauseEnd()
+	{
+		skipSpace();
+		return !*m_pos || *m_pos == ')' || isKeyword( "OR" );
+	}
+
+	void makePhrase( const char *text, std::size_t size, QueryNode *node )
+	{
+		MailTerms	terms;
+		tokenizeMail( text, size, m_stopWords, &terms );
+
+		std::vector< std::pair<gak::uint32, std::string> >	ordered;
+		for(
+			MailTerms::const_iterator it = terms.begin(), endIT = terms.end();
+			it != endIT;
+			++it
+		)
+		{
+			for( std::size_t i=0; i<it->second.size(); ++i )
+			{
+				ordered.push_back( std::make_pair( it->second[i], it->first ) );
+			}
+		}
+		std::sort( ordered.begin(), ordered.end() );
+
+		node->type = ordered.empty() ? qnNone : qnPhrase;
+		for( std::size_t i=0; i<ordered.size(); ++i )
+		{
+			node->terms.push_back( ordered[i].second );
+			node->offsets.push_back( ordered[i].first - ordered[0].first );
+		}
+	}
+
+	void parseOr( QueryNode *node )
+	{
+		QueryNode	orNode( qnOr );
+		while( true )
+		{
+			orNode.children.push_back( QueryNode() );
+			parseAnd( &orNode.children.back() );
+			skipSpace();
+			if( !isKeyword( "OR" ) )
+			{
+				break;
+			}
+			m_pos += 2;
+		}
+		if( orNode.children.size() == 1 )
+			*node = orNode.children[0];
+		else
+			*node = orNode;
+	}
+	void parseAnd( QueryNode *node )
+	{
+		QueryNode	andNode( qnAnd );
+		while( !atClauseEnd() )
+		{
+			if( isKeyword( "AND" ) )
+			{
+				m_pos += 3;
+				continue;
+			}
+			andNode.children.push_back( QueryNode() );
+			parseUnary( &andNode.children.back() );
+		}
+		if( andNode.children.empty() )
+		{
+			throw std::runtime_error( "Query: missing words" );
+		}
+		if( andNode.children.size() == 1 )
+			*node = andNode.children[0];
+		else
+			*node = andNode;
+	}
+	void parseUnary( QueryNode *node )
+	{
+		bool	negate = false;
+		if( isKeyword( "NOT" ) )
+		{
+			m_pos += 3;
+			skipSpace();
+			negate = true;
+		}
+		else if( *m_pos == '-' || *m_pos == '+' )
+		{
+			negate = *m_pos++ == '-';
+		}
+
+		if( negate )
+		{
+			node->type = qnNot;
+			node->children.push_back( QueryNode() );
+			parsePrimary( &node->children.back() );
+		}
+		else
+		{
+			parsePrimary( node );
+		}
+	}
+	void parsePrimary( QueryNode *node )
+	{
+		skipSpace();
+		if( *m_pos == '(' )
+		{
+			++m_pos;
+			parseOr( node );
+			skipSpace();
+			if( *m_pos++ != ')' )
+			{
+				throw std::runtime_error( "Query: missing )" );
+			}
+		}
+		else if( *m_pos == '"' )
+		{
+			const char	*start = ++m_pos;
+			while( *m_pos && *m_pos != '"' )
+			{
+				++m_pos;
+			}
+			if( !*m_pos )
+			{
+				throw std::runtime_error( "Query: missing \"" );
+			}
+			makePhrase( start, std::size_t(m_pos - start), node );
+			if( *++m_pos == '~' )
+			{
+				char	*end;
+				node->slop = gak::uint32( std::strtoul( m_pos+1, &end, 10 ) );
+				m_pos = end;
+			}
+		}
+		else
+		{
+			const char	*start = m_pos;
+			while( !isWordEnd( *m_pos ) )
+			{
+				++m_pos;
+			}
+			if( start == m_pos )
+			{
+				throw std::runtime_error( std::string( "Query: unexpected " ) + *m_pos );
+			}
+			makePhrase( start, std::size_t(m_pos - start), node );
+		}
+	}
+
+	public:
+	MailQueryParser( const StopWordSet *stopWords=nullptr ) : m_stopWords( stopWords ), m_pos( nullptr ) {}
+
+	void parse( const char *query, QueryNode *root )
+	{
+		m_pos = query;
+		parseOr( root );
+		if( *m_pos )
+		{
+			throw std::runtime_error( std::string( "Query: unexpected " ) + *m_pos );
+		}
+	}
+};
+
+/*
+	finds the docs of a segment that match a query node, ascending.
+	advance moves to the first match not less than target.
+*/
+class DocMatcher
+{
+	public:
+	virtual ~DocMatcher() {}
+
+	/// the current match or NO_MAIL_DOC
+	virtual gak::uint32 doc() const = 0;
+	virtual void advance( gak::uint32 target ) = 0;
+	/// BM25 of the current match
+	virtual double score() = 0;
+	/// estimated number of matches, the cheapest drives an intersection
+	virtual gak::uint64 cost() const = 0;
+};
+
+typedef std::unique_ptr<DocMatcher>	DocMatcherPtr;
+
+/// statistics of all segments
+struct QueryStatistics
+{
+	double	avgDocLength;
+	double	numDocs;
+	const MappedSegment	*segment;
+
+	double idf( gak::uint64 docFreq ) const
+	{
+		return std::log( 1.0 + (numDocs - double(docFreq) + 0.5) / (double(docFreq) + 0.5) );
+	}
+	double bm25( double idf, gak::uint32 frequency, gak::uint32 doc ) const
+	{
+		const double	docLength = segment->getDoc( doc ).numWords;
+		const double	tf = frequency;
+		return idf * tf * (BM25_K1 + 1) / (tf + BM25_K1 * (1 - BM25_B + BM25_B * docLength / avgDocLength));
+	}
+};
+
+class EmptyMatcher : public DocMatcher
+{
+	public:
+	virtual gak::uint32 doc() const { return NO_MAIL_DOC; }
+	virtual void advance( gak::uint32 ) {}
+	virtual double score() { return 0; }
+	virtual gak::uint64 cost() const { return 0; }
+};
+
+class TermMatcher : public DocMatcher
+{
+	SegmentPostings			m_postings;
+	double					m_idf;
+	const QueryStatistics	&m_stats;
+
+	public:
+	TermMatcher( const SegmentPostings &postings, double idf, const QueryStatistics &stats )
+	: m_postings( postings ), m_idf( idf ), m_stats( stats ) {}
+
+	virtual gak::uint32 doc() const
+	{
+		return m_postings.doc();
+	}
+	virtual void advance( gak::uint32 target )
+	{
+		m_postings.advance( target );
+	}
+	virtual double score()
+	{
+		return m_stats.bm25( m_idf, m_postings.frequency(), m_postings.doc() );
+	}
+	virtual gak::uint64 cost() const
+	{
+		return m_postings.size();
+	}
+};
+
+/*
+	all terms in the doc, then the positions are compared. The rarest
+	term leads, the others follow with advance.
+*/
+class PhraseMatcher : public DocMatcher
+{
+	std::vector<SegmentPostings>	m_postings;
+	std::vector<gak::uint32>		m_offsets;
+	gak::uint32						m_slop;
+	double							m_idf;				// sum of the terms
+	const QueryStatistics			&m_stats;
+	std::size_t						m_lead;
+	gak::uint32						m_doc;
+	gak::uint32						m_frequency;		// of the phrase in m_doc
+
+	/// counts the phrases, the terms must be in order
+	gak::uint32 countPhrases()
+	{
+		const gak::uint32	*first = m_postings[0].positions();
+		const gak::uint32	numFirst = m_postings[0].frequency();
+		const gak::uint32	span = m_offsets.back();
+		gak::uint32			count = 0;
+
+		for( gak::uint32 i=0; i<numFirst; ++i )
+		{
+			gak::uint32	prev = first[i];
+			std::size_t	t = 1;
+			for( ; t<m_postings.size(); ++t )
+			{
+				const gak::uint32	*positions = m_postings[t].positions();
+				const gak::uint32	*end = positions + m_postings[t].frequency();
+				const gak::uint32	*next = std::lower_bound( positions, end, prev + m_offsets[t] - m_offsets[t-1] );
+				if( next == end )
+				{
+					return count;
+				}
+				prev = *next;
+			}
+			if( prev - first[i] - span <= m_slop )
+			{
+				++count;
+			}
+		}
+		return count;
+	}
+
+	public:
+	PhraseMatcher(
+		const std::vector<SegmentPostings> &postings, const std::vector<gak::uint32> &offsets,
+		gak::uint32 slop, double idf, const QueryStatistics &stats
+	)
+	: m_postings( postings ), m_offsets( offsets ), m_slop( slop ), m_idf( idf ), m_stats( stats ),
+	  m_lead( 0 ), m_doc( 0 ), m_frequency( 0 )
+	{
+		for( std::size_t i=1; i<m_postings.size(); ++i )
+		{
+			if( m_postings[i].size() < m_postings[m_lead].size() )
+			{
+				m_lead = i;
+			}
+		}
+	}
+
+	virtual gak::uint32 doc() const
+	{
+		return m_doc;
+	}
+	virtual void advance( gak::uint32 target )
+	{
+		if( m_doc != NO_MAIL_DOC && m_doc >= target && target )
+		{
+			return;
+		}
+		while( true )
+		{
+			m_postings[m_lead].advance( target );
+			m_doc = m_postings[m_lead].doc();
+			if( m_doc == NO_MAIL_DOC )
+			{
+				return;
+			}
+
+			bool	allFound = true;
+			for( std::size_t i=0; i<m_postings.size() && allFound; ++i )
+			{
+				m_postings[i].advance( m_doc );
+				if( m_postings[i].doc() != m_doc )
+				{
+					target = m_postings[i].doc();
+					allFound = false;
+				}
+			}
+			if( allFound )
+			{
+				m_frequency = countPhrases();
+				if( m_frequency )
+				{
+					return;
+				}
+				target = m_doc+1;
+			}
+			if( target == NO_MAIL_DOC )
+			{
+				m_doc = NO_MAIL_DOC;
+				return;
+			}
+		}
+	}
+	virtual double score()
+	{
+		return m_stats.bm25( m_idf, m_frequency, m_doc );
+	}
+	virtual gak::uint64 cost() const
+	{
+		return m_postings[m_lead].size();
+	}
+};
+
+/*
+	intersection: the cheapest matcher leads, the others gallop to its doc.
+	A doc found by an excluded matcher is skipped.
+*/
+class AndMatcher : public DocMatcher
+{
+	std::vector<DocMatcherPtr>	m_required;
+	std::vector<DocMatcherPtr>	m_excluded;
+	gak::uint32					m_doc;
+
+	struct CostLess
+	{
+		bool operator () ( const DocMatcherPtr &left, const DocMatcherPtr &right ) const
+		{
+			return left->cost() < right->cost();
+		}
+	};
+
+	public:
+	AndMatcher( std::vector<DocMatcherPtr> &required, std::vector<DocMatcherPtr> &excluded )
+	: m_doc( 0 )
+	{
+		m_required.swap( required );
+		m_excluded.swap( excluded );
+		std::sort( m_required.begin(), m_required.end(), CostLess() );
+	}
+
+	virtual gak::uint32 doc() const
+	{
+		return m_doc;
+	}
+	virtual void advance( gak::uint32 target )
+	{
+		if( m_doc != NO_MAIL_DOC && m_doc >= target && target )
+		{
+			return;
+		}
+		while( true )
+		{
+			m_required[0]->advance( target );
+			m_doc = m_required[0]->doc();
+			if( m_doc == NO_MAIL_DOC )
+			{
+				return;
+			}
+
+			bool	allFound = true;
+			for( std::size_t i=1; i<m_required.size() && allFound; ++i )
+			{
+				m_required[i]->advance( m_doc );
+				if( m_required[i]->doc() != m_doc )
+				{
+					target = m_required[i]->doc();
+					allFound = false;
+				}
+			}
+			for( std::size_t i=0; i<m_excluded.size() && allFound; ++i )
+			{
+				m_excluded[i]->advance( m_doc );
+				if( m_excluded[i]->doc() == m_doc )
+				{
+					target = m_doc+1;
+					allFound = false;
+				}
+			}
+			if( allFound )
+			{
+				return;
+			}
+			if( target == NO_MAIL_DOC )
+			{
+				m_doc = NO_MAIL_DOC;
+				return;
+			}
+		}
+	}
+	virtual double score()
+	{
+		double	score = 0;
+		for( std::size_t i=0; i<m_required.size(); ++i )
+		{
+			score += m_required[i]->score();
+		}
+		return score;
+	}
+	virtual gak::uint64 cost() const
+	{
+		return m_required[0]->cost();
+	}
+};
+
+/// union, the docs found by several matchers get the sum of their scores
+class OrMatcher : public DocMatcher
+{
+	std::vector<DocMatcherPtr>	m_children;
+	gak::uint32					m_doc;
+
+	public:
+	OrMatcher( std::vector<DocMatcherPtr> &children ) : m_doc( 0 )
+	{
+		m_children.swap( children );
+	}
+
+	virtual gak::uint32 doc() const
+	{
+		return m_doc;
+	}
+	virtual void advance( gak::uint32 target )
+	{
+		m_doc = NO_MAIL_DOC;
+		for( std::size_t i=0; i<m_children.size(); ++i )
+		{
+			if( m_children[i]->doc() < target || !target )
+			{
+				m_children[i]->advance( target );
+			}
+			m_doc = std::min( m_doc, m_children[i]->doc() );
+		}
+	}
+	virtual double score()
+	{
+		double	score = 0;
+		for( std::size_t i=0; i<m_children.size(); ++i )
+		{
+			if( m_children[i]->doc() == m_doc )
+			{
+				score += m_children[i]->score();
+			}
+		}
+		return score;
+	}
+	virtual gak::uint64 cost() const
+	{
+		gak::uint64	cost = 0;
+		for( std::size_t i=0; i<m_children.size(); ++i )
+		{
+			cost += m_children[i]->cost();
+		}
+		return cost;
+	}
+};
+
+/*
+	runs a query on all segments and keeps the best hits in a heap
+*/
+class MailSearcher
+{
+	typedef std::map< std::string, std::vector<SegmentPostings> >	TermPostings;
+
+	struct HeapEntry
+	{
+		double		score;
+		std::size_t	segment;
+		gak::uint32	doc;
+
+		HeapEntry( double score, std::size_t segment, gak::uint32 doc )
+		: score(score), segment(segment), doc(doc) {}
+
+		/// the worst hit on top of the heap
+		bool operator < ( const HeapEntry &other ) const
+		{
+			return score != other.score
+				? score > other.score
+				: segment != other.segment ? segment < other.segment : doc < other.doc;
+		}
+	};
+
+	const MailSegments					&m_manifest;
+	const std::vector<MappedSegment>	&m_segments;
+	TermPostings						m_postings;
+	std::map<std::string, gak::uint64>	m_docFreqs;
+	QueryStatistics						m_stats;
+
+	void findTerms( const QueryNode &node )
+	{
+		for( std::size_t i=0; i<node.terms.size(); ++i )
+		{
+			const std::string	&term = node.terms[i];
+			if( m_postings.count( term ) )
+			{
+				continue;
+			}
+
+			std::vector<SegmentPostings>	&postings = m_postings[term];
+			gak::uint64						docFreq = 0;
+
+			postings.resize( m_segments.size() );
+			for( std::size_t s=0; s<m_segments.size(); ++s )
+			{
+				if( m_segments[s].find( term, &postings[s] ) )
+				{
+					docFreq += postings[s].size();
+				}
+			}
+			m_docFreqs[term] = docFreq;
+		}
+		for( std::size_t i=0; i<node.children.size(); ++i )
+		{
+			findTerms( node.children[i] );
+		}
+	}
+
+	DocMatcherPtr createMatcher( const QueryNode &node, std::size_t segment )
+	{
+		switch( node.type )
+		{
+			case qnPhrase:
+			{
+				std::vector<SegmentPostings>	postings;
+				std::vector<gak::uint32>		offsets;
+				double							idf = 0;
+
+				for( std::size_t i=0; i<node.terms.size(); ++i )
+				{
+					// the parser has dropped the stop words, every other term is required
+					const gak::uint64	docFreq = m_docFreqs[node.terms[i]];
+					if( !docFreq )
+					{
+						return DocMatcherPtr( new EmptyMatcher );
+					}
+					postings.push_back( m_postings[node.terms[i]][segment] );
+					offsets.push_back( node.offsets[i] );
+					idf += m_stats.idf( docFreq );
+				}
+				if( postings.size() == 1 )
+				{
+					return DocMatcherPtr( new TermMatcher( postings[0], idf, m_stats ) );
+				}
+				return DocMatcherPtr( new PhraseMatcher( postings, offsets, node.slop, idf, m_stats ) );
+			}
+			case qnAnd:
+			{
+				std::vector<DocMatcherPtr>	required, excluded;
+				for( std::size_t i=0; i<node.children.size(); ++i )
+				{
+					const QueryNode	&child = node.children[i];
+					if( child.type == qnNot )
+						excluded.push_back( createMatcher( child.children[0], segment ) );
+					else if( child.type != qnNone )
+						required.push_back( createMatcher( child, segment ) );
+				}
+				if( required.empty() )
+				{
+					return DocMatcherPtr( new EmptyMatcher );
+				}
+				return DocMatcherPtr( new AndMatcher( required, excluded ) );
+			}
+			case qnOr:
+			{
+				std::vector<DocMatcherPtr>	children;
+				for( std::size_t i=0; i<node.children.size(); ++i )
+				{
+					children.push_back( createMatcher( node.children[i], segment ) );
+				}
+				return DocMatcherPtr( new OrMatcher( children ) );
+			}
+			default:
+				// a query without positive words finds nothing
+				return DocMatcherPtr( new EmptyMatcher );
+		}
+	}
+
+	public:
+	MailSearcher( const MailSegments &manifest, const std::vector<MappedSegment> &segments )
+	: m_manifest( manifest ), m_segments( segments )
+	{
+		gak::uint64	numDocs = 0, numWords = 0;
+		for( std::size_t i=0; i<segments.size(); ++i )
+		{
+			numDocs += segments[i].getNumDocs();
+			numWords += segments[i].getNumWords();
+		}
+		m_stats.numDocs = double(numDocs);
+		m_stats.avgDocLength = numDocs ? double(numWords) / double(numDocs) : 1;
+		m_stats.segment = NULL;
+	}
+
+	/// the best maxHits mails that are not outdated, returns the number of all matches
+	std::size_t search( const QueryNode &query, std::size_t maxHits, MailHits *hits )
+	{
+		std::priority_queue<HeapEntry>	best;
+		std::size_t						numMatches = 0;
+
+		findTerms( query );
+		for( std::size_t s=0; s<m_segments.size(); ++s )
+		{
+			const MappedSegment	&segment = m_segments[s];
+			std::vector<signed char>	validMailboxes( segment.getNumMailboxes(), -1 );
+			DocMatcherPtr		matcher = createMatcher( query, s );
+
+			m_stats.segment = &segment;
+			for( matcher->advance( 0 ); matcher->doc() != NO_MAIL_DOC; matcher->advance( matcher->doc()+1 ) )
+			{
+				const gak::uint32	doc = matcher->doc();
+				signed char			&valid = validMailboxes[segment.getDoc( doc ).mailbox];
+				if( valid < 0 )
+				{
+					valid = m_manifest.isValid( segment.getMailbox( segment.getDoc( doc ).mailbox ), segment.getGeneration() );
+				}
+				if( !valid )
+				{
+					continue;
+				}
+
+				++numMatches;
+				const double	score = matcher->score();
+				if( best.size() < maxHits )
+				{
+					best.push( HeapEntry( score, s, doc ) );
+				}
+				else if( maxHits && score > best.top().score )
+				{
+					best.pop();
+					best.push( HeapEntry( score, s, doc ) );
+				}
+			}
+		}
+
+		std::vector<HeapEntry>	sorted;
+		for( ; !best.empty(); best.pop() )
+		{
+			sorted.push_back( best.top() );
+		}
+		for( std::size_t i=sorted.size(); i>0; --i )
+		{
+			const HeapEntry		&entry = sorted[i-1];
+			const MailDoc		doc = m_segments[entry.segment].getDoc( entry.doc );
+			hits->push_back( MailHit( entry.score, m_segments[entry.segment].getMailbox( doc.mailbox ), doc.mailIndex ) );
+		}
+		return numMatches;
+	}
+};
+
+// --------------------------------------------------------------------- //
+// ----- exported datas ------------------------------------------------ //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- module static data -------------------------------------------- //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- class static data --------------------------------------------- //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- prototypes ---------------------------------------------------- //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- module functions ---------------------------------------------- //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- class inlines ------------------------------------------------- //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- class constructors/destructors -------------------------------- //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- class static functions ---------------------------------------- //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- class privates ------------------------------------------------ //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- class protected ----------------------------------------------- //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- class virtuals ------------------------------------------------ //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- class publics ------------------------------------------------- //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- entry points -------------------------------------------------- //
+// --------------------------------------------------------------------- //
+
+#ifdef __BORLANDC__
+#	pragma option -RT.
+#	pragma option -b.
+#	pragma option -a.
+#	pragma option -p.
+#endif
+
+#endif //  MAIL_QUERY_H
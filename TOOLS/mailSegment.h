@@ -0,0 +1,1199 @@
+/*
+		Project:		GAK_CLI
+		Module:			mailSegment.h
+		Description:	segments of the mail index
+		Author:			Martin Gckler
+		Address:		Hofmannsthalweg 14, A-4030 Linz
+		Web:			https://www.gaeckler.at/
+
+		Copyright:		(c) 1988-2025 Martin Gckler
+
+		This program is free software: you can redistribute it and/or modify  
+		it under the terms of the GNU General Public License as published by  
+		the Free Software Foundation, version 3.
+
+		You should have received a copy of the GNU General Public License 
+		along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+		THIS SOFTWARE IS PROVIDED BY Martin Gckler, Austria, Linz ``AS IS''
+		AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+		TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+		PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR
+		CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+		SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+		LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+		USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+		ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+		OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+		OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+		SUCH DAMAGE.
+*/
+
+#ifndef MAIL_SEGMENT_H
+#define MAIL_SEGMENT_H
+
+// --------------------------------------------------------------------- //
+// ----- switches ------------------------------------------------------ //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- includes ------------------------------------------------------ //
+// --------------------------------------------------------------------- //
+
+#include <cmath>
+#include <cstring>
+#include <map>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include <gak/types.h>
+#include <gak/string.h>
+#include <gak/iostream.h>
+#include <gak/exception.h>
+
+#include "mboxIndex.h"
+#include "mappedFile.h"
+#include "streamVByte.h"
+
+// --------------------------------------------------------------------- //
+// ----- imported datas ------------------------------------------------ //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- module switches ----------------------------------------------- //
+// --------------------------------------------------------------------- //
+
+#ifdef __BORLANDC__
+#	pragma option -RT-
+#	pragma option -b
+#	pragma option -a4
+#	pragma option -pc
+#endif
+
+// --------------------------------------------------------------------- //
+// ----- constants ----------------------------------------------------- //
+// --------------------------------------------------------------------- //
+
+static const std::size_t SEGMENT_MERGE_FACTOR = 8;			// segments of a size class merged at once
+static const gak::uint32 SEGMENT_MAX_MERGE_DOCS = 4000000;	// larger segments are final
+static const gak::uint32 NO_MAIL_DOC = gak::uint32(-1);
+static const gak::uint32 SEGMENT_BLOCK_DOCS = 128;			// docs decoded at once
+
+// --------------------------------------------------------------------- //
+// ----- macros -------------------------------------------------------- //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- type definitions ---------------------------------------------- //
+// --------------------------------------------------------------------- //
+
+/// a mail in a segment, the postings refer to its index in the segment
+struct MailDoc
+{
+	gak::uint32	mailbox;		// in the mailbox names of the segment
+	gak::uint32	numWords;
+	gak::uint64	mailIndex;		// in the mailbox
+
+	MailDoc( gak::uint32 mailbox=0, gak::uint32 numWords=0, gak::uint64 mailIndex=0 )
+	: mailbox(mailbox), numWords(numWords), mailIndex(mailIndex) {}
+};
+
+struct MailPosting
+{
+	gak::uint32					doc;
+	std::vector<gak::uint32>	positions;
+
+	MailPosting( gak::uint32 doc=0 ) : doc(doc) {}
+
+	bool operator < ( const MailPosting &other ) const
+	{
+		return doc < other.doc;
+	}
+};
+
+typedef std::vector<MailPosting>				MailPostings;
+typedef std::map<std::string, MailPostings>		MailTermMap;
+
+typedef std::pair<std::string, std::size_t>		WordCount;
+typedef std::vector<WordCount>					WordCounts;
+
+// --------------------------------------------------------------------- //
+// ----- class definitions --------------------------------------------- //
+// --------------------------------------------------------------------- //
+
+template <class T>
+inline void vectorToBinaryStream( std::ostream &stream, const std::vector<T> &data )
+{
+	gak::toBinaryStream( stream, gak::uint64( data.size() ) );
+	if( !data.empty() )
+	{
+		stream.write( reinterpret_cast<const char *>( &data[0] ), std::streamsize( data.size()*sizeof( T ) ) );
+	}
+}
+
+template <class T>
+inline void vectorFromBinaryStream( std::istream &stream, std::vector<T> *data )
+{
+	gak::uint64	size;
+	gak::fromBinaryStream( stream, &size );
+	data->resize( std::size_t( size ) );
+	if( size )
+	{
+		stream.read( reinterpret_cast<char *>( &(*data)[0] ), std::streamsize( size*sizeof( T ) ) );
+	}
+}
+
+inline void stringToBinaryStream( std::ostream &stream, const std::string &str )
+{
+	gak::toBinaryStream( stream, gak::STRING( str.c_str() ) );
+}
+
+inline void stringFromBinaryStream( std::istream &stream, std::string *str )
+{
+	gak::STRING	value;
+	gak::fromBinaryStream( stream, &value );
+	str->assign( value.c_str() );
+}
+
+/*
+	an immutable part of the mail index. Every indexer run writes the mails
+	it indexed as a new segment, so the index is never rewritten completely.
+	This is the segment built in memory, MappedSegment reads the files.
+*/
+class MailSegment
+{
+	public:
+	gak::uint64					generation;		// newest run with mails in this segment
+	std::vector<std::string>	mailboxes;
+	std::vector<MailDoc>		docs;
+	MailTermMap					terms;			// postings sorted by doc
+
+	MailSegment() : generation(0) {}
+
+	const MailPostings *find( const std::string &term ) const
+	{
+		MailTermMap::const_iterator	it = terms.find( term );
+		return it == terms.end() ? NULL : &it->second;
+	}
+};
+
+/*
+	the segment file is searched via memory mapping without reading it:
+	SegmentHeader, uint64 mailboxNames[numMailboxes], MailDoc docs[numDocs],
+	SegmentTerm terms[numTerms], the postings and the names.
+	The terms are sorted bytewise by name. The postings of a term are split
+	into blocks of SEGMENT_BLOCK_DOCS docs. They start with the skip table,
+	SegmentSkip[numBlocks], followed by the doc blocks, the frequency
+	blocks and the position blocks. All blocks are Stream VByte: the docs
+	as differences to the previous doc, the frequencies as they are and the
+	positions of each doc as differences, the first one of a doc as is.
+	Names are zero terminated.
+*/
+struct SegmentHeader
+{
+	gak::uint32	magic;
+	gak::uint16	version;
+	gak::uint16	reserved;
+	gak::uint32	numMailboxes;
+	gak::uint32	numDocs;
+	gak::uint64	generation;
+	gak::uint64	numWords;			// of all docs, for the average length
+	gak::uint64	numTerms;
+	gak::uint64	mailboxOffset;
+	gak::uint64	docOffset;
+	gak::uint64	termOffset;
+	gak::uint64	postingOffset;		// the term postings offsets are relative to this
+	gak::uint64	nameOffset;			// the name offsets are relative to this
+};
+
+struct SegmentTerm
+{
+	gak::uint64	name;
+	gak::uint64	postings;
+	gak::uint32	numPostings;
+	gak::uint32	numPositions;
+	gak::uint32	docBytes;
+	gak::uint32	frequencyBytes;
+	gak::uint64	positionBytes;
+
+	gak::uint32 getNumBlocks() const
+	{
+		return (numPostings + SEGMENT_BLOCK_DOCS - 1) / SEGMENT_BLOCK_DOCS;
+	}
+	gak::uint64 getPostingBytes() const;
+};
+
+/// where a block of postings starts
+struct SegmentSkip
+{
+	gak::uint32	lastDoc;
+	gak::uint32	docOffset;			// relative to the doc blocks
+	gak::uint32	frequencyOffset;	// relative to the frequency blocks
+	gak::uint32	reserved;
+	gak::uint64	positionOffset;		// relative to the position blocks
+};
+
+inline gak::uint64 SegmentTerm::getPostingBytes() const
+{
+	return getNumBlocks() * gak::uint64( sizeof( SegmentSkip ) ) + docBytes + frequencyBytes + positionBytes;
+}
+
+/*
+	a cursor on the postings of a term in a mapped segment. Only the block
+	of the current doc is decoded, advance skips the other blocks with the
+	skip table. The frequencies and positions of a block are decoded when
+	they are needed first.
+*/
+class SegmentPostings
+{
+	const gak::uint8	*m_skips;
+	const gak::uint8	*m_docBlocks;
+	const gak::uint8	*m_frequencyBlocks;
+	const gak::uint8	*m_positionBlocks;
+	const gak::uint8	*m_end;
+	gak::uint32			m_size;
+	gak::uint32			m_numBlocks;
+
+	gak::uint32			m_block;			// m_numBlocks at the end
+	gak::uint32			m_blockSize;
+	gak::uint32			m_index;			// in the block
+	bool				m_hasFrequencies;
+	bool				m_hasPositions;
+
+	gak::uint32					m_docs[SEGMENT_BLOCK_DOCS];
+	gak::uint32					m_frequencies[SEGMENT_BLOCK_DOCS];
+	gak::uint32					m_positionStarts[SEGMENT_BLOCK_DOCS];
+	std::vector<gak::uint32>	m_positions;
+
+	SegmentSkip getSkip( gak::uint32 block ) const
+	{
+		SegmentSkip	skip;
+		std::memcpy( &skip, m_skips + block * sizeof( SegmentSkip ), sizeof( skip ) );
+		return skip;
+	}
+	void loadBlock( gak::uint32 block )
+	{
+		m_block = block;
+		m_index = 0;
+		m_hasFrequencies = m_hasPositions = false;
+		if( block >= m_numBlocks )
+		{
+			m_blockSize = 0;
+			return;
+		}
+
+		const SegmentSkip	skip = getSkip( block );
+		const gak::uint8	*end = block+1 < m_numBlocks
+			? m_docBlocks + getSkip( block+1 ).docOffset
+			: m_frequencyBlocks;
+
+		m_blockSize = block+1 < m_numBlocks ? SEGMENT_BLOCK_DOCS : m_size - block * SEGMENT_BLOCK_DOCS;
+		svbDecode(
+			m_docBlocks + skip.docOffset, end, m_blockSize, true, m_docs,
+			block ? getSkip( block-1 ).lastDoc : 0
+		);
+	}
+	void loadFrequencies()
+	{
+		const SegmentSkip	skip = getSkip( m_block );
+		const gak::uint8	*end = m_block+1 < m_numBlocks
+			? m_frequencyBlocks + getSkip( m_block+1 ).frequencyOffset
+			: m_positionBlocks;
+
+		svbDecode( m_frequencyBlocks + skip.frequencyOffset, end, m_blockSize, false, m_frequencies );
+		m_hasFrequencies = true;
+	}
+	void loadPositions()
+	{
+		if( !m_hasFrequencies )
+		{
+			loadFrequencies();
+		}
+
+		gak::uint32	numPositions = 0;
+		for( gak::uint32 i=0; i<m_blockSize; ++i )
+		{
+			m_positionStarts[i] = numPositions;
+			numPositions += m_frequencies[i];
+		}
+
+		const SegmentSkip	skip = getSkip( m_block );
+		const gak::uint8	*end = m_block+1 < m_numBlocks
+			? m_positionBlocks + getSkip( m_block+1 ).positionOffset
+			: m_end;
+
+		m_positions.resize( numPositions );
+		svbDecode( m_positionBlocks + skip.positionOffset, end, numPositions, false, m_positions.data() );
+		for( gak::uint32 i=0; i<m_blockSize; ++i )
+		{
+			gak::uint32	*positions = m_positions.data() + m_positionStarts[i];
+			for( gak::uint32 j=1; j<m_frequencies[i]; ++j )
+			{
+				positions[j] += positions[j-1];
+			}
+		}
+		m_hasPositions = true;
+	}
+
+	public:
+	SegmentPostings()
+	: m_skips( NULL ), m_docBlocks( NULL ), m_frequencyBlocks( NULL ), m_positionBlocks( NULL ), m_end( NULL ),
+	  m_size( 0 ), m_numBlocks( 0 ), m_block( 0 ), m_blockSize( 0 ), m_index( 0 ),
+	  m_hasFrequencies( false ), m_hasPositions( false )
+	{
+	}
+	/// positions the cursor on the first doc
+	void open( const gak::uint8 *postings, const SegmentTerm &term )
+	{
+		m_size = term.numPostings;
+		m_numBlocks = term.getNumBlocks();
+		m_skips = postings;
+		m_docBlocks = m_skips + m_numBlocks * sizeof( SegmentSkip );
+		m_frequencyBlocks = m_docBlocks + term.docBytes;
+		m_positionBlocks = m_frequencyBlocks + term.frequencyBytes;
+		m_end = m_positionBlocks + term.positionBytes;
+		loadBlock( 0 );
+	}
+
+	/// number of docs
+	gak::uint32 size() const
+	{
+		return m_size;
+	}
+	/// the current doc or NO_MAIL_DOC at the end
+	gak::uint32 doc() const
+	{
+		return m_block < m_numBlocks ? m_docs[m_index] : NO_MAIL_DOC;
+	}
+	void next()
+	{
+		if( ++m_index >= m_blockSize && m_block < m_numBlocks )
+		{
+			loadBlock( m_block+1 );
+		}
+	}
+	/*
+		moves to the first doc not less than target. The blocks are found by
+		galloping through the skip table, the docs by galloping in the block.
+	*/
+	void advance( gak::uint32 target )
+	{
+		if( m_block >= m_numBlocks || m_docs[m_index] >= target )
+		{
+			return;
+		}
+		if( m_docs[m_blockSize-1] < target )
+		{
+			gak::uint32	low = m_block+1, step = 1, high = low;
+			while( high < m_numBlocks && getSkip( high ).lastDoc < target )
+			{
+				low = high+1;
+				high += step;
+				step *= 2;
+			}
+			if( high > m_numBlocks )
+			{
+				high = m_numBlocks;
+			}
+			while( low < high )
+			{
+				const gak::uint32	mid = (low + high) / 2;
+				if( getSkip( mid ).lastDoc < target )
+					low = mid+1;
+				else
+					high = mid;
+			}
+			loadBlock( low );
+			if( m_block >= m_numBlocks )
+			{
+				return;
+			}
+		}
+
+		gak::uint32	low = m_index, step = 1, high = low;
+		while( high < m_blockSize && m_docs[high] < target )
+		{
+			low = high+1;
+			high += step;
+			step *= 2;
+		}
+		if( high > m_blockSize )
+		{
+			high = m_blockSize;
+		}
+		m_index = gak::uint32( std::lower_bound( m_docs + low, m_docs + high, target ) - m_docs );
+	}
+
+	/// number of occurrences in the current doc
+	gak::uint32 frequency()
+	{
+		if( !m_hasFrequencies )
+		{
+			loadFrequencies();
+		}
+		return m_frequencies[m_index];
+	}
+	/// the ascending positions in the current doc, frequency() of them
+	const gak::uint32 *positions()
+	{
+		if( !m_hasPositions )
+		{
+			loadPositions();
+		}
+		return m_positions.data() + m_positionStarts[m_index];
+	}
+};
+
+/*
+	a segment file mapped into memory. The pages are loaded when a query
+	touches them, opening a segment reads the header only.
+*/
+class MappedSegment
+{
+	MappedFile		m_file;
+	gak::STRING		m_fileName;
+	SegmentHeader	m_header;
+
+	MappedSegment( const MappedSegment & );
+	MappedSegment &operator = ( const MappedSegment & );
+
+	void corrupt() const
+	{
+		throw std::runtime_error( std::string( "Corrupt mail segment " ) + m_fileName.c_str() );
+	}
+	SegmentTerm getTerm( gak::uint64 i ) const
+	{
+		SegmentTerm	term;
+		std::memcpy( &term, m_file.getData() + m_header.termOffset + i * sizeof( SegmentTerm ), sizeof( term ) );
+		return term;
+	}
+	const char *getName( gak::uint64 offset ) const
+	{
+		return m_file.getData() + m_header.nameOffset + offset;
+	}
+
+	public:
+	MappedSegment()
+	{
+		std::memset( &m_header, 0, sizeof( m_header ) );
+	}
+
+	/// maps the file and checks, whether the tables fit into it
+	void open( const gak::STRING &fileName )
+	{
+		m_fileName = fileName;
+		if( !m_file.open( fileName ) )
+		{
+			throw gak::OpenReadError( fileName ).addCerror();
+		}
+		if( m_file.getSize() < sizeof( SegmentHeader ) )
+		{
+			corrupt();
+		}
+		std::memcpy( &m_header, m_file.getData(), sizeof( m_header ) );
+		if( m_header.magic != MAIL_SEGMENT_MAGIC || m_header.version != MAIL_SEGMENT_VERSION
+		|| m_header.mailboxOffset != sizeof( SegmentHeader )
+		|| m_header.docOffset != m_header.mailboxOffset + m_header.numMailboxes * sizeof( gak::uint64 )
+		|| m_header.termOffset != m_header.docOffset + m_header.numDocs * sizeof( MailDoc )
+		|| m_header.postingOffset != m_header.termOffset + m_header.numTerms * sizeof( SegmentTerm )
+		|| m_header.nameOffset < m_header.postingOffset || m_header.nameOffset > m_file.getSize()
+		|| m_header.numWords < m_header.numDocs )
+		{
+			corrupt();
+		}
+		m_file.adviseRandom();
+	}
+
+	gak::uint64 getGeneration() const
+	{
+		return m_header.generation;
+	}
+	gak::uint32 getNumMailboxes() const
+	{
+		return m_header.numMailboxes;
+	}
+	const char *getMailbox( gak::uint32 i ) const
+	{
+		gak::uint64	offset;
+		std::memcpy( &offset, m_file.getData() + m_header.mailboxOffset + i * sizeof( gak::uint64 ), sizeof( offset ) );
+		return getName( offset );
+	}
+	gak::uint32 getNumDocs() const
+	{
+		return m_header.numDocs;
+	}
+	gak::uint64 getNumWords() const
+	{
+		return m_header.numWords;
+	}
+	MailDoc getDoc( gak::uint32 i ) const
+	{
+		MailDoc	doc;
+		std::memcpy( &doc, m_file.getData() + m_header.docOffset + i * sizeof( MailDoc ), sizeof( doc ) );
+		return doc;
+	}
+	gak::uint64 getNumTerms() const
+	{
+		return m_header.numTerms;
+	}
+	const char *getTermName( gak::uint64 i ) const
+	{
+		return getName( getTerm( i ).name );
+	}
+	/// number of occurrences in all docs
+	gak::uint64 getTermCount( gak::uint64 i ) const
+	{
+		return getTerm( i ).numPositions;
+	}
+	void getPostings( gak::uint64 i, SegmentPostings *postings ) const
+	{
+		const SegmentTerm	term = getTerm( i );
+		if( term.postings > m_header.nameOffset - m_header.postingOffset
+		|| term.getPostingBytes() > m_header.nameOffset - m_header.postingOffset - term.postings )
+		{
+			corrupt();
+		}
+		postings->open(
+			reinterpret_cast<const gak::uint8 *>( m_file.getData() + m_header.postingOffset + term.postings ), term
+		);
+	}
+
+	/// binary search in the term dictionary
+	bool find( const std::string &name, SegmentPostings *postings ) const
+	{
+		gak::uint64	low = 0, high = m_header.numTerms;
+
+		while( low < high )
+		{
+			const gak::uint64	mid = (low + high) / 2;
+			const int			cmp = std::strcmp( name.c_str(), getTermName( mid ) );
+			if( !cmp )
+			{
+				getPostings( mid, postings );
+				return true;
+			}
+			if( cmp < 0 )
+				high = mid;
+			else
+				low = mid + 1;
+		}
+		return false;
+	}
+};
+
+struct SegmentInfo
+{
+	gak::uint64	id;				// for the file name
+	gak::uint64	generation;
+	gak::uint32	numDocs;
+
+	SegmentInfo( gak::uint64 id=0, gak::uint64 generation=0, gak::uint32 numDocs=0 )
+	: id(id), generation(generation), numDocs(numDocs) {}
+};
+
+/*
+	the list of the segments of the mail index. When a mailbox is indexed
+	again from its beginning, its mails in older segments are outdated: they
+	are skipped by the search and dropped when these segments are merged.
+*/
+class MailSegments
+{
+	static unsigned getSizeClass( gak::uint32 numDocs )
+	{
+		unsigned	sizeClass = 0;
+		while( numDocs >= SEGMENT_MERGE_FACTOR )
+		{
+			numDocs /= gak::uint32(SEGMENT_MERGE_FACTOR);
+			++sizeClass;
+		}
+		return sizeClass;
+	}
+
+	public:
+	gak::uint64							generation;			// of the last run
+	gak::uint64							nextId;
+	std::vector<SegmentInfo>			segments;			// oldest first
+	std::map<std::string, gak::uint64>	baseGenerations;	// mailbox -> run that indexed it completely
+	std::vector<std::string>			stopWords;			// sorted, not indexed in any segment
+
+	MailSegments() : generation(0), nextId(0) {}
+
+	bool isValid( const std::string &mailbox, gak::uint64 segmentGeneration ) const
+	{
+		std::map<std::string, gak::uint64>::const_iterator	it = baseGenerations.find( mailbox );
+		return it == baseGenerations.end() || segmentGeneration >= it->second;
+	}
+
+	/// selects SEGMENT_MERGE_FACTOR segments of the smallest size class that has enough
+	bool selectMerge( std::vector<std::size_t> *selection ) const
+	{
+		std::map< unsigned, std::vector<std::size_t> >	sizeClasses;
+		for( std::size_t i=0; i<segments.size(); ++i )
+		{
+			if( segments[i].numDocs <= SEGMENT_MAX_MERGE_DOCS )
+			{
+				std::vector<std::size_t>	&members = sizeClasses[getSizeClass( segments[i].numDocs )];
+				members.push_back( i );
+				if( members.size() == SEGMENT_MERGE_FACTOR )
+				{
+					*selection = members;
+					return true;
+				}
+			}
+		}
+		return false;
+	}
+	/// the merged segment takes the place of the first one selected
+	void replace( const std::vector<std::size_t> &selection, const SegmentInfo &merged )
+	{
+		segments[selection[0]] = merged;
+		for( std::size_t i=selection.size()-1; i>0; --i )
+		{
+			segments.erase( segments.begin() + std::ptrdiff_t(selection[i]) );
+		}
+	}
+
+	void toBinaryStream ( std::ostream &stream ) const
+	{
+		gak::toBinaryStream( stream, generation );
+		gak::toBinaryStream( stream, nextId );
+		vectorToBinaryStream( stream, segments );
+		gak::toBinaryStream( stream, gak::uint64( baseGenerations.size() ) );
+		for(
+			std::map<std::string, gak::uint64>::const_iterator it = baseGenerations.begin(), endIT = baseGenerations.end();
+			it != endIT;
+			++it
+		)
+		{
+			stringToBinaryStream( stream, it->first );
+			gak::toBinaryStream( stream, it->second );
+		}
+		gak::toBinaryStream( stream, gak::uint64( stopWords.size() ) );
+		for( std::size_t i=0; i<stopWords.size(); ++i )
+		{
+			stringToBinaryStream( stream, stopWords[i] );
+		}
+	}
+	void fromBinaryStream ( std::istream &stream )
+	{
+		gak::uint64	count;
+
+		gak::fromBinaryStream( stream, &generation );
+		gak::fromBinaryStream( stream, &nextId );
+		vectorFromBinaryStream( stream, &segments );
+		baseGenerations.clear();
+		gak::fromBinaryStream( stream, &count );
+		for( gak::uint64 i=0; i<count; ++i )
+		{
+			std::string	mailbox;
+			stringFromBinaryStream( stream, &mailbox );
+			gak::fromBinaryStream( stream, &baseGenerations[mailbox] );
+		}
+		stopWords.clear();
+		if( stream.peek() != std::istream::traits_type::eof() )
+		{
+			gak::fromBinaryStream( stream, &count );
+			stopWords.resize( std::size_t( count ) );
+			for( std::size_t i=0; i<stopWords.size(); ++i )
+			{
+				stringFromBinaryStream( stream, &stopWords[i] );
+			}
+		}
+	}
+};
+
+// --------------------------------------------------------------------- //
+// ----- module functions ---------------------------------------------- //
+// --------------------------------------------------------------------- //
+
+/*
+	appends the postings of one term in the layout of SegmentHeader to
+	postings, term gets their sizes
+*/
+inline void encodePostings(
+	const MailPostings &termPostings, SegmentTerm *term, std::vector<gak::uint8> *postings
+)
+{
+	std::vector<SegmentSkip>	skips;
+	std::vector<gak::uint8>		docBlocks, frequencyBlocks, positionBlocks;
+	std::vector<gak::uint32>	values;
+
+	term->numPostings = gak::uint32( termPostings.size() );
+	term->numPositions = 0;
+	for( std::size_t first=0; first<termPostings.size(); first += SEGMENT_BLOCK_DOCS )
+	{
+		const std::size_t	last = std::min( first + SEGMENT_BLOCK_DOCS, termPostings.size() );
+		SegmentSkip			skip;
+
+		skip.lastDoc = termPostings[last-1].doc;
+		skip.docOffset = gak::uint32( docBlocks.size() );
+		skip.frequencyOffset = gak::uint32( frequencyBlocks.size() );
+		skip.reserved = 0;
+		skip.positionOffset = positionBlocks.size();
+		skips.push_back( skip );
+
+		values.clear();
+		for( std::size_t i=first; i<last; ++i )
+		{
+			values.push_back( termPostings[i].doc );
+		}
+		svbEncode( values.data(), values.size(), true, &docBlocks, first ? termPostings[first-1].doc : 0 );
+
+		values.clear();
+		for( std::size_t i=first; i<last; ++i )
+		{
+			values.push_back( gak::uint32( termPostings[i].positions.size() ) );
+		}
+		svbEncode( values.data(), values.size(), false, &frequencyBlocks );
+
+		values.clear();
+		for( std::size_t i=first; i<last; ++i )
+		{
+			const std::vector<gak::uint32>	&positions = termPostings[i].positions;
+			for( std::size_t j=0; j<positions.size(); ++j )
+			{
+				values.push_back( j ? positions[j] - positions[j-1] : positions[j] );
+			}
+		}
+		svbEncode( values.data(), values.size(), false, &positionBlocks );
+		term->numPositions += gak::uint32( values.size() );
+	}
+	term->docBytes = gak::uint32( docBlocks.size() );
+	term->frequencyBytes = gak::uint32( frequencyBlocks.size() );
+	term->positionBytes = positionBlocks.size();
+
+	if( !skips.empty() )
+	{
+		const gak::uint8	*skipData = reinterpret_cast<const gak::uint8 *>( &skips[0] );
+		postings->insert( postings->end(), skipData, skipData + skips.size() * sizeof( SegmentSkip ) );
+	}
+	postings->insert( postings->end(), docBlocks.begin(), docBlocks.end() );
+	postings->insert( postings->end(), frequencyBlocks.begin(), frequencyBlocks.end() );
+	postings->insert( postings->end(), positionBlocks.begin(), positionBlocks.end() );
+}
+
+/// writes a segment in the layout of SegmentHeader
+inline void writeSegment( const gak::STRING &fileName, const MailSegment &segment )
+{
+	std::ofstream	out( fileName, std::ios::binary );
+	if( !out )
+	{
+		throw gak::OpenWriteError( fileName ).addCerror();
+	}
+
+	SegmentHeader	header;
+	std::memset( &header, 0, sizeof( header ) );
+	header.magic = MAIL_SEGMENT_MAGIC;
+	header.version = MAIL_SEGMENT_VERSION;
+	header.numMailboxes = gak::uint32( segment.mailboxes.size() );
+	header.numDocs = gak::uint32( segment.docs.size() );
+	header.generation = segment.generation;
+	header.numTerms = segment.terms.size();
+	header.mailboxOffset = sizeof( SegmentHeader );
+	header.docOffset = header.mailboxOffset + header.numMailboxes * sizeof( gak::uint64 );
+	header.termOffset = header.docOffset + header.numDocs * sizeof( MailDoc );
+	for( std::size_t i=0; i<segment.docs.size(); ++i )
+	{
+		header.numWords += segment.docs[i].numWords;
+	}
+	header.postingOffset = header.termOffset + header.numTerms * sizeof( SegmentTerm );
+
+	std::vector<gak::uint64>	mailboxNames;
+	std::vector<SegmentTerm>	terms;
+	std::vector<gak::uint8>		postings;
+	std::string					names;
+
+	for( std::size_t i=0; i<segment.mailboxes.size(); ++i )
+	{
+		mailboxNames.push_back( names.size() );
+		names.append( segment.mailboxes[i].c_str(), segment.mailboxes[i].size()+1 );
+	}
+	for(
+		MailTermMap::const_iterator it = segment.terms.begin(), endIT = segment.terms.end();
+		it != endIT;
+		++it
+	)
+	{
+		SegmentTerm	term;
+
+		term.name = names.size();
+		term.postings = postings.size();
+		names.append( it->first.c_str(), it->first.size()+1 );
+		encodePostings( it->second, &term, &postings );
+		terms.push_back( term );
+	}
+	header.nameOffset = header.postingOffset + postings.size();
+
+	out.write( reinterpret_cast<const char *>( &header ), sizeof( header ) );
+	if( !mailboxNames.empty() )
+	{
+		out.write( reinterpret_cast<const char *>( &mailboxNames[0] ), mailboxNames.size() * sizeof( gak::uint64 ) );
+	}
+	if( !segment.docs.empty() )
+	{
+		out.write( reinterpret_cast<const char *>( &segment.docs[0] ), segment.docs.size() * sizeof( MailDoc ) );
+	}
+	if( !terms.empty() )
+	{
+		out.write( reinterpret_cast<const char *>( &terms[0] ), terms.size() * sizeof( SegmentTerm ) );
+	}
+	if( !postings.empty() )
+	{
+		out.write( reinterpret_cast<const char *>( &postings[0] ), postings.size() );
+	}
+	out.write( names.data(), std::streamsize( names.size() ) );
+	out.close();
+	if( !out )
+	{
+		throw std::runtime_error( std::string( "Write error " ) + fileName.c_str() );
+	}
+}
+
+inline gak::STRING getSegmentFile( const gak::STRING &indexPath, gak::uint64 id )
+{
+	static const char hexDigits[] = "0123456789abcdef";
+
+	gak::STRING	segmentFile = indexPath + MAIL_SEGMENT_FILE;
+	for( int shift = 60; shift >= 0; shift -= 4 )
+	{
+		segmentFile += hexDigits[(id >> shift) & 0xF];
+	}
+	return segmentFile;
+}
+
+/*
+	walks the sorted dictionaries of several segments in parallel
+*/
+class SegmentTermWalker
+{
+	const std::vector<const MappedSegment *>	&m_inputs;
+	std::vector<gak::uint64>					m_next;
+
+	public:
+	typedef std::vector< std::pair<std::size_t, gak::uint64> >	Members;	// input -> term
+
+	SegmentTermWalker( const std::vector<const MappedSegment *> &inputs )
+	: m_inputs( inputs ), m_next( inputs.size(), 0 )
+	{
+	}
+
+	/// the next name in bytewise order and the inputs that have it, false at the end
+	bool next( const char **name, Members *members )
+	{
+		*name = NULL;
+		members->clear();
+		for( std::size_t i=0; i<m_inputs.size(); ++i )
+		{
+			if( m_next[i] < m_inputs[i]->getNumTerms() )
+			{
+				const char	*termName = m_inputs[i]->getTermName( m_next[i] );
+				const int	cmp = *name ? std::strcmp( termName, *name ) : -1;
+				if( cmp < 0 )
+				{
+					*name = termName;
+					members->clear();
+				}
+				if( cmp <= 0 )
+				{
+					members->push_back( std::make_pair( i, m_next[i] ) );
+				}
+			}
+		}
+		for( std::size_t i=0; i<members->size(); ++i )
+		{
+			++m_next[(*members)[i].first];
+		}
+		return *name != NULL;
+	}
+};
+
+/*
+	merges segments, oldest first, into a new segment file and drops the
+	outdated mails. The docs keep their order, so the postings stay sorted.
+	The terms are merged one by one: the postings of a term are decoded,
+	get the new doc numbers and are written immediately, so only the docs
+	and the dictionary are held in memory. The first pass counts the terms
+	that still have docs, the table of terms precedes the postings.
+	Returns the number of docs of the new segment.
+*/
+inline gak::uint32 mergeSegments(
+	const MailSegments &manifest, const std::vector<const MappedSegment *> &inputs,
+	const gak::STRING &fileName, gak::uint64 *generation
+)
+{
+	std::map<std::string, gak::uint32>			mailboxIds;
+	std::vector<std::string>					mailboxes;
+	std::vector<MailDoc>						docs;
+	std::vector< std::vector<gak::uint32> >		docMaps( inputs.size() );
+	std::vector<bool>							hasOutdated( inputs.size(), false );
+	gak::uint64									numWords = 0;
+
+	*generation = 0;
+	for( std::size_t i=0; i<inputs.size(); ++i )
+	{
+		const MappedSegment	&input = *inputs[i];
+
+		*generation = std::max( *generation, input.getGeneration() );
+		docMaps[i].resize( input.getNumDocs(), NO_MAIL_DOC );
+		for( gak::uint32 j=0; j<input.getNumDocs(); ++j )
+		{
+			const MailDoc		doc = input.getDoc( j );
+			const std::string	mailbox = input.getMailbox( doc.mailbox );
+			if( !manifest.isValid( mailbox, input.getGeneration() ) )
+			{
+				hasOutdated[i] = true;
+				continue;
+			}
+
+			std::map<std::string, gak::uint32>::iterator	it = mailboxIds.find( mailbox );
+			if( it == mailboxIds.end() )
+			{
+				it = mailboxIds.insert( std::make_pair( mailbox, gak::uint32(mailboxes.size()) ) ).first;
+				mailboxes.push_back( mailbox );
+			}
+			docMaps[i][j] = gak::uint32(docs.size());
+			docs.push_back( MailDoc( it->second, doc.numWords, doc.mailIndex ) );
+			numWords += doc.numWords;
+		}
+	}
+
+	const char					*name;
+	SegmentTermWalker::Members	members;
+	gak::uint64					numTerms = 0;
+	{
+		SegmentTermWalker	walker( inputs );
+		while( walker.next( &name, &members ) )
+		{
+			bool	found = false;
+			for( std::size_t m=0; !found && m<members.size(); ++m )
+			{
+				const std::size_t	i = members[m].first;
+				SegmentPostings		postings;
+
+				inputs[i]->getPostings( members[m].second, &postings );
+				found = postings.size() && !hasOutdated[i];
+				for( ; !found && postings.doc() != NO_MAIL_DOC; postings.next() )
+				{
+					found = docMaps[i][postings.doc()] != NO_MAIL_DOC;
+				}
+			}
+			if( found )
+			{
+				++numTerms;
+			}
+		}
+	}
+
+	std::ofstream	out( fileName, std::ios::binary );
+	if( !out )
+	{
+		throw gak::OpenWriteError( fileName ).addCerror();
+	}
+
+	SegmentHeader	header;
+	std::memset( &header, 0, sizeof( header ) );
+	header.magic = MAIL_SEGMENT_MAGIC;
+	header.version = MAIL_SEGMENT_VERSION;
+	header.numMailboxes = gak::uint32( mailboxes.size() );
+	header.numDocs = gak::uint32( docs.size() );
+	header.generation = *generation;
+	header.numWords = numWords;
+	header.numTerms = numTerms;
+	header.mailboxOffset = sizeof( SegmentHeader );
+	header.docOffset = header.mailboxOffset + header.numMailboxes * sizeof( gak::uint64 );
+	header.termOffset = header.docOffset + header.numDocs * sizeof( MailDoc );
+	header.postingOffset = header.termOffset + header.numTerms * sizeof( SegmentTerm );
+
+	std::vector<gak::uint64>	mailboxNames;
+	std::string					names;
+	for( std::size_t i=0; i<mailboxes.size(); ++i )
+	{
+		mailboxNames.push_back( names.size() );
+		names.append( mailboxes[i].c_str(), mailboxes[i].size()+1 );
+	}
+
+	// the header and the terms are written again, when they are complete
+	out.write( reinterpret_cast<const char *>( &header ), sizeof( header ) );
+	if( !mailboxNames.empty() )
+	{
+		out.write( reinterpret_cast<const char *>( &mailboxNames[0] ), mailboxNames.size() * sizeof( gak::uint64 ) );
+	}
+	if( !docs.empty() )
+	{
+		out.write( reinterpret_cast<const char *>( &docs[0] ), docs.size() * sizeof( MailDoc ) );
+	}
+	std::vector<SegmentTerm>	terms;
+	terms.resize( std::size_t( numTerms ) );
+	if( !terms.empty() )
+	{
+		out.write( reinterpret_cast<const char *>( &terms[0] ), terms.size() * sizeof( SegmentTerm ) );
+	}
+	terms.clear();
+
+	MailPostings				termPostings;
+	std::vector<gak::uint8>		postings;
+	gak::uint64					postingBytes = 0;
+	SegmentTermWalker			walker( inputs );
+	while( walker.next( &name, &members ) )
+	{
+		termPostings.clear();
+		for( std::size_t m=0; m<members.size(); ++m )
+		{
+			const std::size_t	i = members[m].first;
+			SegmentPostings		input;
+
+			inputs[i]->getPostings( members[m].second, &input );
+			for( ; input.doc() != NO_MAIL_DOC; input.next() )
+			{
+				const gak::uint32	doc = docMaps[i][input.doc()];
+				if( doc != NO_MAIL_DOC )
+				{
+					const gak::uint32	*positions = input.positions();
+
+					termPostings.push_back( MailPosting( doc ) );
+					termPostings.back().positions.assign( positions, positions + input.frequency() );
+				}
+			}
+		}
+		if( termPostings.empty() )
+		{
+			continue;
+		}
+
+		SegmentTerm	term;
+		term.name = names.size();
+		term.postings = postingBytes;
+		names.append( name, std::strlen( name )+1 );
+
+		postings.clear();
+		encodePostings( termPostings, &term, &postings );
+		out.write( reinterpret_cast<const char *>( postings.data() ), std::streamsize( postings.size() ) );
+		postingBytes += postings.size();
+		terms.push_back( term );
+	}
+	if( terms.size() != numTerms )
+	{
+		throw std::runtime_error( std::string( "Term count changed while merging " ) + fileName.c_str() );
+	}
+	header.nameOffset = header.postingOffset + postingBytes;
+	out.write( names.data(), std::streamsize( names.size() ) );
+
+	out.seekp( 0 );
+	out.write( reinterpret_cast<const char *>( &header ), sizeof( header ) );
+	if( !terms.empty() )
+	{
+		out.seekp( std::streamoff( header.termOffset ) );
+		out.write( reinterpret_cast<const char *>( &terms[0] ), terms.size() * sizeof( SegmentTerm ) );
+	}
+	out.close();
+	if( !out )
+	{
+		throw std::runtime_error( std::string( "Write error " ) + fileName.c_str() );
+	}
+
+	return header.numDocs;
+}
+
+/// adds the number of occurrences of each term
+inline void addStatistik( const MappedSegment &segment, std::map<std::string, std::size_t> *counts )
+{
+	for( gak::uint64 i=0; i<segment.getNumTerms(); ++i )
+	{
+		(*counts)[segment.getTermName( i )] += std::size_t( segment.getTermCount( i ) );
+	}
+}
+
+inline void addStatistik( const MailSegment &segment, std::map<std::string, std::size_t> *counts )
+{
+	for(
+		MailTermMap::const_iterator it = segment.terms.begin(), endIT = segment.terms.end();
+		it != endIT;
+		++it
+	)
+	{
+		std::size_t	&count = (*counts)[it->first];
+		for( std::size_t i=0; i<it->second.size(); ++i )
+		{
+			count += it->second[i].positions.size();
+		}
+	}
+}
+
+/// the most frequent first
+inline void sortStatistik( const std::map<std::string, std::size_t> &counts, WordCounts *sorted )
+{
+	struct CountGreater
+	{
+		bool operator () ( const WordCount &left, const WordCount &right ) const
+		{
+			return left.second > right.second;
+		}
+	};
+
+	sorted->assign( counts.begin(), counts.end() );
+	std::stable_sort( sorted->begin(), sorted->end(), CountGreater() );
+}
+
+// --------------------------------------------------------------------- //
+// ----- exported datas ------------------------------------------------ //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- module static data -------------------------------------------- //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- class static data --------------------------------------------- //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- prototypes ---------------------------------------------------- //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- module functions ---------------------------------------------- //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- class inlines ------------------------------------------------- //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- class constructors/destructors -------------------------------- //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- class static functions ---------------------------------------- //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- class privates ------------------------------------------------ //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- class protected ----------------------------------------------- //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- class virtuals ------------------------------------------------ //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- class publics ------------------------------------------------- //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- entry points -------------------------------------------------- //
+// --------------------------------------------------------------------- //
+
+#ifdef __BORLANDC__
+#	pragma option -RT.
+#	pragma option -b.
+#	pragma option -a.
+#	pragma option -p.
+#endif
+
+#endif //  MAIL_SEGMENT_H
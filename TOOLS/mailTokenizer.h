@@ -0,0 +1,523 @@
+/*
+		Project:		GAK_CLI
+		Module:			mailTokenizer.h
+		Description:	splits mail text into index terms
+		Author:			Martin Gckler
+		Address:		Hofmannsthalweg 14, A-4030 Linz
+		Web:			https://www.gaeckler.at/
+
+		Copyright:		(c) 1988-2025 Martin Gckler
+
+		This program is free software: you can redistribute it and/or modify  
+		it under the terms of the GNU General Public License as published by  
+		the Free Software Foundation, version 3.
+
+		You should have received a copy of the GNU General Public License 
+		along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+		THIS SOFTWARE IS PROVIDED BY Martin Gckler, Austria, Linz ``AS IS''
+		AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+		TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+		PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR
+		CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+		SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+		LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+		USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+		ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+		OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+		OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+		SUCH DAMAGE.
+*/
+
+#ifndef MAIL_TOKENIZER_H
+#define MAIL_TOKENIZER_H
+
+// --------------------------------------------------------------------- //
+// ----- switches ------------------------------------------------------ //
+// --------------------------------------------------------------------- //
+
+#if defined( __GNUC__ ) && defined( __SSE2__ )
+#	define TOKENIZER_SSE2_KERNEL	1		// part of x86-64, no runtime check
+#else
+#	define TOKENIZER_SSE2_KERNEL	0
+#endif
+
+#if defined( __GNUC__ ) && defined( __aarch64__ )
+#	define TOKENIZER_NEON_KERNEL	1
+#else
+#	define TOKENIZER_NEON_KERNEL	0
+#endif
+
+// --------------------------------------------------------------------- //
+// ----- includes ------------------------------------------------------ //
+// --------------------------------------------------------------------- //
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <gak/types.h>
+
+#if TOKENIZER_SSE2_KERNEL
+#	include <emmintrin.h>
+#endif
+
+#if TOKENIZER_NEON_KERNEL
+#	include <arm_neon.h>
+#endif
+
+// --------------------------------------------------------------------- //
+// ----- imported datas ------------------------------------------------ //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- module switches ----------------------------------------------- //
+// --------------------------------------------------------------------- //
+
+#ifdef __BORLANDC__
+#	pragma option -RT-
+#	pragma option -b
+#	pragma option -a4
+#	pragma option -pc
+#endif
+
+// --------------------------------------------------------------------- //
+// ----- constants ----------------------------------------------------- //
+// --------------------------------------------------------------------- //
+
+static const std::size_t MIN_TERM_LEN = 2;
+static const std::size_t MAX_TERM_LEN = 64;		// longer words are encoded data, not text
+static const std::size_t TOKENIZER_BLOCK = 16;	// bytes classified at once
+
+// --------------------------------------------------------------------- //
+// ----- macros -------------------------------------------------------- //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- type definitions ---------------------------------------------- //
+// --------------------------------------------------------------------- //
+
+/// term -> word positions in one mail
+typedef std::map< std::string, std::vector<gak::uint32> >	MailTerms;
+
+// --------------------------------------------------------------------- //
+// ----- class definitions --------------------------------------------- //
+// --------------------------------------------------------------------- //
+
+/*
+	the stop words in an open addressing hash table with linear probing.
+	The words are stored in lower case, the terms looked up are lower
+	case already, so no case insensitive compare is needed.
+*/
+class StopWordSet
+{
+	struct Entry
+	{
+		gak::uint32	hash;
+		std::string	word;			// empty for a free slot
+	};
+
+	std::vector<Entry>	m_table;
+	std::size_t			m_size;
+
+	static gak::uint32 getHash( const char *word, std::size_t len )
+	{
+		gak::uint32	hash = 2166136261U;				// FNV-1a
+		for( std::size_t i=0; i<len; ++i )
+		{
+			hash = (hash ^ (unsigned char)word[i]) * 16777619U;
+		}
+		return hash;
+	}
+	std::size_t findSlot( const char *word, std::size_t len, gak::uint32 hash ) const
+	{
+		const std::size_t	mask = m_table.size()-1;
+		std::size_t			slot = hash & mask;
+
+		while( !m_table[slot].word.empty() )
+		{
+			const Entry	&entry = m_table[slot];
+			if( entry.hash == hash && entry.word.size() == len && !std::memcmp( entry.word.data(), word, len ) )
+			{
+				break;
+			}
+			slot = (slot + 1) & mask;
+		}
+		return slot;
+	}
+	void grow()
+	{
+		std::vector<Entry>	oldTable( m_table.empty() ? 16 : m_table.size()*2 );
+		oldTable.swap( m_table );
+		for( std::size_t i=0; i<oldTable.size(); ++i )
+		{
+			Entry	&entry = oldTable[i];
+			if( !entry.word.empty() )
+			{
+				Entry	&slot = m_table[findSlot( entry.word.data(), entry.word.size(), entry.hash )];
+				slot.hash = entry.hash;
+				slot.word.swap( entry.word );
+			}
+		}
+	}
+
+	public:
+	StopWordSet() : m_size( 0 ) {}
+
+	std::size_t size() const
+	{
+		return m_size;
+	}
+	void clear()
+	{
+		m_table.clear();
+		m_size = 0;
+	}
+
+	/// the word is stored in ASCII lower case like the terms
+	void addElement( const char *word )
+	{
+		std::string	lower( word );
+		for( std::size_t i=0; i<lower.size(); ++i )
+		{
+			if( lower[i] >= 'A' && lower[i] <= 'Z' )
+			{
+				lower[i] = char(lower[i] - 'A' + 'a');
+			}
+		}
+		if( lower.empty() )
+		{
+			return;
+		}
+		// at most half of the slots are used, so the probe sequences stay short
+		if( (m_size+1)*2 > m_table.size() )
+		{
+			grow();
+		}
+
+		const gak::uint32	hash = getHash( lower.data(), lower.size() );
+		Entry				&slot = m_table[findSlot( lower.data(), lower.size(), hash )];
+		if( slot.word.empty() )
+		{
+			slot.hash = hash;
+			slot.word.swap( lower );
+			++m_size;
+		}
+	}
+	bool hasElement( const char *word, std::size_t len ) const
+	{
+		return m_size && !m_table[findSlot( word, len, getHash( word, len ) )].word.empty();
+	}
+	/// the words sorted, so two sets can be compared
+	void getWords( std::vector<std::string> *words ) const
+	{
+		words->clear();
+		for( std::size_t i=0; i<m_table.size(); ++i )
+		{
+			if( !m_table[i].word.empty() )
+			{
+				words->push_back( m_table[i].word );
+			}
+		}
+		std::sort( words->begin(), words->end() );
+	}
+};
+
+// --------------------------------------------------------------------- //
+// ----- module functions ---------------------------------------------- //
+// --------------------------------------------------------------------- //
+
+/// letters, digits and all non ASCII bytes, so UTF-8 and Latin-1 words stay whole
+inline bool isTermChar( unsigned char c )
+{
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c >= 0x80;
+}
+
+/*
+	returns the length of the UTF-8 punctuation or space at text, 0 for a
+	letter or a byte that is not UTF-8. So quotes and dashes do not stick
+	to the words, Latin-1 text remains as before.
+*/
+inline std::size_t getUtf8Separator( const unsigned char *text, std::size_t size )
+{
+	gak::uint32	codePoint;
+	std::size_t	len;
+
+	if( text[0] >= 0xC2 && text[0] <= 0xDF && size >= 2 && (text[1] & 0xC0) == 0x80 )
+	{
+		codePoint = (gak::uint32(text[0] & 0x1F) << 6) | (text[1] & 0x3F);
+		len = 2;
+	}
+	else if( text[0] >= 0xE0 && text[0] <= 0xEF && size >= 3 && (text[1] & 0xC0) == 0x80 && (text[2] & 0xC0) == 0x80 )
+	{
+		codePoint = (gak::uint32(text[0] & 0x0F) << 12) | (gak::uint32(text[1] & 0x3F) << 6) | (text[2] & 0x3F);
+		len = 3;
+	}
+	else
+	{
+		return 0;
+	}
+
+	const bool	separator = (codePoint >= 0xA0 && codePoint <= 0xBF && codePoint != 0xAA && codePoint != 0xB5 && codePoint != 0xBA)
+		|| codePoint == 0xD7 || codePoint == 0xF7
+		|| (codePoint >= 0x2000 && codePoint <= 0x206F)		// general punctuation
+		|| (codePoint >= 0x3000 && codePoint <= 0x303F);	// CJK punctuation
+	return separator ? len : 0;
+}
+
+/// the length of a UTF-8 sequence at text or 1 for other bytes
+inline std::size_t getUtf8Length( const unsigned char *text, std::size_t size )
+{
+	const std::size_t	len = text[0] >= 0xF0 && text[0] <= 0xF4 ? 4 : text[0] >= 0xE0 ? 3 : text[0] >= 0xC2 ? 2 : 1;
+	if( len > size )
+	{
+		return 1;
+	}
+	for( std::size_t i=1; i<len; ++i )
+	{
+		if( (text[i] & 0xC0) != 0x80 )
+		{
+			return 1;
+		}
+	}
+	return len;
+}
+
+#if TOKENIZER_SSE2_KERNEL
+/// bit i is set, if byte i is an ASCII letter or digit, nonAscii gets the bytes >= 0x80
+inline unsigned classifyBlock( const unsigned char *text, unsigned *nonAscii )
+{
+	const __m128i	bytes = _mm_loadu_si128( (const __m128i*)text );
+	const __m128i	lower = _mm_or_si128( bytes, _mm_set1_epi8( 0x20 ) );
+	const __m128i	letter = _mm_and_si128(
+		_mm_cmpgt_epi8( lower, _mm_set1_epi8( 'a'-1 ) ), _mm_cmplt_epi8( lower, _mm_set1_epi8( 'z'+1 ) )
+	);
+	const __m128i	digit = _mm_and_si128(
+		_mm_cmpgt_epi8( bytes, _mm_set1_epi8( '0'-1 ) ), _mm_cmplt_epi8( bytes, _mm_set1_epi8( '9'+1 ) )
+	);
+
+	*nonAscii = unsigned( _mm_movemask_epi8( bytes ) );
+	return unsigned( _mm_movemask_epi8( _mm_or_si128( letter, digit ) ) );
+}
+#elif TOKENIZER_NEON_KERNEL
+inline unsigned getBlockMask( uint8x16_t flags )
+{
+	static const gak::uint8	bitValues[16] = { 1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128 };
+	const uint8x16_t		bits = vandq_u8( flags, vld1q_u8( bitValues ) );
+
+	return unsigned( vaddv_u8( vget_low_u8( bits ) ) ) | (unsigned( vaddv_u8( vget_high_u8( bits ) ) ) << 8);
+}
+inline unsigned classifyBlock( const unsigned char *text, unsigned *nonAscii )
+{
+	const uint8x16_t	bytes = vld1q_u8( text );
+	const uint8x16_t	lower = vorrq_u8( bytes, vdupq_n_u8( 0x20 ) );
+	const uint8x16_t	letter = vandq_u8( vcgeq_u8( lower, vdupq_n_u8( 'a' ) ), vcleq_u8( lower, vdupq_n_u8( 'z' ) ) );
+	const uint8x16_t	digit = vandq_u8( vcgeq_u8( bytes, vdupq_n_u8( '0' ) ), vcleq_u8( bytes, vdupq_n_u8( '9' ) ) );
+
+	*nonAscii = getBlockMask( vcgeq_u8( bytes, vdupq_n_u8( 0x80 ) ) );
+	return getBlockMask( vorrq_u8( letter, digit ) );
+}
+#endif
+
+/*
+	calls addWord( start, end ) for every word of text. Blocks of 64 ASCII
+	bytes are classified at once and the word starts and ends are taken
+	from the bit mask. Blocks with other bytes are read byte by byte, UTF-8
+	punctuation separates words there.
+*/
+template <class WordFunc>
+void splitWords( const char *text, std::size_t size, WordFunc &addWord )
+{
+	const unsigned char	*bytes = reinterpret_cast<const unsigned char *>( text );
+	const std::size_t	noWord = std::size_t(-1);
+	std::size_t			wordStart = noWord;
+	std::size_t			pos = 0;
+
+	while( pos < size )
+	{
+#if TOKENIZER_SSE2_KERNEL || TOKENIZER_NEON_KERNEL
+		if( size - pos >= 4*TOKENIZER_BLOCK )
+		{
+			gak::uint64	termChars = 0, nonAscii = 0;
+			for( unsigned i=0; i<4; ++i )
+			{
+				unsigned	blockNonAscii;
+				termChars |= gak::uint64( classifyBlock( bytes + pos + i*TOKENIZER_BLOCK, &blockNonAscii ) ) << (i*TOKENIZER_BLOCK);
+				nonAscii |= gak::uint64( blockNonAscii ) << (i*TOKENIZER_BLOCK);
+			}
+			if( !nonAscii )
+			{
+				const gak::uint64	before = (termChars << 1) | (wordStart != noWord ? 1 : 0);
+				gak::uint64			starts = termChars & ~before;
+				gak::uint64			ends = ~termChars & before;
+
+				for( gak::uint64 changes = starts | ends; changes; changes &= changes-1 )
+				{
+					const std::size_t	bit = std::size_t( __builtin_ctzll( changes ) );
+					if( (starts >> bit) & 1 )
+					{
+						wordStart = pos + bit;
+					}
+					else
+					{
+						addWord( wordStart, pos + bit );
+						wordStart = noWord;
+					}
+				}
+				pos += 4*TOKENIZER_BLOCK;
+				continue;
+			}
+		}
+#endif
+		const std::size_t	blockEnd = std::min( size, pos + 4*TOKENIZER_BLOCK );
+		while( pos < blockEnd )
+		{
+			const unsigned char	c = bytes[pos];
+			bool				termChar = isTermChar( c );
+			std::size_t			len = 1;
+
+			if( c >= 0x80 )
+			{
+				len = getUtf8Separator( bytes + pos, size - pos );
+				termChar = !len;
+				if( termChar )
+				{
+					len = getUtf8Length( bytes + pos, size - pos );
+				}
+			}
+			if( termChar && wordStart == noWord )
+			{
+				wordStart = pos;
+			}
+			else if( !termChar && wordStart != noWord )
+			{
+				addWord( wordStart, pos );
+				wordStart = noWord;
+			}
+			pos += len;
+		}
+	}
+	if( wordStart != noWord )
+	{
+		addWord( wordStart, size );
+	}
+}
+
+/// collects the terms of a mail, see tokenizeMail
+class MailTermCollector
+{
+	const char			*m_text;
+	const StopWordSet	*m_stopWords;
+	MailTerms			*m_terms;
+	gak::uint32			m_position;
+	char				m_lower[MAX_TERM_LEN];
+	std::string			m_term;
+
+	public:
+	MailTermCollector( const char *text, const StopWordSet *stopWords, MailTerms *terms )
+	: m_text( text ), m_stopWords( stopWords ), m_terms( terms ), m_position( 0 )
+	{
+	}
+
+	void operator () ( std::size_t start, std::size_t end )
+	{
+		const std::size_t	len = end - start;
+		if( len >= MIN_TERM_LEN && len <= MAX_TERM_LEN )
+		{
+			for( std::size_t j=0; j<len; ++j )
+			{
+				const char	c = m_text[start+j];
+				m_lower[j] = c >= 'A' && c <= 'Z' ? char(c - 'A' + 'a') : c;
+			}
+			if( !m_stopWords || !m_stopWords->hasElement( m_lower, len ) )
+			{
+				m_term.assign( m_lower, len );
+				(*m_terms)[m_term].push_back( m_position );
+			}
+		}
+		++m_position;
+	}
+
+	gak::uint32 getNumWords() const
+	{
+		return m_position;
+	}
+};
+
+/*
+	splits text into lower case terms for the segment index. The position
+	counts every word, also stop words and words too short or too long,
+	so phrases keep their distances. Returns the number of words.
+	The same function splits the search queries without stop words.
+*/
+inline gak::uint32 tokenizeMail(
+	const char *text, std::size_t size, const StopWordSet *stopWords, MailTerms *terms
+)
+{
+	MailTermCollector	collector( text, stopWords, terms );
+	splitWords( text, size, collector );
+	return collector.getNumWords();
+}
+
+// --------------------------------------------------------------------- //
+// ----- exported datas ------------------------------------------------ //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- module static data -------------------------------------------- //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- class static data --------------------------------------------- //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- prototypes ---------------------------------------------------- //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- module functions ---------------------------------------------- //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- class inlines ------------------------------------------------- //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- class constructors/destructors -------------------------------- //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- class static functions ---------------------------------------- //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- class privates ------------------------------------------------ //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- class protected ----------------------------------------------- //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- class virtuals ------------------------------------------------ //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- class publics ------------------------------------------------- //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- entry points -------------------------------------------------- //
+// --------------------------------------------------------------------- //
+
+#ifdef __BORLANDC__
+#	pragma option -RT.
+#	pragma option -b.
+#	pragma option -a.
+#	pragma option -p.
+#endif
+
+#endif //  MAIL_TOKENIZER_H
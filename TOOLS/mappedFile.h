@@ -0,0 +1,287 @@
+/*
+		Project:		GAK_CLI
+		Module:			mappedFile.h
+		Description:	read only memory mapping of a file
+		Author:			Martin Gckler
+		Address:		Hofmannsthalweg 14, A-4030 Linz
+		Web:			https://www.gaeckler.at/
+
+		Copyright:		(c) 1988-2025 Martin Gckler
+
+		This program is free software: you can redistribute it and/or modify  
+		it under the terms of the GNU General Public License as published by  
+		the Free Software Foundation, version 3.
+
+		You should have received a copy of the GNU General Public License 
+		along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+		THIS SOFTWARE IS PROVIDED BY Martin Gckler, Austria, Linz ``AS IS''
+		AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+		TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+		PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR
+		CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+		SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+		LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+		USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+		ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+		OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+		OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+		SUCH DAMAGE.
+*/
+
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+// --------------------------------------------------------------------- //
+// ----- switches ------------------------------------------------------ //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- includes ------------------------------------------------------ //
+// --------------------------------------------------------------------- //
+
+#include <cstddef>
+
+#ifdef _Windows
+#	include <windows.h>
+#else
+#	include <fcntl.h>
+#	include <unistd.h>
+#	include <sys/mman.h>
+#	include <sys/stat.h>
+#endif
+
+// --------------------------------------------------------------------- //
+// ----- imported datas ------------------------------------------------ //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- module switches ----------------------------------------------- //
+// --------------------------------------------------------------------- //
+
+#ifdef __BORLANDC__
+#	pragma option -RT-
+#	pragma option -b
+#	pragma option -a4
+#	pragma option -pc
+#endif
+
+// --------------------------------------------------------------------- //
+// ----- constants ----------------------------------------------------- //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- macros -------------------------------------------------------- //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- type definitions ---------------------------------------------- //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- class definitions --------------------------------------------- //
+// --------------------------------------------------------------------- //
+
+/// read only view of a complete file, pages are loaded by the OS on demand
+class MappedFile
+{
+	const char	*m_data;
+	std::size_t	m_size;
+#ifdef _Windows
+	HANDLE		m_file, m_mapping;
+#else
+	int			m_fd;
+#endif
+
+	MappedFile( const MappedFile & );
+	MappedFile &operator = ( const MappedFile & );
+
+	public:
+	MappedFile() : m_data( NULL ), m_size( 0 )
+#ifdef _Windows
+	, m_file( INVALID_HANDLE_VALUE ), m_mapping( NULL )
+#else
+	, m_fd( -1 )
+#endif
+	{
+	}
+	~MappedFile()
+	{
+		close();
+	}
+
+	/// returns false, if the file cannot be opened or is empty
+	bool open( const char *fileName )
+	{
+		close();
+#ifdef _Windows
+		// other programs may append, a mapped file cannot be truncated, but replaced by rename
+		m_file = CreateFileA(
+			fileName, GENERIC_READ, FILE_SHARE_READ|FILE_SHARE_WRITE|FILE_SHARE_DELETE, NULL, OPEN_EXISTING,
+			FILE_ATTRIBUTE_NORMAL, NULL
+		);
+		if( m_file == INVALID_HANDLE_VALUE )
+			return false;
+
+		LARGE_INTEGER	size;
+		if( !GetFileSizeEx( m_file, &size ) || !size.QuadPart )
+		{
+			close();
+			return false;
+		}
+		m_mapping = CreateFileMappingA( m_file, NULL, PAGE_READONLY, 0, 0, NULL );
+		if( !m_mapping )
+		{
+			close();
+			return false;
+		}
+		m_data = static_cast<const char *>( MapViewOfFile( m_mapping, FILE_MAP_READ, 0, 0, 0 ) );
+		m_size = std::size_t( size.QuadPart );
+#else
+		m_fd = ::open( fileName, O_RDONLY );
+		if( m_fd < 0 )
+			return false;
+
+		struct stat	statBuff;
+		if( fstat( m_fd, &statBuff ) || !statBuff.st_size )
+		{
+			close();
+			return false;
+		}
+		void *data = mmap( NULL, std::size_t( statBuff.st_size ), PROT_READ, MAP_SHARED, m_fd, 0 );
+		m_data = data == MAP_FAILED ? NULL : static_cast<const char *>( data );
+		m_size = std::size_t( statBuff.st_size );
+#endif
+		if( !m_data )
+		{
+			close();
+			return false;
+		}
+		return true;
+	}
+	void close()
+	{
+#ifdef _Windows
+		if( m_data )
+			UnmapViewOfFile( m_data );
+		if( m_mapping )
+			CloseHandle( m_mapping );
+		if( m_file != INVALID_HANDLE_VALUE )
+			CloseHandle( m_file );
+		m_mapping = NULL;
+		m_file = INVALID_HANDLE_VALUE;
+#else
+		if( m_data )
+			munmap( const_cast<char *>( m_data ), m_size );
+		if( m_fd >= 0 )
+			::close( m_fd );
+		m_fd = -1;
+#endif
+		m_data = NULL;
+		m_size = 0;
+	}
+
+	/// true, if the file is smaller than mapped now, the pages behind its end cannot be read
+	bool hasShrunk() const
+	{
+#ifdef _Windows
+		LARGE_INTEGER	size;
+		return m_file != INVALID_HANDLE_VALUE && GetFileSizeEx( m_file, &size ) && std::size_t( size.QuadPart ) < m_size;
+#else
+		struct stat	statBuff;
+		return m_fd >= 0 && !fstat( m_fd, &statBuff ) && std::size_t( statBuff.st_size ) < m_size;
+#endif
+	}
+
+	/// tells the OS that the file is accessed by lookups, not read sequentially
+	void adviseRandom() const
+	{
+#ifndef _Windows
+		if( m_data )
+			madvise( const_cast<char *>( m_data ), m_size, MADV_RANDOM );
+#endif
+	}
+
+	/// tells the OS that the file is read once from the beginning to the end
+	void adviseSequential() const
+	{
+#ifndef _Windows
+		if( m_data )
+			madvise( const_cast<char *>( m_data ), m_size, MADV_SEQUENTIAL );
+#endif
+	}
+
+	bool isOpen() const
+	{
+		return m_data != NULL;
+	}
+	const char *getData() const
+	{
+		return m_data;
+	}
+	std::size_t getSize() const
+	{
+		return m_size;
+	}
+};
+
+// --------------------------------------------------------------------- //
+// ----- exported datas ------------------------------------------------ //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- module static data -------------------------------------------- //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- class static data --------------------------------------------- //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- prototypes ---------------------------------------------------- //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- module functions ---------------------------------------------- //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- class inlines ------------------------------------------------- //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- class constructors/destructors -------------------------------- //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- class static functions ---------------------------------------- //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- class privates ------------------------------------------------ //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- class protected ----------------------------------------------- //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- class virtuals ------------------------------------------------ //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- class publics ------------------------------------------------- //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- entry points -------------------------------------------------- //
+// --------------------------------------------------------------------- //
+
+#ifdef __BORLANDC__
+#	pragma option -RT.
+#	pragma option -b.
+#	pragma option -a.
+#	pragma option -p.
+#endif
+
+#endif //  MAPPED_FILE_H
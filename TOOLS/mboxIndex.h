@@ -42,6 +42,7 @@
 
 #include <gak/types.h>
 #include <gak/string.h>
+#include <gak/array.h>
 #include <gak/compare.h>
 #include <gak/iostream.h>
 #include <gak/indexer.h>
@@ -68,7 +69,7 @@
 /// Mailbox index file
 static const gak::uint32 MBOX_INDEX_MAGIC	= 0x19901993;
 static const gak::uint16 MBOX_INDEX_VERSION	= 0x1;
-static const char MBOX_INDEX_EXT[] = ".mboxIdx";
+static const char MBOX_INDEX_EXT[] = ".mboxIdx";			// only to remove the files of older versions
 
 /// Mailbox position file
 static const gak::uint32 MBOX_POS_MAGIC		= 0x19931990;
@@ -78,7 +79,16 @@ static const char MBOX_POS_EXT[] = ".mboxPos";
 /// Mail server index file
 static const gak::uint32 MAIL_INDEX_MAGIC	= 0x19641964;
 static const gak::uint16 MAIL_INDEX_VERSION	= 0x1;
-static const char MAIL_INDEX_FILE[] = ".mailIndex";
+static const char MAIL_INDEX_FILE[] = ".mailIndex";		// only to remove the file of older versions
+
+/// Mail index segments
+static const gak::uint32 MAIL_SEGMENT_MAGIC	= 0x19641965;
+static const gak::uint16 MAIL_SEGMENT_VERSION	= 0x5;
+static const char MAIL_SEGMENT_FILE[] = ".mailSegment.";	// followed by the segment id
+
+static const gak::uint32 MAIL_SEGMENTS_MAGIC	= 0x19641966;
+static const gak::uint16 MAIL_SEGMENTS_VERSION	= 0x1;
+static const char MAIL_SEGMENTS_FILE[] = ".mailSegments";
 
 // AI mail brain
 static const gak::uint32 BRAIN_MAGIC		= 0x19701974;
@@ -119,6 +129,36 @@ struct MailAddress
 	}
 };
 
+/*
+	the .mboxPos file: the start of every mail and the state to append new
+	mails. Older files contain the positions only.
+*/
+struct MboxPositions
+{
+	gak::Array<gak::int64>	positions;
+	gak::uint64				indexedSize;		// mailbox size when indexed
+	gak::uint64				tailChecksum;		// of the bytes before indexedSize
+
+	MboxPositions() : indexedSize(0), tailChecksum(0) {}
+
+	void toBinaryStream ( std::ostream &stream ) const
+	{
+		gak::toBinaryStream( stream, positions );
+		gak::toBinaryStream( stream, indexedSize );
+		gak::toBinaryStream( stream, tailChecksum );
+	}
+	void fromBinaryStream ( std::istream &stream )
+	{
+		gak::fromBinaryStream( stream, &positions );
+		indexedSize = tailChecksum = 0;
+		if( stream.peek() != std::istream::traits_type::eof() )
+		{
+			gak::fromBinaryStream( stream, &indexedSize );
+			gak::fromBinaryStream( stream, &tailChecksum );
+		}
+	}
+};
+
 typedef gak::ai::Index<size_t>			MboxIndex;
 typedef gak::ai::Index<MailAddress>		MailIndex;
 typedef MboxIndex::SearchResult			MboxSearchResult;
@@ -59,13 +59,14 @@
 #define PROFILER		1
 #define USE_PAIR_MAP	0		// for searching pair map is better than TreeMap that is faster for indexing
 
-#define TEST_RECURSION	0
-
 // --------------------------------------------------------------------- //
 // ----- includes ------------------------------------------------------ //
 // --------------------------------------------------------------------- //
 
 #include <memory>
+#include <set>
+#include <vector>
+#include <algorithm>
 
 #include <gak/threadDirScanner.h>
 #include <gak/cmdlineParser.h>
@@ -78,8 +79,12 @@
 #include <gak/shared.h>
 #include <gak/aiBrain.h>
 #include <gak/logfile.h>
+#include <gak/exception.h>
 
 #include "mboxIndex.h"
+#include "mboxReader.h"
+#include "mailTokenizer.h"
+#include "mailSegment.h"
 
 // --------------------------------------------------------------------- //
 // ----- imported datas ------------------------------------------------ //
@@ -125,6 +130,8 @@ static const char CHAR_BACK_IDX		= 'Z';
 static const size_t DEF_THREAD_COUNT = 8UL;
 static const size_t DEF_WORD_DISTANCE = 3UL;
 
+static const size_t SEGMENT_TERM_SHARDS = 64;
+
 // --------------------------------------------------------------------- //
 // ----- macros -------------------------------------------------------- //
 // --------------------------------------------------------------------- //
@@ -162,29 +169,56 @@ inline size_t FindCurrentThreadIdx()
 // ----- class definitions --------------------------------------------- //
 // --------------------------------------------------------------------- //
 
-typedef SharedPointer<StringIndex> StringIndexPtr;
-
-inline StringIndexPtr createStringIndex()
-{
-	return StringIndexPtr::makeShared();
-}
-
+/// a mail read by a scanner thread, tokenized by the pool thread
 struct MailIndexerCmd
 {
 	STRING			mboxFile;
 	size_t			idx;
-	StringIndexPtr	index;
+	STRING			text;
 	
-	MailIndexerCmd(const STRING &theName, size_t idx, const StringIndexPtr &index) : mboxFile(theName),idx(idx), index(index) {}
+	MailIndexerCmd(const STRING &theName, size_t idx) : mboxFile(theName),idx(idx) {}
 };
 
 typedef SharedPointer<MailIndexerCmd> MailIndexerPtr;
 
-inline MailIndexerPtr createIndexerCmd(const STRING &theName, size_t idx, const StringIndexPtr &index)
+inline MailIndexerPtr createIndexerCmd(const STRING &theName, size_t idx)
 {
-	return MailIndexerPtr::makeShared(theName, idx, index);
+	return MailIndexerPtr::makeShared(theName, idx);
 }
 
+/*
+	merges the segments of the previous runs while the mailboxes are indexed.
+	It works on a copy of the segment list, the main thread takes it after join.
+*/
+class SegmentMerger : public Thread
+{
+	STRING					m_indexPath;
+	MailSegments			m_manifest;
+	std::vector<uint64>		m_obsolete;		// merged segments, removed when the new list is written
+	STRING					m_error;
+
+	public:
+	SegmentMerger( const STRING &indexPath, const MailSegments &manifest )
+	: m_indexPath( indexPath ), m_manifest( manifest )
+	{
+		StartThread( "SegmentMerger" );
+	}
+	virtual void ExecuteThread();
+
+	const MailSegments &getManifest() const
+	{
+		return m_manifest;
+	}
+	const std::vector<uint64> &getObsolete() const
+	{
+		return m_obsolete;
+	}
+	const STRING &getError() const
+	{
+		return m_error;
+	}
+};
+
 namespace gak
 {
 	template <>
@@ -192,31 +226,64 @@ namespace gak
 	{
 		typedef MailIndexerPtr object_type;
 
-		static MailIndex		s_mailIndex;
-		static bool				s_indexChanged;
-		static Critical			s_mailIndexCritical;
-
-		void process( const MailIndexerPtr &ptr, void *pool, void *mainData )
+		/// the terms of the new segment are split by hash, each part has its own lock
+		struct TermShard
 		{
-			doEnterFunctionEx(gakLogging::llInfo,"ProcessorType<MailIndexerCmd>::mergeIndex");
-			try
+			MailTermMap	terms;
+			Critical	critical;
+		};
+
+		static Critical							s_docCritical;
+		static MailSegment						s_segment;		// mailboxes and docs are locked by s_docCritical
+		static std::map<std::string, uint32>	s_mailboxIds;
+		static std::set<std::string>			s_reindexed;	// their mails in older segments are outdated
+		static TermShard						s_termShards[SEGMENT_TERM_SHARDS];
+		static StopWordSet						s_stopWords;	// filled before the pool starts
+
+		static size_t getTermShard( const std::string &term )
+		{
+			size_t	hash = 0;
+			for( size_t i=0; i<term.size(); ++i )
 			{
-				CriticalScope scope( s_mailIndexCritical );
-
-				const MailIndexerCmd &cmd = *ptr;
-				s_mailIndex.copyIndexPositions( MailAddress(cmd.mboxFile, cmd.idx), *cmd.index );
-				s_indexChanged = true;
+				hash = hash * 31 + (unsigned char)term[i];
 			}
-			catch( ... )
+			return hash % SEGMENT_TERM_SHARDS;
+		}
+		static uint32 getMailboxId( const STRING &mboxFile )
+		{
+			const std::string	mailbox( mboxFile.c_str() );
+
+			std::map<std::string, uint32>::const_iterator it = s_mailboxIds.find( mailbox );
+			if( it == s_mailboxIds.end() )
 			{
-				ConsoleOut( F_BIND { std::cerr << "MainIndexerError" << std::endl; } );
+				it = s_mailboxIds.insert( std::make_pair( mailbox, uint32(s_segment.mailboxes.size()) ) ).first;
+				s_segment.mailboxes.push_back( mailbox );
 			}
+			return it->second;
 		}
+
+		static void setReindexed( const STRING &mboxFile )
+		{
+			CriticalScope scope( s_docCritical );
+			s_reindexed.insert( std::string( mboxFile.c_str() ) );
+		}
+
+		void process( const MailIndexerPtr &ptr, void *pool, void *mainData );
 	};
 }
 
 static std::unique_ptr< ThreadPool<MailIndexerPtr> >	g_IndexerPool;
 
+/// the positions of a mailbox read, written when its mails are in a segment
+struct PositionsFile
+{
+	STRING			fileName;
+	MboxPositions	positions;
+
+	PositionsFile( const STRING &fileName, const MboxPositions &positions )
+	: fileName( fileName ), positions( positions ) {}
+};
+
 namespace gak
 {
 	template <>
@@ -234,6 +301,9 @@ namespace gak
 		static Brain			s_Brain;
 		static bool				s_brainChanged;
 		static STRING			s_brainFile;
+
+		static Critical						s_positionsCritical;
+		static std::vector<PositionsFile>	s_positions;
 		static size_t			s_wordDistance;
 
 		static void init(const CommandLine	&cmdLine)
@@ -254,6 +324,7 @@ namespace gak
 					{
 						word.lowerCase();
 						s_stopWords.addElement( word );
+						ProcessorType<MailIndexerPtr>::s_stopWords.addElement( word );
 					}
 				}
 				in.close();
@@ -300,10 +371,8 @@ namespace gak
 			STRING		indexFile;
 			STRING		posFile;
 			size_t		idx=0;
-			std::unique_ptr<Mails>		p_theMails(new Mails);
-			Mails		&theMails = *p_theMails;
-			std::unique_ptr<MboxIndex>	p_mboxIndex(new MboxIndex());
-			MboxIndex	&mboxIndex = *p_mboxIndex;
+			MboxReader	reader;
+			MboxPositions	mboxPos;
 			StopWatch	sw(true);
 
 			ConsoleOut( F_BIND { std::cout << FindCurrentThreadIdx() << " process: " << file << ' ' << pool->size() << std::endl; } );
@@ -319,100 +388,110 @@ namespace gak
 			indexFile += mboxFile + MBOX_INDEX_EXT;
 			posFile += mboxFile + MBOX_POS_EXT;
 
-			if( !(s_flags & FLAG_FORCE) && !strAccess(indexFile,0) && !strAccess(posFile,0) )
+			if( !(s_flags & FLAG_FORCE) && !strAccess(posFile,0) )
 			{
 				DirectoryEntry theFileEntry(file);
-				DirectoryEntry theIndexEntry(indexFile);
+				DirectoryEntry thePosEntry(posFile);
+
+				if( theFileEntry.modifiedDate < thePosEntry.modifiedDate )
+				{
+					return;
+				}
 
-				if( theFileEntry.modifiedDate < theIndexEntry.modifiedDate )
+				// mailboxes usually grow at the end: index the new mails only
+				try
 				{
-					DirectoryEntry thePosEntry(posFile);
-					if( theFileEntry.modifiedDate < thePosEntry.modifiedDate )
+					readFromBinaryFile( posFile, &mboxPos, MBOX_POS_MAGIC, MBOX_POS_VERSION, false );
+					if( reader.resume( file, mboxPos.positions, mboxPos.indexedSize, mboxPos.tailChecksum ) )
 					{
-						return;
+						if( reader.getOffset() >= reader.getSize() )
+						{
+							return;
+						}
+						idx = reader.getMailCount();
+						ConsoleOut( F_BIND { std::cout << FindCurrentThreadIdx() << " append: " << file << " behind " << idx << " Mails" << std::endl; } );
 					}
 				}
+				catch( ... )
+				{
+					reader.close();
+					idx = 0;
+				}
 			}
 
-			Array<int64> positions;
+			// an empty mailbox has no mails, anything else must be readable
+			const size_t	firstMail = idx;
+			if( !firstMail )
 			{
-				doEnterFunctionEx(gakLogging::llInfo,"loadMboxFile");
-				loadMboxFile( file, theMails, &positions );
+				ProcessorType<MailIndexerPtr>::setReindexed( mboxFile );
+			}
+			if( !reader.isOpen() && !reader.open( file ) && DirectoryEntry( file ).fileSize )
+			{
+				throw OpenReadError( file ).addCerror();
 			}
-			s_mailCount += theMails.size();
-			doLogValueEx(gakLogging::llInfo, s_mailCount );
-
-			ConsoleOut( F_BIND { std::cout << FindCurrentThreadIdx() << " read " << theMails.size() << " Mails from " << file << ' ' << sw.get<Hours<> >().toString() << ' ' << pool->size() << std::endl; } );
 
-			for( 
-				Mails::iterator it = theMails.begin(), endIT = theMails.end();
-				it != endIT;
-				++it
-			)
+			while( true )
 			{
-				const MAIL &theMail = *it;
+				MAIL theMail;
+				{
+					doEnterFunctionEx(gakLogging::llInfo,"MboxReader::next");
+					if( !reader.next( &theMail ) )
+					{
+						break;
+					}
+				}
 				STRING text = theMail.extractPlainText();
 				if( !text.isEmpty() && text.size() < 1024*1024 )	// do not process extra large mails
 				{
 					if( s_flags & FLAG_USE_META )
 					{
-						doLogValueEx(gakLogging::llDetail, it->from);
-						text += it->from;
-						doLogValueEx(gakLogging::llDetail, it->to);
-						text += it->to;
-						doLogValueEx(gakLogging::llDetail, it->subject);
-						text += it->subject;
-						text += it->date.getOriginalTime();
-					}
-					StringTokens tokens;
-					{
-						doEnterFunctionEx(gakLogging::llInfo,"indexer::processor");
-						StringIndexPtr index = createStringIndex();
-						tokenString( text, s_stopWords, IS_WORD, &tokens );
-						processPositions(text, tokens, index );
-						{
-							MailIndexerPtr cmd = createIndexerCmd(mboxFile, idx, index);
-							g_IndexerPool->process(cmd);
-						}
-						mboxIndex.copyIndexPositions( idx, *index );
-						doLogValueEx(gakLogging::llInfo, mboxIndex.size() );
-					}
-
-					if( s_flags & OPT_BRAIN_PATH )
-					{
-						doEnterFunctionEx(gakLogging::llInfo,"brain::learn");
-						static Critical	s_brainCritical;
-
-						CriticalScope	scope( s_brainCritical );
-						s_brainChanged = true;
-						s_Brain.learnFromTokens(text, tokens, s_wordDistance);
+						doLogValueEx(gakLogging::llDetail, theMail.from);
+						text += theMail.from;
+						doLogValueEx(gakLogging::llDetail, theMail.to);
+						text += theMail.to;
+						doLogValueEx(gakLogging::llDetail, theMail.subject);
+						text += theMail.subject;
+						text += theMail.date.getOriginalTime();
 					}
+					MailIndexerPtr cmd = createIndexerCmd(mboxFile, idx);
+					cmd->text = text;
+					g_IndexerPool->process(cmd);
 				}
 				idx++;
-				ConsoleOut( F_BIND { gakLogging::doShowProgress( 'R', idx, theMails.size() ); } );
+				ConsoleOut( F_BIND { gakLogging::doShowProgress( 'R', reader.getOffset(), reader.getSize() ); } );
 			}
-#if TEST_RECURSION
-			//assert(mboxIndex.testRecursion());
-			if( !mboxIndex.testRecursion() )
+			s_mailCount += idx - firstMail;
+			doLogValueEx(gakLogging::llInfo, s_mailCount );
+
+			if( reader.isTruncated() )
 			{
-				ConsoleOut( F_BIND { std::cout << FindCurrentThreadIdx() << " Recursion Error " << indexFile << ' ' << sw.get<Hours<> >().toString() << ' ' << pool->size() << std::endl; } );
+				// without positions the next run indexes the mailbox completely
+				ConsoleOut( F_BIND { std::cerr << file << " has shrunk while it was read, it is indexed again by the next run" << std::endl; } );
+				reader.close();
+				if( !strAccess( posFile, 0 ) )
+				{
+					strRemove( posFile );
+				}
+				return;
 			}
-#endif
-			ConsoleOut( F_BIND { std::cout << FindCurrentThreadIdx() << " writing: " << indexFile << ' ' << sw.get<Hours<> >().toString() << ' ' << pool->size() << std::endl; } );
-			makePath(indexFile);
-			writeToBinaryFile( indexFile, mboxIndex, MBOX_INDEX_MAGIC, MBOX_INDEX_VERSION, ovmShortDown );
-			ConsoleOut( F_BIND { std::cout << FindCurrentThreadIdx() << " writing: " << posFile << ' ' << sw.get<Hours<> >().toString() << ' ' << pool->size() << std::endl; } );
-			makePath(posFile);
-			writeToBinaryFile( posFile, positions, MBOX_POS_MAGIC, MBOX_POS_VERSION, ovmShortDown );
-			ConsoleOut( F_BIND { std::cout << FindCurrentThreadIdx() << " Written: " << posFile << ' ' << sw.get<Hours<> >().toString() << ' ' << pool->size() << std::endl; } );
-
-			positions.clear();
-			ConsoleOut( F_BIND { std::cout << FindCurrentThreadIdx() << " Deleting index " << sw.get<Hours<> >().toString() << ' ' << pool->size() << std::endl; } );
-			p_mboxIndex.reset();
-			ConsoleOut( F_BIND { std::cout << FindCurrentThreadIdx() << " Deleting mails " << sw.get<Hours<> >().toString() << ' ' << pool->size() << std::endl; } );
-			size_t numMails = p_theMails->size();
-			p_theMails.reset();
-			ConsoleOut( F_BIND { std::cout << FindCurrentThreadIdx() << " Processed " << file << ", found " << numMails << '/' << s_mailCount << " mails. "<< sw.get<Hours<> >().toString() << ' ' << pool->size() << std::endl; } );
+
+			ConsoleOut( F_BIND { std::cout << FindCurrentThreadIdx() << " read " << idx - firstMail << " Mails from " << file << ' ' << sw.get<Hours<> >().toString() << ' ' << pool->size() << std::endl; } );
+			mboxPos.positions = reader.getPositions();
+			mboxPos.indexedSize = reader.getSize();
+			mboxPos.tailChecksum = reader.getChecksum( reader.getSize() );
+			{
+				// a run that fails before its segment is written must read these mails again
+				CriticalScope	scope( s_positionsCritical );
+				s_positions.push_back( PositionsFile( posFile, mboxPos ) );
+			}
+
+			// the mailbox index of older versions, the segments replace it
+			if( !strAccess( indexFile, 0 ) )
+			{
+				strRemove( indexFile );
+			}
+			reader.close();
+			ConsoleOut( F_BIND { std::cout << FindCurrentThreadIdx() << " Processed " << file << ", found " << idx << '/' << s_mailCount << " mails. "<< sw.get<Hours<> >().toString() << ' ' << pool->size() << std::endl; } );
 		}
 	};
 
@@ -435,7 +514,7 @@ static CommandLine::Options options[] =
 	{ CHAR_THREAD_COUNT,	"threadCount",	0, 1, OPT_THREAD_COUNT|CommandLine::needArg, "number of threads (<32>)" },
 	{ CHAR_FORCE,			"force",		0, 1, FLAG_FORCE, "force indexing" },
 	{ CHAR_DISTANCE,		"maxDistance",	0, 1, OPT_WORD_DISTANCE|CommandLine::needArg, "max. word distance for AI (<3>)" },
-	{ CHAR_BACK_IDX,		"backIdx",		0, 1, FLAG_BACK_IDX, "main index in back groond" },
+	{ CHAR_BACK_IDX,		"backIdx",		0, 1, FLAG_BACK_IDX, "merge into the main index in background threads" },
 	{ 0 }
 };
 
@@ -451,12 +530,18 @@ STRING			ProcessorType<STRING>::s_indexPath;
 Brain			ProcessorType<STRING>::s_Brain;
 bool			ProcessorType<STRING>::s_brainChanged = false;
 STRING			ProcessorType<STRING>::s_brainFile;
+
+Critical					ProcessorType<STRING>::s_positionsCritical;
+std::vector<PositionsFile>	ProcessorType<STRING>::s_positions;
 int				ProcessorType<STRING>::s_flags = 0;
 size_t			ProcessorType<STRING>::s_wordDistance = DEF_WORD_DISTANCE;
 
-MailIndex		ProcessorType<MailIndexerPtr>::s_mailIndex;
-bool			ProcessorType<MailIndexerPtr>::s_indexChanged = false;
-Critical		ProcessorType<MailIndexerPtr>::s_mailIndexCritical;
+Critical								ProcessorType<MailIndexerPtr>::s_docCritical;
+MailSegment								ProcessorType<MailIndexerPtr>::s_segment;
+std::map<std::string, uint32>			ProcessorType<MailIndexerPtr>::s_mailboxIds;
+std::set<std::string>					ProcessorType<MailIndexerPtr>::s_reindexed;
+ProcessorType<MailIndexerPtr>::TermShard	ProcessorType<MailIndexerPtr>::s_termShards[SEGMENT_TERM_SHARDS];
+StopWordSet								ProcessorType<MailIndexerPtr>::s_stopWords;
 
 
 // --------------------------------------------------------------------- //
@@ -478,24 +563,75 @@ static int mboxIndexer( const CommandLine &cmdLine )
 	{
 		threadCount = getValueE<size_t>(cmdLine.parameter[CHAR_THREAD_COUNT][0]);
 	}
-	size_t backGroundIDX = !threadCount? 0 : (cmdLine.flags & FLAG_BACK_IDX ? 1 : 0);
+	// the terms are locked in shards, so every scanner thread gets a merger
+	size_t backGroundIDX = !threadCount? 0 : (cmdLine.flags & FLAG_BACK_IDX ? threadCount : 0);
 	g_IndexerPool.reset(new ThreadPool<MailIndexerPtr>(backGroundIDX,"MailIndexer"));
 
 	ParalelDirScanner	theScanner("mboxIndexer", cmdLine, nullptr, threadCount);
 
 	ProcessorType<STRING>::init(cmdLine);
 
-	MailIndex &index = ProcessorType<MailIndexerPtr>::s_mailIndex;
-	STRING indexFile = ProcessorType<STRING>::s_indexPath + MAIL_INDEX_FILE;
-	if( !(cmdLine.flags&FLAG_FORCE) && !strAccess( indexFile, 0 ) )
+	typedef ProcessorType<MailIndexerPtr>	SegmentBuilder;
+
+	const STRING &indexPath = ProcessorType<STRING>::s_indexPath;
+	const STRING manifestFile = indexPath + MAIL_SEGMENTS_FILE;
+	MailSegments manifest;
+	std::vector<uint64> obsolete;
+	if( !strAccess( manifestFile, 0 ) )
 	{
-		std::cout << "Reading index " << indexFile << std::endl;
-		readFromBinaryFile( indexFile, &index, MAIL_INDEX_MAGIC, MAIL_INDEX_VERSION, false );
+		std::cout << "Reading segments " << manifestFile << std::endl;
+		readFromBinaryFile( manifestFile, &manifest, MAIL_SEGMENTS_MAGIC, MAIL_SEGMENTS_VERSION, false );
+
+		// segments of an older layout cannot be searched
+		for( size_t i=0; i<manifest.segments.size(); ++i )
+		{
+			try
+			{
+				MappedSegment	segment;
+				segment.open( getSegmentFile( indexPath, manifest.segments[i].id ) );
+			}
+			catch( std::exception &e )
+			{
+				std::cerr << e.what() << ", indexing all mailboxes" << std::endl;
+				ProcessorType<STRING>::s_flags |= FLAG_FORCE;
+				break;
+			}
+		}
+	}
+	else
+	{
+		// without segments the unchanged mailboxes would be missing
+		ProcessorType<STRING>::s_flags |= FLAG_FORCE;
+	}
+
+	// the search drops the stop words of the query, so they must be those of the segments
+	std::vector<std::string> stopWords;
+	SegmentBuilder::s_stopWords.getWords( &stopWords );
+	if( stopWords != manifest.stopWords && !(ProcessorType<STRING>::s_flags & FLAG_FORCE) )
+	{
+		std::cout << "Stop words changed, indexing all mailboxes" << std::endl;
+		ProcessorType<STRING>::s_flags |= FLAG_FORCE;
+	}
+	manifest.stopWords.swap( stopWords );
+
+	SharedObjectPointer<SegmentMerger>	merger;
+	if( ProcessorType<STRING>::s_flags & FLAG_FORCE )
+	{
+		for( size_t i=0; i<manifest.segments.size(); ++i )
+		{
+			obsolete.push_back( manifest.segments[i].id );
+		}
+		manifest.segments.clear();
+		manifest.baseGenerations.clear();
+	}
+	else
+	{
+		merger = new SegmentMerger( indexPath, manifest );
 	}
 
 	Brain &brain = ProcessorType<STRING>::s_Brain;
 	const STRING &brainFile = ProcessorType<STRING>::s_brainFile;
-	if( cmdLine.flags & OPT_BRAIN_PATH && !(cmdLine.flags&FLAG_FORCE) && !strAccess( brainFile, 0 ))
+	if( cmdLine.flags & OPT_BRAIN_PATH && !(ProcessorType<STRING>::s_flags&FLAG_FORCE) && !strAccess( brainFile, 0 ))
 	{
 		std::cout << "Reading brain " << brainFile << std::endl;
 		readFromBinaryFile( brainFile, &brain, BRAIN_MAGIC, BRAIN_VERSION, false );
@@ -520,13 +656,14 @@ static int mboxIndexer( const CommandLine &cmdLine )
 #endif
 	ConsoleOut( F_BIND { std::cout << "Deleting s_stopWords " << sw.get<Hours<> >().toString() <<std::endl; } );
 	ProcessorType<STRING>::s_stopWords.clear();
+	ProcessorType<MailIndexerPtr>::s_stopWords.clear();
 
 	doLogPositionEx( gakLogging::llInfo );
 	if( ProcessorType<STRING>::s_brainChanged )
 	{
 		doLogPositionEx( gakLogging::llInfo );
 		ConsoleOut( F_BIND { std::cout << "writing: " << brainFile << ' ' << sw.get<Hours<> >().toString() <<std::endl; } );
-		makePath(indexFile);
+		makePath(manifestFile);
 		writeToBinaryFile( brainFile, brain, BRAIN_MAGIC, BRAIN_VERSION, ovmShortDown );
 		doLogPositionEx( gakLogging::llInfo );
 		ConsoleOut( F_BIND { std::cout << FindCurrentThreadIdx() << " Deleting brain " << sw.get<Hours<> >().toString() <<std::endl; } );
@@ -540,27 +677,105 @@ static int mboxIndexer( const CommandLine &cmdLine )
 			ConsoleOut( F_BIND { std::cout << "Not writing: " << brainFile << std::endl; } );
 	}
 
-	if( ProcessorType<MailIndexerPtr>::s_indexChanged )
+	// the postings of this run become a new segment
+	MailSegment &segment = SegmentBuilder::s_segment;
+	for( size_t i=0; i<SEGMENT_TERM_SHARDS; ++i )
+	{
+		MailTermMap &terms = SegmentBuilder::s_termShards[i].terms;
+		for(
+			MailTermMap::iterator it = terms.begin(), endIT = terms.end();
+			it != endIT;
+			++it
+		)
+		{
+			MailPostings &postings = segment.terms[it->first];
+			postings.swap( it->second );
+			std::sort( postings.begin(), postings.end() );
+		}
+		terms.clear();
+	}
+
+	if( merger )
 	{
-		ConsoleOut( F_BIND { std::cout << "writing: " << indexFile << ' ' << sw.get<Hours<> >().toString() << std::endl; } );
-		makePath(indexFile);
-		writeToBinaryFile( indexFile, index, MAIL_INDEX_MAGIC, MAIL_INDEX_VERSION, ovmShortDown );
+		ConsoleOut( F_BIND { std::cout << "Waiting for segment merger " << sw.get<Hours<> >().toString() << std::endl; } );
+		merger->join();
+		if( !merger->getError().isEmpty() )
+		{
+			std::cerr << "Merging segments failed: " << merger->getError() << std::endl;
+		}
+		manifest = merger->getManifest();
+		obsolete.insert( obsolete.end(), merger->getObsolete().begin(), merger->getObsolete().end() );
+	}
+
+	segment.generation = ++manifest.generation;
+	const std::set<std::string> &reindexed = SegmentBuilder::s_reindexed;
+	for(
+		std::set<std::string>::const_iterator it = reindexed.begin(), endIT = reindexed.end();
+		it != endIT;
+		++it
+	)
+	{
+		manifest.baseGenerations[*it] = segment.generation;
+	}
 
+	const bool indexChanged = !segment.docs.empty();
+	if( indexChanged )
+	{
+		const SegmentInfo info( manifest.nextId++, segment.generation, uint32(segment.docs.size()) );
+		const STRING segmentFile = getSegmentFile( indexPath, info.id );
+
+		ConsoleOut( F_BIND { std::cout << "writing: " << segmentFile << ' ' << segment.docs.size() << " mails " << sw.get<Hours<> >().toString() << std::endl; } );
+		makePath(segmentFile);
+		writeSegment( segmentFile, segment );
+		manifest.segments.push_back( info );
+	}
+
+	// the files replaced are removed after the new list is complete
+	ConsoleOut( F_BIND { std::cout << "writing: " << manifestFile << ' ' << manifest.segments.size() << " segments " << sw.get<Hours<> >().toString() << std::endl; } );
+	makePath(manifestFile);
+	writeToBinaryFile( manifestFile, manifest, MAIL_SEGMENTS_MAGIC, MAIL_SEGMENTS_VERSION, ovmShortDown );
+	for( size_t i=0; i<obsolete.size(); ++i )
+	{
+		strRemove( getSegmentFile( indexPath, obsolete[i] ) );
+	}
+
+	// the mails of these mailboxes are in the segments now
+	const std::vector<PositionsFile> &positions = ProcessorType<STRING>::s_positions;
+	ConsoleOut( F_BIND { std::cout << "writing: " << positions.size() << " position files " << sw.get<Hours<> >().toString() << std::endl; } );
+	for( size_t i=0; i<positions.size(); ++i )
+	{
+		makePath(positions[i].fileName);
+		writeToBinaryFile( positions[i].fileName, positions[i].positions, MBOX_POS_MAGIC, MBOX_POS_VERSION, ovmShortDown );
+	}
+	ProcessorType<STRING>::s_positions.clear();
+
+	// the index file of older versions
+	STRING indexFile = indexPath + MAIL_INDEX_FILE;
+	if( !strAccess( indexFile, 0 ) )
+	{
+		strRemove( indexFile );
+	}
+
+	if( indexChanged )
+	{
+		// the words of the mails indexed by this run, mboxSearch -S shows all
 		ConsoleOut( F_BIND { std::cout << "Creating statistic" << ' ' << sw.get<Hours<> >().toString() << std::endl; } );
-		StatistikData sd;
-		index.getStatistik(&sd);
+		std::map<std::string, std::size_t> wordCounts;
+		addStatistik( segment, &wordCounts );
+		WordCounts sd;
+		sortStatistik( wordCounts, &sd );
 
 		ConsoleOut( F_BIND { std::cout << "Writing statistic " << sd.size() << std::endl; } );
 		std::size_t count = 0;
 		std::ofstream	of(ProcessorType<STRING>::s_indexPath+"index.log" );
 		for(
-			StatistikData::const_iterator it = sd.cbegin(), endIT = sd.cend();
+			WordCounts::const_iterator it = sd.cbegin(), endIT = sd.cend();
 			it != endIT;
 			++it
 		)
 		{
 			++count;
-			of << it->m_word << ' ' << it->m_count << '\n';
+			of << it->first << ' ' << it->second << '\n';
 #ifndef NDEBUG
 			ConsoleOut( F_BIND { gakLogging::doShowProgress( 'S', count, sd.size() ); } );
 #endif
@@ -570,15 +785,11 @@ static int mboxIndexer( const CommandLine &cmdLine )
 		sd.clear();
 
 		ConsoleOut( F_BIND { std::cout << "deleted statistic -> deleting index " << sw.get<Hours<> >().toString() << std::endl; } );
-#if TEST_RECURSION
-		doLogPositionEx( gakLogging::llInfo );
-		if( !index.testRecursion() )
-			std::cerr << "recursion failure" << std::endl;
-#endif
-		index.clear();
-		ConsoleOut( F_BIND { std::cout << "deleted index " << sw.get<Hours<> >().toString() << std::endl; } );
-		doLogPositionEx( gakLogging::llInfo );
 	}
+	segment.terms.clear();
+	segment.docs.clear();
+	ConsoleOut( F_BIND { std::cout << "deleted index " << sw.get<Hours<> >().toString() << std::endl; } );
+	doLogPositionEx( gakLogging::llInfo );
 	return result;
 }
 
@@ -606,11 +817,103 @@ static int mboxIndexer( const CommandLine &cmdLine )
 // --------------------------------------------------------------------- //
 // ----- class virtuals ------------------------------------------------ //
 // --------------------------------------------------------------------- //
+
+void SegmentMerger::ExecuteThread()
+{
+	try
+	{
+		std::vector<size_t>	selection;
+		while( m_manifest.selectMerge( &selection ) )
+		{
+			std::vector<MappedSegment>			inputs( selection.size() );
+			std::vector<const MappedSegment*>	inputPtrs;
+			for( size_t i=0; i<selection.size(); ++i )
+			{
+				inputs[i].open( getSegmentFile( m_indexPath, m_manifest.segments[selection[i]].id ) );
+				inputPtrs.push_back( &inputs[i] );
+			}
+
+			const uint64 id = m_manifest.nextId++;
+			const STRING segmentFile = getSegmentFile( m_indexPath, id );
+			ConsoleOut( F_BIND { std::cout << "merging " << selection.size() << " segments: " << segmentFile << std::endl; } );
+
+			uint64			generation;
+			const uint32	numDocs = mergeSegments( m_manifest, inputPtrs, segmentFile, &generation );
+			const SegmentInfo info( id, generation, numDocs );
+
+			for( size_t i=0; i<selection.size(); ++i )
+			{
+				m_obsolete.push_back( m_manifest.segments[selection[i]].id );
+			}
+			m_manifest.replace( selection, info );
+		}
+	}
+	catch( std::exception &e )
+	{
+		m_error = e.what();
+	}
+	catch( ... )
+	{
+		m_error = "Unknown error";
+	}
+}
    
 // --------------------------------------------------------------------- //
 // ----- class publics ------------------------------------------------- //
 // --------------------------------------------------------------------- //
 
+/// the terms of the mail go into the new segment and, with -B, the brain learns the mail
+void ProcessorType<MailIndexerPtr>::process( const MailIndexerPtr &ptr, void *, void * )
+{
+	doEnterFunctionEx(gakLogging::llInfo,"ProcessorType<MailIndexerCmd>::mergeIndex");
+	try
+	{
+		const MailIndexerCmd &cmd = *ptr;
+		MailTerms terms;
+		const uint32 numWords = tokenizeMail( cmd.text, cmd.text.size(), &s_stopWords, &terms );
+		uint32 doc;
+		{
+			CriticalScope scope( s_docCritical );
+
+			doc = uint32(s_segment.docs.size());
+			s_segment.docs.push_back( MailDoc( getMailboxId( cmd.mboxFile ), numWords, cmd.idx ) );
+		}
+		for(
+			MailTerms::const_iterator it = terms.begin(), endIT = terms.end();
+			it != endIT;
+			++it
+		)
+		{
+			TermShard &shard = s_termShards[getTermShard( it->first )];
+
+			CriticalScope scope( shard.critical );
+
+			MailPostings &postings = shard.terms[it->first];
+			postings.push_back( MailPosting( doc ) );
+			postings.back().positions = it->second;
+		}
+
+		typedef ProcessorType<STRING>	Scanner;
+		if( Scanner::s_flags & OPT_BRAIN_PATH )
+		{
+			doEnterFunctionEx(gakLogging::llInfo,"brain::learn");
+			static Critical	s_brainCritical;
+
+			// the brain learns from the tokens of the gak indexer
+			StringTokens tokens;
+			tokenString( cmd.text, Scanner::s_stopWords, IS_WORD, &tokens );
+
+			CriticalScope	scope( s_brainCritical );
+			Scanner::s_brainChanged = true;
+			Scanner::s_Brain.learnFromTokens(cmd.text, tokens, Scanner::s_wordDistance);
+		}
+	}
+	catch( ... )
+	{
+		ConsoleOut( F_BIND { std::cerr << "MainIndexerError" << std::endl; } );
+	}
+}
+
 // --------------------------------------------------------------------- //
 // ----- entry points -------------------------------------------------- //
 // --------------------------------------------------------------------- //
@@ -0,0 +1,345 @@
+/*
+		Project:		GAK_CLI
+		Module:			mboxReader.h
+		Description:	reads a mailbox one mail at a time
+		Author:			Martin Gckler
+		Address:		Hofmannsthalweg 14, A-4030 Linz
+		Web:			https://www.gaeckler.at/
+
+		Copyright:		(c) 1988-2025 Martin Gckler
+
+		This program is free software: you can redistribute it and/or modify  
+		it under the terms of the GNU General Public License as published by  
+		the Free Software Foundation, version 3.
+
+		You should have received a copy of the GNU General Public License 
+		along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+		THIS SOFTWARE IS PROVIDED BY Martin Gckler, Austria, Linz ``AS IS''
+		AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+		TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+		PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR
+		CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+		SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+		LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+		USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+		ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+		OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+		OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+		SUCH DAMAGE.
+*/
+
+#ifndef MBOX_READER_H
+#define MBOX_READER_H
+
+// --------------------------------------------------------------------- //
+// ----- switches ------------------------------------------------------ //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- includes ------------------------------------------------------ //
+// --------------------------------------------------------------------- //
+
+#include <cstring>
+#include <istream>
+#include <streambuf>
+
+#include <gak/array.h>
+#include <gak/mboxParser.h>
+
+#include "mappedFile.h"
+
+// --------------------------------------------------------------------- //
+// ----- imported datas ------------------------------------------------ //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- module switches ----------------------------------------------- //
+// --------------------------------------------------------------------- //
+
+#ifdef __BORLANDC__
+#	pragma option -RT-
+#	pragma option -b
+#	pragma option -a4
+#	pragma option -pc
+#endif
+
+// --------------------------------------------------------------------- //
+// ----- constants ----------------------------------------------------- //
+// --------------------------------------------------------------------- //
+
+static const char MBOX_SEPARATOR[] = "From ";
+static const std::size_t MBOX_TAIL_SIZE = 4096;		// bytes checked before appended mails
+
+// --------------------------------------------------------------------- //
+// ----- macros -------------------------------------------------------- //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- type definitions ---------------------------------------------- //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- class definitions --------------------------------------------- //
+// --------------------------------------------------------------------- //
+
+/*
+	reads a range of the mapped mailbox without copying it
+*/
+class MappedMailBuffer : public std::streambuf
+{
+	public:
+	MappedMailBuffer( const char *start, const char *end )
+	{
+		char	*data = const_cast<char *>( start );
+		setg( data, data, data + (end - start) );
+	}
+};
+
+/*
+	replaces loadMboxFile for large mailboxes: the mailbox is mapped and the
+	separator lines are searched while the mails are processed, so only the
+	current mail is held in memory. The start of the following mail is
+	always known, so each mail is parsed from the mapping between its start
+	and the next one, the mailbox is not opened again for every mail.
+*/
+class MboxReader
+{
+	MappedFile				m_file;
+	gak::STRING				m_mboxFile;
+	gak::Array<gak::int64>	m_positions;
+	std::size_t				m_nextMail;
+	bool					m_truncated;
+
+	MboxReader( const MboxReader & );
+	MboxReader &operator = ( const MboxReader & );
+
+	std::size_t nextLine( std::size_t pos ) const
+	{
+		const char	*data = m_file.getData();
+		const void	*eol = memchr( data + pos, '\n', m_file.getSize() - pos );
+
+		return eol ? std::size_t( static_cast<const char *>( eol ) - data ) + 1 : m_file.getSize();
+	}
+	/// returns the first separator line at or behind the line start pos
+	std::size_t findMail( std::size_t pos ) const
+	{
+		const char			*data = m_file.getData();
+		const std::size_t	size = m_file.getSize();
+		const std::size_t	sepLen = sizeof( MBOX_SEPARATOR )-1;
+
+		while( pos < size )
+		{
+			if( size - pos >= sepLen && !memcmp( data + pos, MBOX_SEPARATOR, sepLen ) )
+			{
+				break;
+			}
+			pos = nextLine( pos );
+		}
+		return pos;
+	}
+	void addPosition( std::size_t pos )
+	{
+		if( pos < m_file.getSize() )
+		{
+			m_positions.addElement( gak::int64( pos ) );
+		}
+	}
+	bool map( const gak::STRING &mboxFile )
+	{
+		close();
+		if( !m_file.open( mboxFile ) )
+		{
+			return false;
+		}
+		m_file.adviseSequential();
+		m_mboxFile = mboxFile;
+		return true;
+	}
+
+	public:
+	MboxReader() : m_nextMail( 0 ), m_truncated( false )
+	{
+	}
+
+	/// returns false, if the mailbox cannot be opened or is empty
+	bool open( const gak::STRING &mboxFile )
+	{
+		if( !map( mboxFile ) )
+		{
+			return false;
+		}
+		addPosition( findMail( 0 ) );
+		return true;
+	}
+	/*
+		continues behind the mails read by a previous run. Returns false, if
+		the mailbox was not only appended since: it shrunk, the bytes before
+		the old end changed or no new mail starts there.
+	*/
+	bool resume(
+		const gak::STRING &mboxFile, const gak::Array<gak::int64> &positions,
+		gak::uint64 indexedSize, gak::uint64 tailChecksum
+	)
+	{
+		if( !indexedSize || !positions.size() || !map( mboxFile ) )
+		{
+			return false;
+		}
+
+		const std::size_t	size = m_file.getSize();
+		const std::size_t	sepLen = sizeof( MBOX_SEPARATOR )-1;
+		if( indexedSize > size || getChecksum( std::size_t( indexedSize ) ) != tailChecksum
+		|| (indexedSize < size && (size - indexedSize < sepLen
+			|| memcmp( m_file.getData() + indexedSize, MBOX_SEPARATOR, sepLen ))) )
+		{
+			close();
+			return false;
+		}
+
+		m_positions = positions;
+		m_nextMail = positions.size();
+		addPosition( std::size_t( indexedSize ) );
+		return true;
+	}
+	void close()
+	{
+		m_file.close();
+		m_positions.clear();
+		m_nextMail = 0;
+		m_truncated = false;
+	}
+
+	/// loads the next mail, returns false at the end of the mailbox
+	bool next( gak::mail::MAIL *theMail )
+	{
+		if( m_nextMail >= m_positions.size() )
+		{
+			return false;
+		}
+		// a mail client may have truncated or rewritten the mailbox meanwhile,
+		// reading the pages behind its new end would raise SIGBUS
+		if( m_file.hasShrunk() )
+		{
+			m_truncated = true;
+			return false;
+		}
+
+		addPosition( findMail( nextLine( std::size_t( m_positions[m_nextMail] ) ) ) );
+
+		const char			*data = m_file.getData();
+		const std::size_t	end = m_nextMail+1 < m_positions.size()
+			? std::size_t( m_positions[m_nextMail+1] )
+			: m_file.getSize();
+		MappedMailBuffer	buffer( data + std::size_t( m_positions[m_nextMail] ), data + end );
+		std::istream		stream( &buffer );
+
+		gak::mail::loadMail( stream, theMail );
+		theMail->mboxFile = m_mboxFile;
+		++m_nextMail;
+		return true;
+	}
+
+	/// true, if next stopped, because the mailbox has shrunk, its mails must be read again
+	bool isTruncated() const
+	{
+		return m_truncated;
+	}
+	/// number of mails returned by next
+	std::size_t getMailCount() const
+	{
+		return m_nextMail;
+	}
+	/// bytes of the mailbox processed by next
+	std::size_t getOffset() const
+	{
+		return m_nextMail < m_positions.size() ? std::size_t( m_positions[m_nextMail] ) : m_file.getSize();
+	}
+	std::size_t getSize() const
+	{
+		return m_file.getSize();
+	}
+	bool isOpen() const
+	{
+		return m_file.isOpen();
+	}
+	/// FNV-1a of the last bytes before end to detect changes of an indexed mailbox
+	gak::uint64 getChecksum( std::size_t end ) const
+	{
+		const unsigned char	*data = reinterpret_cast<const unsigned char *>( m_file.getData() );
+		gak::uint64			checksum = 14695981039346656037ULL;
+
+		for( std::size_t i = end > MBOX_TAIL_SIZE ? end - MBOX_TAIL_SIZE : 0; i<end; ++i )
+		{
+			checksum ^= data[i];
+			checksum *= 1099511628211ULL;
+		}
+		return checksum;
+	}
+	/// start of every mail read, the same as loadMboxFile returns
+	const gak::Array<gak::int64> &getPositions() const
+	{
+		return m_positions;
+	}
+};
+
+// --------------------------------------------------------------------- //
+// ----- exported datas ------------------------------------------------ //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- module static data -------------------------------------------- //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- class static data --------------------------------------------- //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- prototypes ---------------------------------------------------- //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- module functions ---------------------------------------------- //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- class inlines ------------------------------------------------- //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- class constructors/destructors -------------------------------- //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- class static functions ---------------------------------------- //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- class privates ------------------------------------------------ //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- class protected ----------------------------------------------- //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- class virtuals ------------------------------------------------ //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- class publics ------------------------------------------------- //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- entry points -------------------------------------------------- //
+// --------------------------------------------------------------------- //
+
+#ifdef __BORLANDC__
+#	pragma option -RT.
+#	pragma option -b.
+#	pragma option -a.
+#	pragma option -p.
+#endif
+
+#endif //  MBOX_READER_H
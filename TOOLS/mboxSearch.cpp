@@ -45,13 +45,34 @@
 #include <gak/strFiles.h>
 */
 
+#include <vector>
+#include <algorithm>
+#include <memory>
+#include <sstream>
+#include <mutex>
+#include <condition_variable>
+
+#ifdef _Windows
+#	include <windows.h>
+#else
+#	include <sys/socket.h>
+#	include <sys/un.h>
+#	include <fcntl.h>
+#	include <unistd.h>
+#	include <csignal>
+#endif
+
 #include <gak/indexer.h>
 #include <gak/cmdlineParser.h>
 #include <gak/mboxParser.h>
 #include <gak/exception.h>
 #include <gak/aiBrain.h>
+#include <gak/threadPool.h>
 
 #include "mboxIndex.h"
+#include "mailTokenizer.h"
+#include "mailSegment.h"
+#include "mailQuery.h"
 
 // --------------------------------------------------------------------- //
 // ----- imported datas ------------------------------------------------ //
@@ -78,11 +99,28 @@ static const int FLAG_INDEX_PATH	= 0x010;
 static const int FLAG_BRAIN_PATH	= 0x020;
 static const int FLAG_MBOX_PATH		= 0x040;
 static const int FLAG_STATISTICS	= 0x080;
+static const int FLAG_DAEMON		= 0x100;
+static const int FLAG_SOCKET		= 0x200;
+static const int FLAG_THREAD_COUNT	= 0x400;
+static const int FLAG_SHOWN_HITS	= 0x800;
 
 static const char CHAR_INDEX_PATH	= 'I';
 static const char CHAR_BRAIN_PATH	= 'B';
 static const char CHAR_MBOX_PATH	= 'M';
 static const char CHAR_STATISTICS	= 'S';
+static const char CHAR_DAEMON		= 'D';
+static const char CHAR_SOCKET		= 'U';
+static const char CHAR_THREAD_COUNT	= 'T';
+static const char CHAR_SHOWN_HITS	= 'H';
+
+static const size_t DEF_SHOWN_HITS	= 4;
+static const size_t DEF_THREAD_COUNT	= 4;
+static const size_t NUM_FETCH_THREADS	= 8;		// reading the headers of the mails shown, shared by all queries
+
+static const size_t MAIL_HEADER_BLOCK	= 4096;
+static const size_t MAX_MAIL_HEADER		= 65536;
+
+static const char DAEMON_END_MARK[]	= ".";		// ends every answer of the daemon
 
 // --------------------------------------------------------------------- //
 // ----- macros -------------------------------------------------------- //
@@ -99,6 +137,722 @@ using ai::Brain;
 // ----- class definitions --------------------------------------------- //
 // --------------------------------------------------------------------- //
 
+/// a file read at given offsets, several threads may read at once
+class MailboxFile
+{
+#ifdef _Windows
+	HANDLE	m_file;
+#else
+	int		m_fd;
+#endif
+
+	MailboxFile( const MailboxFile & );
+	MailboxFile &operator = ( const MailboxFile & );
+
+	public:
+#ifdef _Windows
+	MailboxFile() : m_file( INVALID_HANDLE_VALUE ) {}
+#else
+	MailboxFile() : m_fd( -1 ) {}
+#endif
+	~MailboxFile()
+	{
+		close();
+	}
+
+	bool open( const char *fileName )
+	{
+		close();
+#ifdef _Windows
+		m_file = CreateFileA(
+			fileName, GENERIC_READ, FILE_SHARE_READ|FILE_SHARE_WRITE, NULL, OPEN_EXISTING,
+			FILE_FLAG_RANDOM_ACCESS, NULL
+		);
+#else
+		m_fd = ::open( fileName, O_RDONLY );
+#endif
+		return isOpen();
+	}
+	void close()
+	{
+#ifdef _Windows
+		if( m_file != INVALID_HANDLE_VALUE )
+			CloseHandle( m_file );
+		m_file = INVALID_HANDLE_VALUE;
+#else
+		if( m_fd >= 0 )
+			::close( m_fd );
+		m_fd = -1;
+#endif
+	}
+	bool isOpen() const
+	{
+#ifdef _Windows
+		return m_file != INVALID_HANDLE_VALUE;
+#else
+		return m_fd >= 0;
+#endif
+	}
+
+	/// reads up to size bytes at offset, returns the number of bytes read
+	std::size_t read( gak::uint64 offset, void *buffer, std::size_t size ) const
+	{
+#ifdef _Windows
+		OVERLAPPED	overlapped;
+		DWORD		numRead = 0;
+
+		std::memset( &overlapped, 0, sizeof( overlapped ) );
+		overlapped.Offset = DWORD( offset );
+		overlapped.OffsetHigh = DWORD( offset >> 32 );
+		return ReadFile( m_file, buffer, DWORD( size ), &numRead, &overlapped ) ? std::size_t( numRead ) : 0;
+#else
+		const ssize_t	numRead = ::pread( m_fd, buffer, size, off_t( offset ) );
+		return numRead > 0 ? std::size_t( numRead ) : 0;
+#endif
+	}
+};
+
+/// the header fields of a mail shown in the result list
+struct MailHeaders
+{
+	std::string	from, to, date, subject;
+	STRING		error;			// empty, if the mail was read
+
+	private:
+	static bool isField( const std::string &line, std::size_t colon, const char *name )
+	{
+		std::size_t	i = 0;
+		for( ; i<colon && name[i]; ++i )
+		{
+			if( tolower( (unsigned char)line[i] ) != name[i] )
+			{
+				return false;
+			}
+		}
+		return i == colon && !name[i];
+	}
+	static void decodeBase64( const std::string &text, std::string *result )
+	{
+		unsigned	bits = 0, numBits = 0;
+		for( std::size_t i=0; i<text.size() && text[i] != '='; ++i )
+		{
+			const char	c = text[i];
+			const int	value = c >= 'A' && c <= 'Z' ? c - 'A'
+				: c >= 'a' && c <= 'z' ? c - 'a' + 26
+				: c >= '0' && c <= '9' ? c - '0' + 52
+				: c == '+' ? 62 : c == '/' ? 63 : -1;
+			if( value < 0 )
+			{
+				continue;
+			}
+			bits = (bits << 6) | unsigned(value);
+			numBits += 6;
+			if( numBits >= 8 )
+			{
+				numBits -= 8;
+				*result += char( (bits >> numBits) & 0xFF );
+			}
+		}
+	}
+	static void decodeQuoted( const std::string &text, std::string *result )
+	{
+		for( std::size_t i=0; i<text.size(); ++i )
+		{
+			if( text[i] == '_' )
+			{
+				*result += ' ';
+			}
+			else if( text[i] == '=' && i+2 < text.size() && isxdigit( (unsigned char)text[i+1] ) && isxdigit( (unsigned char)text[i+2] ) )
+			{
+				*result += char( std::strtoul( text.substr( i+1, 2 ).c_str(), nullptr, 16 ) );
+				i += 2;
+			}
+			else
+			{
+				*result += text[i];
+			}
+		}
+	}
+	/// finds the next encoded word at or behind pos, a stray "=?" is skipped
+	static bool findEncodedWord(
+		const std::string &text, std::size_t pos,
+		std::size_t *start, std::size_t *charsetEnd, std::size_t *wordEnd
+	)
+	{
+		for(
+			*start = text.find( "=?", pos );
+			*start != std::string::npos;
+			*start = text.find( "=?", *start+2 )
+		)
+		{
+			*charsetEnd = text.find( '?', *start+2 );
+			if( *charsetEnd == std::string::npos || *charsetEnd+2 >= text.size() || text[*charsetEnd+2] != '?' )
+			{
+				continue;
+			}
+			*wordEnd = text.find( "?=", *charsetEnd+3 );
+			// an encoded word contains no white space
+			if( *wordEnd != std::string::npos && text.find_first_of( " \t", *start ) > *wordEnd )
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+	/// decodes the RFC 2047 words =?charset?B|Q?text?=, the charset is kept
+	static std::string decodeWords( const std::string &text )
+	{
+		std::string	result;
+		std::size_t	pos = 0;
+		bool		lastEncoded = false;
+
+		while( pos < text.size() )
+		{
+			std::size_t	start, charsetEnd, wordEnd;
+			if( !findEncodedWord( text, pos, &start, &charsetEnd, &wordEnd ) )
+			{
+				result.append( text, pos, std::string::npos );
+				break;
+			}
+
+			// the space between two encoded words is not shown
+			const std::string	between( text, pos, start-pos );
+			if( !lastEncoded || between.find_first_not_of( " \t" ) != std::string::npos )
+			{
+				result += between;
+			}
+
+			const std::string	encoded( text, charsetEnd+3, wordEnd-charsetEnd-3 );
+			const char			encoding = char( toupper( (unsigned char)text[charsetEnd+1] ) );
+			if( encoding == 'B' )
+				decodeBase64( encoded, &result );
+			else if( encoding == 'Q' )
+				decodeQuoted( encoded, &result );
+			else
+				result.append( text, start, wordEnd+2-start );
+
+			pos = wordEnd+2;
+			lastEncoded = true;
+		}
+		return result;
+	}
+
+	public:
+	/// reads the fields from the header lines, folded lines are joined
+	void parse( const std::string &header )
+	{
+		std::string	*field = nullptr;
+		std::size_t	pos = 0;
+
+		while( pos < header.size() )
+		{
+			std::size_t	lineEnd = header.find( '\n', pos );
+			if( lineEnd == std::string::npos )
+			{
+				lineEnd = header.size();
+			}
+			std::string	line( header, pos, lineEnd-pos );
+			pos = lineEnd+1;
+
+			if( !line.empty() && line[line.size()-1] == '\r' )
+			{
+				line.erase( line.size()-1 );
+			}
+			if( line.empty() )
+			{
+				break;
+			}
+			if( line[0] == ' ' || line[0] == '\t' )
+			{
+				const std::size_t	valueStart = line.find_first_not_of( " \t" );
+				if( field && valueStart != std::string::npos )
+				{
+					*field += ' ';
+					field->append( line, valueStart, std::string::npos );
+				}
+				continue;
+			}
+
+			field = nullptr;
+			const std::size_t	colon = line.find( ':' );
+			if( colon == std::string::npos )
+			{
+				continue;
+			}
+			if( isField( line, colon, "from" ) )
+				field = &from;
+			else if( isField( line, colon, "to" ) )
+				field = &to;
+			else if( isField( line, colon, "date" ) )
+				field = &date;
+			else if( isField( line, colon, "subject" ) )
+				field = &subject;
+
+			if( field && field->empty() )
+			{
+				const std::size_t	valueStart = line.find_first_not_of( " \t", colon+1 );
+				if( valueStart != std::string::npos )
+				{
+					field->assign( line, valueStart, std::string::npos );
+				}
+			}
+			else
+			{
+				field = nullptr;
+			}
+		}
+		from = decodeWords( from );
+		to = decodeWords( to );
+		subject = decodeWords( subject );
+	}
+};
+
+typedef std::vector<MailHeaders>	MailHeaderList;
+
+class MailSearchIndex;
+
+/// counts the headers of a query not read yet
+class FetchCounter
+{
+	std::mutex				m_mutex;
+	std::condition_variable	m_done;
+	size_t					m_pending;
+
+	public:
+	FetchCounter( size_t pending ) : m_pending( pending ) {}
+
+	void done()
+	{
+		std::lock_guard<std::mutex>	lock( m_mutex );
+		if( !--m_pending )
+		{
+			m_done.notify_all();
+		}
+	}
+	void wait()
+	{
+		std::unique_lock<std::mutex>	lock( m_mutex );
+		m_done.wait( lock, [this] { return !m_pending; } );
+	}
+};
+
+/// reads the headers of one mail shown, a job of the fetch threads
+struct HeaderFetch
+{
+	MailSearchIndex	*index;
+	const MailHit	*hit;
+	MailHeaders		*headers;
+	FetchCounter	*counter;
+
+	HeaderFetch( MailSearchIndex *index, const MailHit *hit, MailHeaders *headers, FetchCounter *counter )
+	: index(index), hit(hit), headers(headers), counter(counter) {}
+};
+
+typedef SharedPointer<HeaderFetch> HeaderFetchPtr;
+
+namespace gak
+{
+	template <>
+	struct ProcessorType<HeaderFetchPtr>
+	{
+		typedef HeaderFetchPtr object_type;
+
+		void process( const HeaderFetchPtr &fetch, void *, void * );
+	};
+}
+
+/*
+	the mapped segments of an index and the positions of the mailboxes
+	found. A daemon keeps it for all queries and replaces it, when the
+	indexer has written a new manifest. Searches running keep the old one.
+*/
+class MailSearchIndex
+{
+	/// loaded when a mail of it is shown first, each mailbox has its own lock
+	struct Mailbox
+	{
+		Critical		critical;
+		bool			loaded;
+		STRING			mboxFile;		// empty, if the mailbox was not found
+		MboxPositions	positions;
+
+		Mailbox() : loaded( false ) {}
+	};
+
+	typedef std::shared_ptr<Mailbox>	MailboxPtr;
+
+	const gak::CommandLine				&m_cmdLine;
+	STRING								m_indexPath;
+	STRING								m_manifestFile;
+	DateTime							m_manifestDate;
+	MailSegments						m_manifest;
+	StopWordSet							m_stopWords;		// of the manifest, dropped from the queries
+	std::vector<MappedSegment>			m_segments;
+	size_t								m_maxHits;
+	ThreadPool<HeaderFetchPtr>			m_fetchPool;
+
+	Critical							m_mailboxCritical;
+	std::map<std::string, MailboxPtr>	m_mailboxes;
+
+	MailboxPtr getMailbox( const std::string &name )
+	{
+		MailboxPtr	mailbox;
+		{
+			CriticalScope	scope( m_mailboxCritical );
+
+			MailboxPtr	&entry = m_mailboxes[name];
+			if( !entry )
+			{
+				entry.reset( new Mailbox );
+			}
+			mailbox = entry;
+		}
+
+		CriticalScope	scope( mailbox->critical );
+		if( !mailbox->loaded )
+		{
+			mailbox->loaded = true;
+			for(
+				ArrayOfStrings::const_iterator it = m_cmdLine.parameter[CHAR_MBOX_PATH].cbegin(), endIT = m_cmdLine.parameter[CHAR_MBOX_PATH].cend();
+				it != endIT;
+				++it
+			)
+			{
+				STRING	mboxFile = *it;
+				mboxFile.condAppend(DIRECTORY_DELIMITER);
+				mboxFile += name.c_str();
+
+				STRING	mboxPositionsFile = m_indexPath + name.c_str() + MBOX_POS_EXT;
+
+				if( !strAccess( mboxFile, 0 ) && !strAccess( mboxPositionsFile, 0 ) )
+				{
+					readFromBinaryFile( mboxPositionsFile, &mailbox->positions, MBOX_POS_MAGIC, MBOX_POS_VERSION, false );
+					mailbox->mboxFile = mboxFile;
+					break;
+				}
+			}
+		}
+		return mailbox;
+	}
+
+	/// reads the header lines of a mail only, they end with an empty line
+	static void readHeader( const MailboxFile &file, uint64 start, uint64 end, std::string *header )
+	{
+		char	block[MAIL_HEADER_BLOCK];
+
+		while( header->size() < MAX_MAIL_HEADER && start + header->size() < end )
+		{
+			const size_t	size = file.read(
+				start + header->size(), block, size_t( std::min( uint64( sizeof( block ) ), end - start - header->size() ) )
+			);
+			if( !size )
+			{
+				break;
+			}
+
+			const size_t	searchStart = header->size() >= 3 ? header->size() - 3 : 0;
+			header->append( block, size );
+
+			size_t	headerEnd = header->find( "\n\n", searchStart );
+			if( headerEnd == std::string::npos )
+			{
+				headerEnd = header->find( "\n\r\n", searchStart );
+			}
+			if( headerEnd != std::string::npos )
+			{
+				header->resize( headerEnd+1 );
+				break;
+			}
+		}
+	}
+
+	public:
+	MailSearchIndex( const gak::CommandLine &cmdLine )
+	: m_cmdLine( cmdLine ), m_maxHits( DEF_SHOWN_HITS ), m_fetchPool( NUM_FETCH_THREADS, "HeaderFetcher" )
+	{
+		if( cmdLine.flags & FLAG_SHOWN_HITS )
+		{
+			m_maxHits = getValueE<size_t>(cmdLine.parameter[CHAR_SHOWN_HITS][0]);
+		}
+		m_indexPath = cmdLine.parameter[CHAR_INDEX_PATH][0];
+		m_indexPath.condAppend(DIRECTORY_DELIMITER);
+
+		m_manifestFile = m_indexPath + MAIL_SEGMENTS_FILE;
+		if( strAccess( m_manifestFile, 0 ) )
+		{
+			throw gak::OpenReadError(m_manifestFile);
+		}
+		m_manifestDate = DirectoryEntry( m_manifestFile ).modifiedDate;
+		readFromBinaryFile( m_manifestFile, &m_manifest, MAIL_SEGMENTS_MAGIC, MAIL_SEGMENTS_VERSION, false );
+		for( size_t i=0; i<m_manifest.stopWords.size(); ++i )
+		{
+			m_stopWords.addElement( m_manifest.stopWords[i].c_str() );
+		}
+
+		// the segments are mapped, a query reads the pages it needs only
+		std::vector<MappedSegment>( m_manifest.segments.size() ).swap( m_segments );
+		for( size_t i=0; i<m_manifest.segments.size(); ++i )
+		{
+			m_segments[i].open( getSegmentFile( m_indexPath, m_manifest.segments[i].id ) );
+		}
+		m_fetchPool.start();
+	}
+	~MailSearchIndex()
+	{
+		m_fetchPool.shutdown();
+	}
+
+	const gak::CommandLine &getCommandLine() const
+	{
+		return m_cmdLine;
+	}
+	const STRING &getIndexPath() const
+	{
+		return m_indexPath;
+	}
+	const std::vector<MappedSegment> &getSegments() const
+	{
+		return m_segments;
+	}
+	/// reads the fields shown of a mail at its position in the mailbox
+	void fetchHeaders( const MailHit &hit, MailHeaders *headers )
+	{
+		try
+		{
+			const MailboxPtr	mailbox = getMailbox( hit.mailbox );
+			if( mailbox->mboxFile.isEmpty() )
+			{
+				headers->error = STRING("Mailbox ") + hit.mailbox.c_str() + " not found.";
+				return;
+			}
+
+			const Array<int64>	&positions = mailbox->positions.positions;
+			if( hit.mailIndex >= positions.size() )
+			{
+				headers->error = STRING("Mail not found in ") + hit.mailbox.c_str();
+				return;
+			}
+			const uint64	start = uint64( positions[size_t(hit.mailIndex)] );
+			const uint64	end = hit.mailIndex+1 < positions.size() ? uint64( positions[size_t(hit.mailIndex+1)] ) : uint64(-1);
+
+			// opened for each mail, so a daemon keeps no handle of all the mailboxes found
+			MailboxFile	file;
+			if( !file.open( mailbox->mboxFile ) )
+			{
+				headers->error = STRING("Cannot open ") + mailbox->mboxFile;
+				return;
+			}
+			std::string	header;
+			readHeader( file, start, end, &header );
+			headers->parse( header );
+		}
+		catch( std::exception &e )
+		{
+			headers->error = e.what();
+		}
+	}
+	void fetchHeaders( const MailHits &hits, MailHeaderList *headers );
+
+	/// true, if the indexer has written a new manifest
+	bool isOutdated() const
+	{
+		return !strAccess( m_manifestFile, 0 ) && DirectoryEntry( m_manifestFile ).modifiedDate != m_manifestDate;
+	}
+
+	/// writes the number of mails found and the best of them
+	void search( const char *queryStr, std::ostream &out )
+	{
+		QueryNode	query;
+		MailHits	hits;
+		MailQueryParser( &m_stopWords ).parse( queryStr, &query );
+		const size_t numFound = MailSearcher( m_manifest, m_segments ).search( query, m_maxHits, &hits );
+
+		MailHeaderList	headers;
+		fetchHeaders( hits, &headers );
+
+		out << "Found " << numFound << " items" << std::endl;
+		for( size_t j=0; j<hits.size(); ++j )
+		{
+			const MailHeaders	&mail = headers[j];
+
+			out << '\n' << hits[j].mailbox << std::endl;
+			if( mail.error.isEmpty() )
+			{
+				out << "From:    " << mail.from << std::endl;
+				out << "To:      " << mail.to << std::endl;
+				out << "Date:    " << mail.date << std::endl;
+				out << "Subject: " << mail.subject << std::endl;
+			}
+			else
+			{
+				out << mail.error << std::endl;
+			}
+		}
+	}
+};
+
+typedef std::shared_ptr<MailSearchIndex>	MailSearchIndexPtr;
+
+/*
+	where the answers for stdin or for a client connected to the socket go.
+	The answers are written in the order of the queries, an answer done
+	before an earlier one waits.
+*/
+class SearchOutput
+{
+	int								m_client;		// -1 for stdout
+	Critical						m_critical;
+	uint64							m_nextAnswer;
+	std::map<uint64, std::string>	m_answers;		// waiting for an earlier one
+	bool							m_connected;
+
+	bool writeAnswer( const std::string &answer )
+	{
+#ifndef _Windows
+		if( m_client >= 0 )
+		{
+			for( size_t written = 0; written < answer.size(); )
+			{
+				const ssize_t	size = ::write( m_client, answer.data() + written, answer.size() - written );
+				if( size <= 0 )
+				{
+					return false;
+				}
+				written += size_t(size);
+			}
+			return true;
+		}
+#endif
+		std::cout << answer << std::flush;
+		return bool(std::cout);
+	}
+
+	public:
+	SearchOutput( int client ) : m_client( client ), m_nextAnswer( 0 ), m_connected( true ) {}
+	~SearchOutput()
+	{
+#ifndef _Windows
+		if( m_client >= 0 )
+		{
+			::close( m_client );
+		}
+#endif
+	}
+
+	bool isConnected()
+	{
+		CriticalScope	scope( m_critical );
+		return m_connected;
+	}
+	/// writes the answer and those waiting for it, if the query was the next one
+	void write( uint64 sequence, std::string &answer )
+	{
+		CriticalScope	scope( m_critical );
+
+		m_answers[sequence].swap( answer );
+		for(
+			std::map<uint64, std::string>::iterator it = m_answers.begin();
+			it != m_answers.end() && it->first == m_nextAnswer;
+			it = m_answers.begin()
+		)
+		{
+			if( m_connected )
+			{
+				m_connected = writeAnswer( it->second );
+			}
+			m_answers.erase( it );
+			++m_nextAnswer;
+		}
+	}
+};
+
+typedef std::shared_ptr<SearchOutput>	SearchOutputPtr;
+
+/// a query read from stdin or from a client, each is a job of the search threads
+struct SearchRequest
+{
+	SearchOutputPtr	output;
+	uint64			sequence;	// of the query in its input
+	STRING			query;
+
+	SearchRequest( const SearchOutputPtr &output, uint64 sequence, const STRING &query )
+	: output(output), sequence(sequence), query(query) {}
+};
+
+typedef SharedPointer<SearchRequest> SearchRequestPtr;
+
+namespace gak
+{
+	template <>
+	struct ProcessorType<SearchRequestPtr>
+	{
+		typedef SearchRequestPtr object_type;
+
+		static Critical				s_indexCritical;
+		static MailSearchIndexPtr	s_index;
+
+		/// the current index, a new manifest is loaded first
+		static MailSearchIndexPtr getIndex()
+		{
+			CriticalScope	scope( s_indexCritical );
+
+			if( s_index->isOutdated() )
+			{
+				// the indexer may still write, the old index is used until the next query
+				try
+				{
+					MailSearchIndexPtr	index( new MailSearchIndex( s_index->getCommandLine() ) );
+					s_index = index;
+				}
+				catch( std::exception &e )
+				{
+					std::cerr << "Reloading index: " << e.what() << std::endl;
+				}
+			}
+			return s_index;
+		}
+
+		void process( const SearchRequestPtr &request, void *, void * )
+		{
+			doEnterFunctionEx(gakLogging::llInfo,"ProcessorType<SearchRequestPtr>::process");
+
+			std::ostringstream	out;
+			try
+			{
+				getIndex()->search( request->query, out );
+			}
+			catch( std::exception &e )
+			{
+				out << "Error: " << e.what() << std::endl;
+			}
+			out << DAEMON_END_MARK << std::endl;
+
+			std::string	answer = out.str();
+			request->output->write( request->sequence, answer );
+		}
+	};
+}
+
+#ifndef _Windows
+/// reads the queries of a client until it closes the connection
+class ClientReader : public Thread
+{
+	SearchOutputPtr					m_output;
+	ThreadPool<SearchRequestPtr>	&m_pool;
+	int								m_client;
+
+	public:
+	ClientReader( int client, ThreadPool<SearchRequestPtr> &pool )
+	: m_output( new SearchOutput( client ) ), m_pool( pool ), m_client( client )
+	{
+		StartThread( "ClientReader" );
+	}
+	virtual void ExecuteThread();
+};
+#endif
+
+Critical			ProcessorType<SearchRequestPtr>::s_indexCritical;
+MailSearchIndexPtr	ProcessorType<SearchRequestPtr>::s_index;
 
 // --------------------------------------------------------------------- //
 // ----- exported datas ------------------------------------------------ //
@@ -114,6 +868,10 @@ static gak::CommandLine::Options options[] =
 	{ CHAR_BRAIN_PATH,	"brainPath",	0, 1, FLAG_BRAIN_PATH|gak::CommandLine::needArg,	"path where to store the AI brain" },
 	{ CHAR_MBOX_PATH,	"mboxPath",		0, unsigned(-1), FLAG_MBOX_PATH|gak::CommandLine::needArg,	"path where to find the mbox files" },
 	{ CHAR_STATISTICS,	"showStats",	0, 1, FLAG_STATISTICS,								"show statistics" },
+	{ CHAR_DAEMON,		"daemon",		0, 1, FLAG_DAEMON,									"answer the queries read from stdin, one per line" },
+	{ CHAR_SOCKET,		"socket",		0, 1, FLAG_SOCKET|gak::CommandLine::needArg,		"answer the queries of the clients of this unix socket" },
+	{ CHAR_THREAD_COUNT,	"threadCount",	0, 1, FLAG_THREAD_COUNT|gak::CommandLine::needArg,	"number of search threads (<4>)" },
+	{ CHAR_SHOWN_HITS,	"hits",			0, 1, FLAG_SHOWN_HITS|gak::CommandLine::needArg,	"number of mails shown (<4>)" },
 	{ 0 }
 };
 
@@ -219,101 +977,147 @@ static void aiSearch( const gak::CommandLine &cmdLine )
 	}
 }
 
-// -I X:\MailIndex -M X:\Mail -M W:\Mail "demon +force" BikeFeeling
+// -I X:\MailIndex -M X:\Mail -M W:\Mail "demon force" "\"bike feeling\"~2 OR (bike -car)"
 // -I X:\MailIndex -M X:\Mail -M W:\Mail -S
 static void indexSearch( const gak::CommandLine &cmdLine )
 {
 	doEnterFunctionEx(gakLogging::llInfo, "indexSearch");
 
-	MailIndex index;
-
-	STRING indexPath = cmdLine.parameter[CHAR_INDEX_PATH][0];
-	indexPath.condAppend(DIRECTORY_DELIMITER);
-	STRING indexFile = indexPath + MAIL_INDEX_FILE;
-	if( strAccess( indexFile, 0 ) )
-	{
-		throw gak::OpenReadError(indexFile);
-	}
-
-	std::cout << "Reading " << indexFile << std::endl;
-	readFromBinaryFile( indexFile, &index, MAIL_INDEX_MAGIC, MAIL_INDEX_VERSION, true );
+	MailSearchIndex	index( cmdLine );
 
-	std::cout << "Searching in " << indexFile << std::endl;
+	std::cout << "Searching in " << index.getIndexPath() << std::endl;
 
 	const char *argv;
 	for( int i=1; (argv = cmdLine.argv[i]) != nullptr; ++i )
 	{
 		std::cout << "\nSearching for " << argv << std::endl;
-		MailRelevantHits	result = index.getRelevantHits(argv, false, true, false);
-		std::cout << "Found " << result.size() << "items" << std::endl;
-		size_t count=0;
+		index.search( argv, std::cout );
+	}
+
+	if( cmdLine.flags &FLAG_STATISTICS ) 
+	{
+		const std::vector<MappedSegment>	&segments = index.getSegments();
+		std::map<std::string, size_t>		wordCounts;
+		for( size_t i=0; i<segments.size(); ++i )
+		{
+			addStatistik( segments[i], &wordCounts );
+		}
+
+		WordCounts stats;
+		sortStatistik( wordCounts, &stats );
+		size_t i=0;
 		for(
-			MailRelevantHits::const_iterator it = result.cbegin(), endIT = result.cend();
-			endIT != it && ++count < 5;
-			++it
+			WordCounts::const_iterator it = stats.cbegin(), endIT = stats.cend();
+			it != endIT && i<10;
+			++it, ++i
 		)
 		{
-			gak::mail::MAIL	theMail;
-			STRING			mboxFile;
-			STRING			mboxPositionsFile;
+			std::cout << it->second << ' ' << it->first << std::endl;
+		}
+	}
+}
 
-			std::cout << '\n' << it->m_source.mboxFile << std::endl;
-			for(
-				ArrayOfStrings::const_iterator it2 = cmdLine.parameter[CHAR_MBOX_PATH].cbegin(), endIT2 = cmdLine.parameter[CHAR_MBOX_PATH].cend();
-				it2 != endIT2;
-				++it2
-			)
-			{
-				mboxFile = *it2;
-				mboxFile.condAppend(DIRECTORY_DELIMITER);
-				mboxFile += it->m_source.mboxFile;
+#ifndef _Windows
+/// accepts clients until the daemon is killed, each gets a thread reading its queries
+static void acceptClients( const STRING &socketFile, ThreadPool<SearchRequestPtr> &pool )
+{
+	sockaddr_un	address;
+	if( socketFile.strlen() >= sizeof( address.sun_path ) )
+	{
+		throw CmdlineError("Socket path too long.");
+	}
+	std::memset( &address, 0, sizeof( address ) );
+	address.sun_family = AF_UNIX;
+	std::strcpy( address.sun_path, socketFile );
 
-				mboxPositionsFile = indexPath;
-				mboxPositionsFile.condAppend(DIRECTORY_DELIMITER);
-				mboxPositionsFile += it->m_source.mboxFile;
-				mboxPositionsFile += MBOX_POS_EXT;
+	const int	server = ::socket( AF_UNIX, SOCK_STREAM, 0 );
+	if( server < 0 )
+	{
+		throw std::runtime_error( "Cannot create socket" );
+	}
+	// a socket of a previous daemon would block bind
+	::unlink( socketFile );
+	if( ::bind( server, (const sockaddr *)&address, sizeof( address ) ) || ::listen( server, SOMAXCONN ) )
+	{
+		::close( server );
+		throw std::runtime_error( std::string( "Cannot listen on " ) + socketFile.c_str() );
+	}
 
-				if( !strAccess( mboxFile, 0 ) && !strAccess( mboxPositionsFile, 0 ) )
+	std::vector< SharedObjectPointer<ClientReader> >	readers;
+	while( true )
+	{
+		const int	client = ::accept( server, nullptr, nullptr );
+		if( client >= 0 )
+		{
+			for( size_t i=readers.size(); i>0; --i )
+			{
+				if( !readers[i-1]->isRunning )
 				{
-					break;
+					readers[i-1]->join();
+					readers.erase( readers.begin() + std::ptrdiff_t(i-1) );
 				}
 			}
-			if( !strAccess( mboxFile, 0 ) && !strAccess( mboxPositionsFile, 0 ) )
-			{
-				Array<int64>	positions;
-				readFromBinaryFile( mboxPositionsFile, &positions, MBOX_POS_MAGIC, MBOX_POS_VERSION, false );
-
-				loadMail( mboxFile, it->m_source.mailIndex, positions, &theMail );
-				std::cout << "From:    " << theMail.from << std::endl;
-				std::cout << "To:      " << theMail.to << std::endl;
-				std::cout << "Date:    " << theMail.date.getLocalTime() << std::endl;
-				std::cout << "Subject: " << theMail.subject << std::endl;
-			}
-			else
-			{
-				std::cout << "Mailbox " << it->m_source.mboxFile << " not found." << std::endl;
-			}
+			readers.push_back( new ClientReader( client, pool ) );
 		}
 	}
+}
+#endif
 
-	if( cmdLine.flags &FLAG_STATISTICS ) 
+/*
+	keeps the index mapped and the positions of the mailboxes read for all
+	queries. Each line is a query, each answer ends with DAEMON_END_MARK.
+	The queries are searched in parallel, but the answers come in the
+	order of the queries of stdin or of a client.
+*/
+static void searchDaemon( const gak::CommandLine &cmdLine )
+{
+	doEnterFunctionEx(gakLogging::llInfo, "searchDaemon");
+
+	typedef ProcessorType<SearchRequestPtr>	Searcher;
+
+	size_t threadCount = DEF_THREAD_COUNT;
+	if( cmdLine.flags & FLAG_THREAD_COUNT )
 	{
-		ai::StatistikData stats;
-		index.getStatistik(&stats);
-		size_t i=0;
-		for(
-			ai::StatistikData::const_iterator it = stats.cbegin(), endIT = stats.cend();
-			it != endIT && i<10;
-			++it
-		)
+		threadCount = getValueE<size_t>(cmdLine.parameter[CHAR_THREAD_COUNT][0]);
+	}
+
+	Searcher::s_index.reset( new MailSearchIndex( cmdLine ) );
+	std::cerr << "Searching in " << Searcher::s_index->getIndexPath() << std::endl;
+
+#ifndef _Windows
+	// a client or a reader of stdout gone must not kill the daemon, writing fails only
+	::signal( SIGPIPE, SIG_IGN );
+#endif
+
+	ThreadPool<SearchRequestPtr>	pool( threadCount, "MailSearcher" );
+	pool.start();
+
+	if( cmdLine.flags & FLAG_SOCKET )
+	{
+#ifndef _Windows
+		acceptClients( cmdLine.parameter[CHAR_SOCKET][0], pool );
+#else
+		throw CmdlineError("Unix sockets are not supported.");
+#endif
+	}
+	else
+	{
+		const SearchOutputPtr	output( new SearchOutput( -1 ) );
+		uint64					sequence = 0;
+		std::string				query;
+		while( std::getline( std::cin, query ) )
 		{
-			if( !ai::isSpecialIndex(it->m_word) )
+			if( !query.empty() && query[query.size()-1] == '\r' )
 			{
-				std::cout << it->m_count << ' ' << it->m_word << std::endl;
-				++i;
+				query.erase( query.size()-1 );
 			}
+			pool.process( SearchRequestPtr::makeShared( output, sequence++, STRING( query.c_str() ) ) );
 		}
 	}
+
+	pool.flush();
+	pool.shutdown();
+	Searcher::s_index.reset();
 }
 
 static void mboxSearch( const gak::CommandLine &cmdLine )
@@ -333,7 +1137,14 @@ static void mboxSearch( const gak::CommandLine &cmdLine )
 		{
 			throw CmdlineError("Mbox path missing.");
 		}
-		indexSearch( cmdLine );
+		if( cmdLine.flags & (FLAG_DAEMON|FLAG_SOCKET) )
+		{
+			searchDaemon( cmdLine );
+		}
+		else
+		{
+			indexSearch( cmdLine );
+		}
 	}
 	else
 	{
@@ -363,11 +1174,67 @@ static void mboxSearch( const gak::CommandLine &cmdLine )
 // --------------------------------------------------------------------- //
 // ----- class virtuals ------------------------------------------------ //
 // --------------------------------------------------------------------- //
+
+#ifndef _Windows
+void ClientReader::ExecuteThread()
+{
+	std::string	buffer;
+	char		block[4096];
+	ssize_t		size;
+	uint64		sequence = 0;
+
+	while( m_output->isConnected() && (size = ::read( m_client, block, sizeof( block ) )) > 0 )
+	{
+		buffer.append( block, size_t(size) );
+
+		size_t	lineEnd;
+		while( (lineEnd = buffer.find( '\n' )) != std::string::npos )
+		{
+			std::string	query( buffer, 0, lineEnd );
+			buffer.erase( 0, lineEnd+1 );
+			if( !query.empty() && query[query.size()-1] == '\r' )
+			{
+				query.erase( query.size()-1 );
+			}
+			m_pool.process( SearchRequestPtr::makeShared( m_output, sequence++, STRING( query.c_str() ) ) );
+		}
+	}
+	// the connection is closed, when the last answer is written
+	m_output.reset();
+}
+#endif
    
 // --------------------------------------------------------------------- //
 // ----- class publics ------------------------------------------------- //
 // --------------------------------------------------------------------- //
 
+void ProcessorType<HeaderFetchPtr>::process( const HeaderFetchPtr &fetch, void *, void * )
+{
+	fetch->index->fetchHeaders( *fetch->hit, fetch->headers );
+	fetch->counter->done();
+}
+
+/// the hits are read by the fetch threads, the search thread waits for them
+void MailSearchIndex::fetchHeaders( const MailHits &hits, MailHeaderList *headers )
+{
+	headers->resize( hits.size() );
+	if( hits.size() < 2 )
+	{
+		for( size_t i=0; i<hits.size(); ++i )
+		{
+			fetchHeaders( hits[i], &(*headers)[i] );
+		}
+		return;
+	}
+
+	FetchCounter	counter( hits.size() );
+	for( size_t i=0; i<hits.size(); ++i )
+	{
+		m_fetchPool.process( HeaderFetchPtr::makeShared( this, &hits[i], &(*headers)[i], &counter ) );
+	}
+	counter.wait();
+}
+
 // --------------------------------------------------------------------- //
 // ----- entry points -------------------------------------------------- //
 // --------------------------------------------------------------------- //
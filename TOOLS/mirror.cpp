@@ -45,13 +45,24 @@
 
 #include <memory>
 #include <fstream>
+#include <sstream>
 #include <iomanip>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
 
 #include <sys/stat.h>
 
 #include <gak/condQueue.h>
 #include <gak/cmdlineParser.h>
 #include <gak/thread.h>
+#include <gak/threadPool.h>
 #include <gak/directory.h>
 #include <gak/fcopy.h>
 #include <gak/stack.h>
@@ -61,6 +72,27 @@
 #include <gak/acls.h>
 #include <gak/eta.h>
 #include <gak/mboxParser.h>
+#include <gak/iostream.h>
+
+#ifndef _Windows
+#	include <unistd.h>
+#	include <fcntl.h>
+#	include <sys/xattr.h>
+#endif
+
+#if defined( SEEK_DATA ) && defined( SEEK_HOLE )
+#	define SPARSE_COPY	1
+#else
+#	define SPARSE_COPY	0
+#endif
+
+#ifdef __linux__
+#	include <poll.h>
+#	include <sys/inotify.h>
+#	define WATCH_MODE	1
+#else
+#	define WATCH_MODE	0
+#endif
 
 // --------------------------------------------------------------------- //
 // ----- imported datas ------------------------------------------------ //
@@ -88,6 +120,10 @@ const int FLAG_CREATE_TREE	= 0x040;
 const int OPT_MAX_AGE		= 0x080;
 const int OPT_MAX_QUEUE		= 0x100;
 const int FLAG_FATAL_MAIL	= 0x200;
+const int OPT_RUN_SIZE		= 0x400;
+const int FLAG_WATCH		= 0x800;
+const int OPT_DEBOUNCE		= 0x1000;
+const int OPT_TRACE_FILE	= 0x2000;
 
 const int CHAR_DO_COMPARE	= 'C';
 const int CHAR_DO_LOG		= 'L';
@@ -95,10 +131,26 @@ const int CHAR_CREATE_TREE	= 'T';
 const int CHAR_MAX_AGE		= 'A';
 const int CHAR_MAX_QUEUE	= 'Q';
 const int CHAR_FATAL_MAIL	= 'M';
+const int CHAR_RUN_SIZE		= 'R';
+const int CHAR_WATCH		= 'W';
+const int CHAR_DEBOUNCE		= 'D';
+const int CHAR_TRACE_FILE	= 'P';
+
+static const char EXCLUDES_FILE[] = ".mirrorExcludes";
 
 const int COUNT_WIDTH		= 6;
 const int LOCK_WIDTH		= 2;
 
+const std::size_t DEF_MERGE_QUEUE_LEN	= 10000;
+const std::size_t SPARSE_BUFFER_SIZE	= 1024*1024;
+const std::size_t NUM_META_WORKERS		= 4;
+const std::size_t META_BATCH_SIZE		= 256;		// max. entries of one directory per job
+
+const unsigned DEF_DEBOUNCE			= 2000;		// milliseconds
+const unsigned MAX_DEBOUNCE_FACTOR	= 10;		// max. delay of a batch: 10 * debounce
+
+const gak::int64 TRACE_MIN_MICROS	= 100;		// shorter operations are not traced
+
 // --------------------------------------------------------------------- //
 // ----- macros -------------------------------------------------------- //
 // --------------------------------------------------------------------- //
@@ -116,6 +168,10 @@ static CommandLine::Options options[] =
 	{ CHAR_MAX_AGE,		"maxAge",		0, 1, OPT_MAX_AGE|CommandLine::needArg,	"<max age in day of backup files>" },
 	{ CHAR_MAX_QUEUE,	"maxQueueLen",	0, 1, OPT_MAX_QUEUE|CommandLine::needArg,	"<max length of process queues>" },
 	{ CHAR_FATAL_MAIL,	"fatalMail",	0, 1, FLAG_FATAL_MAIL,	"send mail in case of fatal error" },
+	{ CHAR_RUN_SIZE,	"runSize",		0, 1, OPT_RUN_SIZE|CommandLine::needArg,	"<entries per sorted temp file, limits memory for huge trees>" },
+	{ CHAR_WATCH,		"watch",		0, 1, FLAG_WATCH,	"keep running and mirror the changes of the source" },
+	{ CHAR_DEBOUNCE,	"debounce",		0, 1, OPT_DEBOUNCE|CommandLine::needArg,	"<milliseconds to collect changes in watch mode>" },
+	{ CHAR_TRACE_FILE,	"profileTrace",	0, 1, OPT_TRACE_FILE|CommandLine::needArg,	"<chrome trace event file for the thread profile>" },
 	{ 0 }
 };
 
@@ -123,6 +179,107 @@ static CommandLine::Options options[] =
 // ----- type definitions ---------------------------------------------- //
 // --------------------------------------------------------------------- //
 typedef CondQueue<DirectoryEntry> DirectoryQueue;
+
+/// relative path -> the complete subtree has to be checked
+typedef TreeMap<F_STRING, bool> ChangedPaths;
+
+typedef std::chrono::steady_clock	ProfileClock;
+
+enum ProfileStage
+{
+	psWait,		// blocked on an empty or full queue
+	psQueue,	// push and pop
+	psStat,		// directory reading and lookups
+	psCopy,		// data copy and mkdir
+	psHash,		// check sums in compare mode
+	psMeta,		// ACLs, attributes, times
+	psDelete,	// remove and rename
+	psNumStages
+};
+
+static const char *const s_stageNames[psNumStages] =
+{
+	"wait", "queue", "stat", "copy", "hash", "meta", "delete"
+};
+
+static const ProfileClock::time_point	s_profileEpoch = ProfileClock::now();
+
+/*
+	one directory entry of a sorted run, the path is relative to the
+	collector's root, so that source and destination runs can be merged
+*/
+struct SortedEntry
+{
+	F_STRING	relPath;
+	bool		directory;
+	uint64		fileSize;
+	int64		modifyUTC;
+#ifdef _Windows
+	bool		needBackup;
+#endif
+
+	SortedEntry() : directory(false), fileSize(0), modifyUTC(0)
+	{
+#ifdef _Windows
+		needBackup = false;
+#endif
+	}
+	SortedEntry( const F_STRING &relPath, const DirectoryEntry &entry )
+	: relPath(relPath), directory(entry.directory), fileSize(entry.fileSize),
+	modifyUTC(entry.modifiedDate.getUtcUnixSeconds())
+	{
+#ifdef _Windows
+		needBackup = entry.needBackup;
+#endif
+	}
+
+	int compare( const SortedEntry &other ) const
+	{
+		return gak::compare( relPath, other.relPath );
+	}
+	bool operator < ( const SortedEntry &other ) const
+	{
+		return compare( other ) < 0;
+	}
+	DirectoryEntry toDirectoryEntry( const STRING &basePath ) const
+	{
+		DirectoryEntry	entry;
+
+		entry.fileName = basePath + relPath;
+		entry.directory = directory;
+		entry.fileSize = fileSize;
+		entry.modifiedDate = DateTime( time_t(modifyUTC) );
+#ifdef _Windows
+		entry.needBackup = needBackup;
+#endif
+		return entry;
+	}
+
+	void toBinaryStream( std::ostream &stream ) const
+	{
+		gak::toBinaryStream( stream, relPath );
+		gak::toBinaryStream( stream, uint8(directory) );
+		gak::toBinaryStream( stream, fileSize );
+		gak::toBinaryStream( stream, modifyUTC );
+#ifdef _Windows
+		gak::toBinaryStream( stream, uint8(needBackup) );
+#endif
+	}
+	void fromBinaryStream( std::istream &stream )
+	{
+		uint8	flag;
+
+		gak::fromBinaryStream( stream, &relPath );
+		gak::fromBinaryStream( stream, &flag );
+		directory = flag != 0;
+		gak::fromBinaryStream( stream, &fileSize );
+		gak::fromBinaryStream( stream, &modifyUTC );
+#ifdef _Windows
+		gak::fromBinaryStream( stream, &flag );
+		needBackup = flag != 0;
+#endif
+	}
+};
 // --------------------------------------------------------------------- //
 // ----- class definitions --------------------------------------------- //
 // --------------------------------------------------------------------- //
@@ -150,11 +307,157 @@ class TreeCreator
 	void perform( const STRING &backupPath );
 };
 
+/*
+	the time a thread spent in each stage. Each profile is written by its
+	own thread only and read after the threads have finished.
+*/
+class StageProfile
+{
+	struct TraceEvent
+	{
+		ProfileStage	stage;
+		int64			start, duration;	// microseconds since s_profileEpoch
+	};
+
+	const char					*m_name;
+	ProfileClock::time_point	m_start, m_stop;
+	int64						m_nanos[psNumStages];
+	uint64						m_calls[psNumStages];
+	std::vector<TraceEvent>		m_events;
+
+	public:
+	static bool					s_trace;
+
+	StageProfile() : m_name("")
+	{
+		for( int i=0; i<psNumStages; ++i )
+		{
+			m_nanos[i] = 0;
+			m_calls[i] = 0;
+		}
+	}
+	void setName( const char *name )
+	{
+		m_name = name;
+	}
+	void start()
+	{
+		m_stop = m_start = ProfileClock::now();
+	}
+	void stop()
+	{
+		m_stop = ProfileClock::now();
+	}
+	void add( ProfileStage stage, ProfileClock::time_point start, ProfileClock::time_point end )
+	{
+		int64	nanos = std::chrono::duration_cast<std::chrono::nanoseconds>( end - start ).count();
+
+		m_nanos[stage] += nanos;
+		m_calls[stage]++;
+		if( s_trace && nanos >= TRACE_MIN_MICROS*1000 )
+		{
+			TraceEvent	event = {
+				stage,
+				std::chrono::duration_cast<std::chrono::microseconds>( start - s_profileEpoch ).count(),
+				nanos/1000
+			};
+			m_events.push_back( event );
+		}
+	}
+
+	void print( std::ostream &out ) const;
+	void writeTrace( std::ostream &out, int tid, bool *first ) const;
+};
+
+class ProfileScope
+{
+	StageProfile				&m_profile;
+	ProfileStage				m_stage;
+	ProfileClock::time_point	m_start;
+
+	public:
+	ProfileScope( StageProfile &profile, ProfileStage stage )
+	: m_profile(profile), m_stage(stage), m_start(ProfileClock::now())
+	{
+	}
+	~ProfileScope()
+	{
+		m_profile.add( m_stage, m_start, ProfileClock::now() );
+	}
+};
+
+/*
+	merges the sorted runs of one collector into one sorted stream
+*/
+class MergedRunReader
+{
+	struct RunCursor
+	{
+		std::ifstream	stream;
+		SortedEntry		current;
+		bool			valid;
+
+		RunCursor( const STRING &runFile ) : stream( runFile, std::ios_base::binary ), valid(false)
+		{
+			next();
+		}
+		void next()
+		{
+			valid = stream && stream.peek() != EOF;
+			if( valid )
+			{
+				current.fromBinaryStream( stream );
+			}
+		}
+	};
+
+	std::vector< std::unique_ptr<RunCursor> >	m_runs;
+	RunCursor									*m_current;
+
+	void selectNext();
+
+	public:
+	MergedRunReader( const ArrayOfStrings &runFiles );
+
+	bool isValid() const
+	{
+		return m_current != nullptr;
+	}
+	const SortedEntry &current() const
+	{
+		return m_current->current;
+	}
+	void next()
+	{
+		m_current->next();
+		selectNext();
+	}
+
+	const SortedEntry *find( const F_STRING &relPath );
+};
+
 class CollectorBase : public Thread
 {
 	protected:
 	DirectoryQueue		m_fileQueue;
 	std::size_t			m_count, m_errorCount, m_maxQueueLen;
+	StageProfile		m_profile;
+
+	void pushEntry( const DirectoryEntry &entry, unsigned sleepTime )
+	{
+		{
+			ProfileScope	scope( m_profile, psQueue );
+			m_fileQueue.push( entry );
+		}
+		if( m_maxQueueLen && m_fileQueue.size() >= m_maxQueueLen )
+		{
+			ProfileScope	scope( m_profile, psWait );
+			while( m_fileQueue.size() >= m_maxQueueLen )
+			{
+				Sleep( sleepTime );
+			}
+		}
+	}
 
 	public:
 	CollectorBase( std::size_t maxQueueLen )
@@ -194,6 +497,10 @@ class CollectorBase : public Thread
 	{
 		return getLocker().getLockedBy();
 	}
+	const StageProfile &getProfile() const
+	{
+		return m_profile;
+	}
 };
 
 class CollectorThread : public CollectorBase
@@ -205,15 +512,33 @@ class CollectorThread : public CollectorBase
 	DateTime	  	m_latestDate;
 	F_STRING		m_latestFile;
 
+	std::size_t					m_runSize;
+	char						m_runTag;
+	std::vector<SortedEntry>	m_runBuffer;
+	ArrayOfStrings				m_runFiles;
+	bool						m_runsComplete;
+	mutable std::mutex			m_runsMutex;
+	mutable std::condition_variable	m_runsDone;
+
+	const ChangedPaths			*m_changes;
+
 	void scanDirectory( const STRING &dir, const F_STRING &excludes );
+	void collectChanges();
+	void flushRun();
 
 	public:
-	CollectorThread( const STRING &sourcePath, const STRING &excludes, std::size_t maxQueueLen )
-	: CollectorBase( maxQueueLen ), m_sourcePath( sourcePath ), m_excludes(excludes), m_latestDate( time_t(0) )
+	CollectorThread(
+		const STRING &sourcePath, const STRING &excludes, std::size_t maxQueueLen,
+		std::size_t runSize, char runTag, const ChangedPaths *changes
+	)
+	: CollectorBase( maxQueueLen ), m_sourcePath( sourcePath ), m_excludes(excludes), m_latestDate( time_t(0) ),
+	m_runSize( runSize ), m_runTag( runTag ), m_runsComplete( false ), m_changes( changes )
 	{
 		doEnterFunctionEx(gakLogging::llDetail,"CollectorThread::CollectorThread");
+		m_profile.setName( runTag == 's' ? "SrcCollector" : "DstCollector" );
 		StartThread("CollectorThread");
 	}
+	~CollectorThread();
 
 	virtual void ExecuteThread();
 
@@ -221,6 +546,17 @@ class CollectorThread : public CollectorBase
 	{
 		return m_sourcePath;
 	}
+	bool isMergeMode() const
+	{
+		return m_runSize != 0;
+	}
+	/// waits until all sorted runs are written, the result remains valid until destruction
+	const ArrayOfStrings &waitForRuns() const
+	{
+		std::unique_lock<std::mutex>	lock( m_runsMutex );
+		m_runsDone.wait( lock, [this] { return m_runsComplete; } );
+		return m_runFiles;
+	}
 	const DirectoryEntry *findElement( const DirectoryEntry *other )
 	{
 		return m_completeList.findElement( *other );
@@ -282,6 +618,7 @@ class CopyFilterThread : public CollectorBase
 	m_fatalMailMode(fatalMailMode),
 	m_checkCount(0)
 	{
+		m_profile.setName( "CopyFilter" );
 		StartThread("CopyFilterThread");
 	}
 	virtual void ExecuteThread();
@@ -295,7 +632,10 @@ class CopyFilterThread : public CollectorBase
 	}
 	const STRING &getBackupPath( bool useLatest ) const
 	{
-		Thread::joinOtherThread( m_theDstCollector );
+		if( m_theDstCollector->isMergeMode() )
+			m_theDstCollector->waitForRuns();
+		else
+			Thread::joinOtherThread( m_theDstCollector );
 		return m_theDstCollector->getBackupPath(useLatest);
 	}
 	std::size_t getCheckCount() const
@@ -312,10 +652,14 @@ class DeleteFilterThread : public CollectorBase
 	STRING		m_sourcePath;
 	bool		m_compareMode;
 
-	bool exists( const STRING &sourceFile )
+	std::unique_ptr<MergedRunReader>	m_srcRuns;
+
+	bool exists( const STRING &sourceFile, const F_STRING &relPath )
 	{
 		bool	result;
-		if( m_theSrcCollector )
+		if( m_srcRuns )
+			result = m_srcRuns->find( relPath );
+		else if( m_theSrcCollector )
 			result = m_theSrcCollector->findElement( sourceFile );
 		else
 			result = ::exists( sourceFile );
@@ -335,6 +679,7 @@ class DeleteFilterThread : public CollectorBase
 	m_sourcePath( src ),
 	m_compareMode(compareMode)
 	{
+		m_profile.setName( "DeleteFilter" );
 		StartThread("DeleteFilterThread");
 	}
 	virtual void ExecuteThread();
@@ -348,7 +693,10 @@ class DeleteFilterThread : public CollectorBase
 	}
 	const STRING &getBackupPath( bool useLatest ) const
 	{
-		Thread::joinOtherThread( m_theDstCollector );
+		if( m_theDstCollector->isMergeMode() )
+			m_theDstCollector->waitForRuns();
+		else
+			Thread::joinOtherThread( m_theDstCollector );
 		return m_theDstCollector->getBackupPath(useLatest);
 	}
 };
@@ -356,8 +704,10 @@ class DeleteFilterThread : public CollectorBase
 class CopyThread : public Thread
 {
 	std::clock_t								m_startTick;
-	std::size_t	  								m_count, m_errorCount, m_aclErrorCount;
+	std::size_t	  								m_count, m_errorCount, m_sparseCount;
 	SharedObjectPointer<CopyFilterThread>		m_filter;
+	DirectoryQueue								m_metaDataQueue;
+	StageProfile								m_profile;
 	bool										m_archiveMode;
 	bool										m_fatalMailMode;
 	TreeCreator									*m_theTreeCreator;
@@ -373,12 +723,24 @@ class CopyThread : public Thread
 		return false;
 	}
 	private:
+	bool sparseCopy( const STRING &src, const STRING &dest );
+	void copyData( const STRING &src, const STRING &dest )
+	{
+		if( sparseCopy( src, dest ) )
+		{
+			m_sparseCount++;
+		}
+		else
+		{
+			::fcopy( src, dest, *this );
+		}
+	}
 	void fcopy( const STRING &src, const STRING &dest )
 	{
 		FileID	srcID = getFileID( src );
 		if( !srcID )
 		{
-			::fcopy( src, dest, *this );
+			copyData( src, dest );
 		}
 		else
 		{
@@ -391,7 +753,7 @@ class CopyThread : public Thread
 			else
 			{
 				m_copiedFiles[srcID] = dest;
-				::fcopy( src, dest, *this );
+				copyData( src, dest );
 			}
 		}
 	}
@@ -402,13 +764,14 @@ class CopyThread : public Thread
 		bool fatalMailMode,
 		TreeCreator *theTreeCreator
 	) : 
-	m_startTick(0), 
-	m_count(0), m_errorCount(0), m_aclErrorCount(0), 
-	m_filter(theFilter), 
+	m_startTick(0),
+	m_count(0), m_errorCount(0), m_sparseCount(0),
+	m_filter(theFilter),
 	m_archiveMode(archiveMode), m_fatalMailMode(fatalMailMode), 
 	m_theTreeCreator(theTreeCreator), 
 	m_permille(0), m_totalBytes(0)
 	{
+		m_profile.setName( "CopyThread" );
 		StartThread("CopyThread");
 	}
 	virtual void ExecuteThread();
@@ -421,9 +784,33 @@ class CopyThread : public Thread
 	{
 		return m_errorCount;
 	}
-	std::size_t getAclErrorCount() const
+	std::size_t getSparseCount() const
+	{
+		return m_sparseCount;
+	}
+	const STRING &getSource() const
+	{
+		return m_filter->getSource();
+	}
+	const STRING &getDestination() const
+	{
+		return m_filter->getDestination();
+	}
+	const DirectoryQueue &getQueue() const
+	{
+		return m_metaDataQueue;
+	}
+	DirectoryQueue &getQueue()
+	{
+		return m_metaDataQueue;
+	}
+	int getLockCount() const
+	{
+		return m_metaDataQueue.getLocker().getLockCount();
+	}
+	const StageProfile &getProfile() const
 	{
-		return m_aclErrorCount;
+		return m_profile;
 	}
 	unsigned getPermille() const
 	{
@@ -465,6 +852,13 @@ class DeleteThread : public Thread
 	SharedObjectPointer<DeleteFilterThread>	m_filter;
 	TreeCreator								*m_theTreeCreator;
 	Stack<STRING>							m_directories;
+	TreeMap<F_STRING, bool>					m_changedDirectories;	// directories that lost entries
+	StageProfile							m_profile;
+
+	void directoryChanged( const STRING &path )
+	{
+		m_changedDirectories[path.leftString( path.searchRChar( DIRECTORY_DELIMITER ) )] = true;
+	}
 
 	public:
 	DeleteThread(
@@ -474,6 +868,7 @@ class DeleteThread : public Thread
 	)
 	: m_filter(filter), m_maxAge(maxAge), m_theTreeCreator(theTreeCreator)
 	{
+		m_profile.setName( "DeleteThread" );
 		StartThread("DeleteThread");
 	}
 	virtual void ExecuteThread();
@@ -486,7 +881,130 @@ class DeleteThread : public Thread
 	{
 		return m_directories;
 	}
+	/// valid after the thread has terminated
+	const TreeMap<F_STRING, bool> &getChangedDirectories() const
+	{
+		return m_changedDirectories;
+	}
+	const StageProfile &getProfile() const
+	{
+		return m_profile;
+	}
+};
+
+class MetaDataThread;
+
+/*
+	entries of one source directory, handled by one metadata worker
+*/
+struct MetaDataBatch
+{
+	MetaDataThread			*owner;
+	Array<DirectoryEntry>	entries;
+
+	MetaDataBatch( MetaDataThread *owner ) : owner( owner )
+	{
+	}
+};
+typedef SharedPointer<MetaDataBatch>	MetaDataBatchPtr;
+
+/*
+	applies ownership, ACLs, extended attributes and directory timestamps
+	to the entries the CopyThread has written. The files are grouped by
+	their directory and handed to a pool of workers. Directories whose
+	contents were created, copied or deleted are processed at the end,
+	after the copy and the delete stage have finished, so that their
+	timestamps are not changed again by their contents.
+*/
+class MetaDataThread : public Thread
+{
+	std::size_t								m_count, m_errorCount;
+	SharedObjectPointer<CopyThread>			m_copier;
+	SharedObjectPointer<DeleteThread>		m_deleter;
+	Stack<DirectoryEntry>					m_directories;
+	TreeMap<F_STRING, bool>					m_changedDirectories;	// relative path -> still to do
+	std::ofstream							m_errFile;
+	Critical								m_workerCritical;
+	StageProfile							m_profile, m_workerProfile;
+
+	bool copyMetaData(
+		const DirectoryEntry &theSourceEntry, const STRING &theDestFile,
+		std::ostream &errFile
+	);
+	void directoryChanged( const STRING &directory );
+
+	public:
+	MetaDataThread(
+		SharedObjectPointer<CopyThread> copier,
+		SharedObjectPointer<DeleteThread> deleter
+	)
+	: m_count(0), m_errorCount(0), m_copier(copier), m_deleter(deleter)
+	{
+		m_profile.setName( "MetaDataThread" );
+		m_workerProfile.setName( "MetaDataPool" );
+		StartThread("MetaDataThread");
+	}
+	virtual void ExecuteThread();
+
+	void processBatch( const MetaDataBatch &batch );
+
+	std::size_t getCount() const
+	{
+		return m_count;
+	}
+	std::size_t getErrorCount() const
+	{
+		return m_errorCount;
+	}
+	const Stack<DirectoryEntry> &getDirectoryStack() const
+	{
+		return m_directories;
+	}
+	const StageProfile &getProfile() const
+	{
+		return m_profile;
+	}
+	const StageProfile &getWorkerProfile() const
+	{
+		return m_workerProfile;
+	}
+};
+
+namespace gak
+{
+	template <>
+	struct ProcessorType<MetaDataBatchPtr>
+	{
+		typedef MetaDataBatchPtr object_type;
+
+		void process( const MetaDataBatchPtr &batch, void *pool, void *mainData )
+		{
+			batch->owner->processBatch( *batch );
+		}
+	};
+}
+
+#if WATCH_MODE
+/*
+	watches the source tree with inotify and collects the changed paths
+*/
+class SourceWatcher
+{
+	int						m_fd;
+	STRING					m_sourcePath;
+	F_STRING				m_excludes;
+	std::map<int, F_STRING>	m_watches;		// watch descriptor -> relative path
+
+	void addWatches( const F_STRING &relPath );
+	void removeWatches( const F_STRING &relPath );
+
+	public:
+	SourceWatcher( const STRING &sourcePath, const F_STRING &excludes );
+	~SourceWatcher();
+
+	bool collect( ChangedPaths *changes, unsigned debounce );
 };
+#endif
 
 class CheckSumThread : public Thread
 {
@@ -510,6 +1028,8 @@ class CheckSumThread : public Thread
 // ----- class static data --------------------------------------------- //
 // --------------------------------------------------------------------- //
 
+bool StageProfile::s_trace = false;
+
 // --------------------------------------------------------------------- //
 // ----- prototypes ---------------------------------------------------- //
 // --------------------------------------------------------------------- //
@@ -531,6 +1051,45 @@ inline STRING getDestFilePath(
 	return destFilePath;
 }
 
+template <typename QueueT>
+inline bool profiledWait( QueueT &queue, StageProfile &profile )
+{
+	ProfileScope	scope( profile, psWait );
+	return queue.wait( 2000 );
+}
+
+template <typename QueueT>
+inline bool profiledPWait( QueueT &queue, StageProfile &profile )
+{
+	ProfileScope	scope( profile, psWait );
+	return queue.pwait( 2000 );
+}
+
+template <typename QueueT>
+inline DirectoryEntry profiledPop( QueueT &queue, StageProfile &profile )
+{
+	ProfileScope	scope( profile, psQueue );
+	return queue.pop();
+}
+
+static bool isExcluded( const STRING &file, const F_STRING &excludes )
+{
+	doEnterFunctionEx(gakLogging::llDetail,"isExcluded");
+
+	std::size_t	slashPos = file.searchRChar( DIRECTORY_DELIMITER );
+	if( excludes.isEmpty() || slashPos == file.no_index )
+	{
+		return false;
+	}
+
+	ArrayOfStrings	excludeList;
+	STRING			excludesPath = file.leftString( slashPos ) + DIRECTORY_DELIMITER + excludes;
+	excludeList.readFromFile( excludesPath );
+
+	return excludeList.size()
+		&& excludeList.findElement( STRING( (const char *)file + slashPos + 1 ) ) != excludeList.no_index;
+}
+
 static void removeTree( const STRING &tree )
 {
 	doEnterFunctionEx(gakLogging::llInfo,"removeTree");
@@ -686,7 +1245,8 @@ static void deleteOldBackups( const STRING &destination, int maxAge, bool create
 static void mirror(
 	const STRING &source, const STRING &destination,
 	int maxAge, bool fatalMailMode, bool createTree, bool doLog, bool compareMode,
-	std::size_t maxQueueLen
+	std::size_t maxQueueLen, std::size_t runSize, const ChangedPaths *changes,
+	const STRING &traceFile
 )
 {
 	doEnterFunctionEx(gakLogging::llInfo, "mirror" );
@@ -710,21 +1270,23 @@ static void mirror(
 
 
 	SharedObjectPointer<CollectorThread>	theSourceCollector = new CollectorThread(
-		source, ".mirrorExcludes", maxQueueLen
+		source, EXCLUDES_FILE, maxQueueLen, runSize, 's', changes
 	);
 	SharedObjectPointer<CollectorThread>	theDestCollector = new CollectorThread(
-		destination, nullptr, maxQueueLen
+		destination, nullptr, maxQueueLen, runSize, 'd', changes
 	);
 
+	// with sorted runs, the filters merge both sides and need no stat calls
+	const bool	joinCollectors = !maxQueueLen || runSize;
 
 	SharedObjectPointer<DeleteFilterThread>	theDeleteFilter = new DeleteFilterThread(
-		maxQueueLen ? SharedObjectPointer<CollectorThread>() : theSourceCollector,
+		joinCollectors ? theSourceCollector : SharedObjectPointer<CollectorThread>(),
 		theDestCollector,
 		source, compareMode, maxQueueLen
 	);
 	SharedObjectPointer<CopyFilterThread>		theCopyFilter = new CopyFilterThread(
 		theSourceCollector,
-		maxQueueLen ? SharedObjectPointer<CollectorThread>() : theDestCollector,
+		joinCollectors ? theDestCollector : SharedObjectPointer<CollectorThread>(),
 		destination, maxAge > 0, compareMode, fatalMailMode, maxQueueLen
 	);
 
@@ -736,12 +1298,18 @@ static void mirror(
 		theCopyFilter, maxAge > 0, fatalMailMode, theTreeCreator.get()
 	);
 
+	SharedObjectPointer<MetaDataThread>		theMetaConsumer = new MetaDataThread(
+		theCopyConsumer, theDeleteConsumer
+	);
+
 	const DirectoryQueue	&destQueue = theDestCollector->getQueue();
 	const DirectoryQueue	&deleteQueue = theDeleteFilter->getQueue();
 	const Stack<STRING>		&directoryList = theDeleteConsumer->getDirectoryStack();
 
 	const DirectoryQueue	&sourceQueue = theSourceCollector->getQueue();
 	const DirectoryQueue	&copyQueue = theCopyFilter->getQueue();
+	const DirectoryQueue	&metaQueue = theCopyConsumer->getQueue();
+	const Stack<DirectoryEntry>	&metaDirectoryList = theMetaConsumer->getDirectoryStack();
 
 	if( compareMode )
 		std::cout << "check  " << source << std::endl;
@@ -750,7 +1318,7 @@ static void mirror(
     std::cout << "to     " << destination << std::endl;
     std::cout << "id     " << GetCurrentProcessId() << std::endl;
 
-	if( maxAge > 0 )
+	if( maxAge > 0 && !changes )
 	{
 		std::cout << "Removing old backups" << std::endl;
 		deleteOldBackups( destination, maxAge, createTree );
@@ -759,13 +1327,13 @@ static void mirror(
 	Eta<>	delEtaCalculator;
 	Eta<>	checkEtaCalculator;
 	Eta<>	copyEtaCalculator;
-	while( theCopyConsumer->isRunning || theDeleteConsumer->isRunning )
+	while( theCopyConsumer->isRunning || theMetaConsumer->isRunning || theDeleteConsumer->isRunning )
 	{
 		if( !deleteTime && !theDeleteConsumer->isRunning )
 		{
 			deleteTime = sw.get< Seconds<> >().asSeconds();
 		}
-		if( !copyTime && !theCopyConsumer->isRunning )
+		if( !copyTime && !theCopyConsumer->isRunning && !theMetaConsumer->isRunning )
 		{
 			copyTime = sw.get< Seconds<> >().asSeconds();
 		}
@@ -809,7 +1377,14 @@ static void mirror(
 			std::setw( LOCK_WIDTH ) << theCopyFilter->getLockCount() <<
 			'/' <<
 			(theCopyConsumer->isRunning ? "CT" : "ct") <<
-			(theCopyConsumer->isWaiting ? 'W' : '_')
+			(theCopyConsumer->isWaiting ? 'W' : '_') <<
+			'/' <<
+			std::setw( COUNT_WIDTH ) << (metaQueue.size()+metaDirectoryList.size()) <<
+			'/' <<
+			std::setw( LOCK_WIDTH ) << theCopyConsumer->getLockCount() <<
+			'/' <<
+			(theMetaConsumer->isRunning ? "MT" : "mt") <<
+			(theMetaConsumer->isWaiting ? 'W' : '_')
 		;
 		if( lastCopySize == copySize && (copySize || theCopyConsumer->getPermille()) )
 		{
@@ -909,22 +1484,70 @@ static void mirror(
 			"\nPer sec   : " << theDestCollector->getCount() / deleteTime << '/' << theSourceCollector->getCount() / copyTime <<
 			"\nDeleted   : " << theDeleteConsumer->getCount() <<
 			"\nCopied    : " << theCopyConsumer->getCount() <<
+			"\nSparse    : " << theCopyConsumer->getSparseCount() <<
 			"\nErrors    : " << theCopyConsumer->getErrorCount() <<
-			"\nACL Errors: " << theCopyConsumer->getAclErrorCount() <<
+			"\nMeta Data : " << theMetaConsumer->getCount() <<
+			"\nACL Errors: " << theMetaConsumer->getErrorCount() <<
 			std::endl
 		;
 	}
-}
 
-static int mirror( const CommandLine &cmdLine )
-{
-	doEnterFunctionEx(gakLogging::llInfo, "mirror( const CommandLine &cmdLine )" );
+	const StageProfile *profiles[] =
+	{
+		&theDestCollector->getProfile(),
+		&theDeleteFilter->getProfile(),
+		&theDeleteConsumer->getProfile(),
+		&theSourceCollector->getProfile(),
+		&theCopyFilter->getProfile(),
+		&theCopyConsumer->getProfile(),
+		&theMetaConsumer->getProfile(),
+		&theMetaConsumer->getWorkerProfile()
+	};
+	const int numProfiles = int(sizeof(profiles)/sizeof(profiles[0]));
+
+	std::cout << "\nProfile (ms)  ";
+	for( int i=0; i<psNumStages; ++i )
+	{
+		std::cout << std::setw(9) << s_stageNames[i];
+	}
+	std::cout << std::setw(9) << "other" << std::setw(9) << "wall" << '\n';
+	for( int i=0; i<numProfiles; ++i )
+	{
+		profiles[i]->print( std::cout );
+	}
+	std::cout << std::flush;
+
+	if( !traceFile.isEmpty() )
+	{
+		std::ofstream	trace( traceFile );
+		bool			first = true;
+
+		trace << "{\"traceEvents\":[";
+		for( int i=0; i<numProfiles; ++i )
+		{
+			profiles[i]->writeTrace( trace, i+1, &first );
+		}
+		trace << "\n]}\n";
+		if( !trace )
+		{
+			std::cerr << "Cannot write " << traceFile << std::endl;
+		}
+	}
+}
+
+static int mirror( const CommandLine &cmdLine )
+{
+	doEnterFunctionEx(gakLogging::llInfo, "mirror( const CommandLine &cmdLine )" );
 
 	int			maxAge = 0;
 	std::size_t	maxQueueLen = 0;
+	std::size_t	runSize = 0;
+	unsigned	debounce = DEF_DEBOUNCE;
+	STRING		traceFile;
 	bool		createTree;
 	bool		doLog;
 	bool		doCompare;
+	bool		doWatch;
 
 	if( cmdLine.flags & OPT_MAX_AGE )
 	{
@@ -934,9 +1557,30 @@ static int mirror( const CommandLine &cmdLine )
 	{
 		maxQueueLen = cmdLine.parameter[CHAR_MAX_QUEUE][0].getValueE<std::size_t>();
 	}
+	if( cmdLine.flags & OPT_RUN_SIZE )
+	{
+		runSize = cmdLine.parameter[CHAR_RUN_SIZE][0].getValueE<std::size_t>();
+	}
+	if( cmdLine.flags & OPT_DEBOUNCE )
+	{
+		debounce = cmdLine.parameter[CHAR_DEBOUNCE][0].getValueE<unsigned>();
+	}
+	if( cmdLine.flags & OPT_TRACE_FILE )
+	{
+		traceFile = cmdLine.parameter[CHAR_TRACE_FILE][0];
+		StageProfile::s_trace = true;
+	}
 	doLog = cmdLine.flags & FLAG_DO_LOG;
 	doCompare = cmdLine.flags & FLAG_DO_COMPARE;
 	createTree = cmdLine.flags & FLAG_CREATE_TREE;
+	doWatch = cmdLine.flags & FLAG_WATCH;
+
+	if( doWatch && doCompare )
+		throw CmdlineError( "Watch mode and compare mode are not allowed." );
+#if !WATCH_MODE
+	if( doWatch )
+		throw CmdlineError( "Watch mode is not supported on this system." );
+#endif
 
 	if( cmdLine.argc != 3 )
 		throw CmdlineError();
@@ -952,20 +1596,62 @@ static int mirror( const CommandLine &cmdLine )
 	}
 	else if( !maxAge )
 		createTree = false;
-	else
+	else if( !runSize )
 		maxQueueLen = 0;
 
+	if( runSize && !maxQueueLen )
+	{
+		// the sorted runs replace the complete lists, keep the queues small
+		maxQueueLen = DEF_MERGE_QUEUE_LEN;
+	}
+
 	if( source[source.strlen()-1] == DIRECTORY_DELIMITER )
 		source.cut( source.strlen() -1 );
 
 	if( destination[destination.strlen()-1] == DIRECTORY_DELIMITER )
 		destination.cut( destination.strlen() -1 );
 
+#if WATCH_MODE
+	// start watching before the initial run, so that we do not miss anything
+	std::unique_ptr<SourceWatcher>	watcher;
+	if( doWatch )
+	{
+		watcher.reset( new SourceWatcher( source, EXCLUDES_FILE ) );
+	}
+#endif
+
 	mirror(
 		source, destination,
-		maxAge, cmdLine.flags & FLAG_FATAL_MAIL, createTree, doLog, doCompare, maxQueueLen
+		maxAge, cmdLine.flags & FLAG_FATAL_MAIL, createTree, doLog, doCompare, maxQueueLen, runSize,
+		nullptr, traceFile
 	);
 
+#if WATCH_MODE
+	while( watcher )
+	{
+		ChangedPaths	changes;
+		if( watcher->collect( &changes, debounce ) )
+		{
+			std::cout << "\nChanged   : " << changes.size() << std::endl;
+			// the change lists are small, the filters can use the complete lists
+			mirror(
+				source, destination,
+				maxAge, cmdLine.flags & FLAG_FATAL_MAIL, false, doLog, false, 0, 0,
+				&changes, traceFile
+			);
+		}
+		else
+		{
+			std::cout << "\nToo many changes, full mirror" << std::endl;
+			mirror(
+				source, destination,
+				maxAge, cmdLine.flags & FLAG_FATAL_MAIL, false, doLog, false, maxQueueLen, runSize,
+				nullptr, traceFile
+			);
+		}
+	}
+#endif
+
 	return EXIT_SUCCESS;
 }
 
@@ -977,6 +1663,52 @@ static int mirror( const CommandLine &cmdLine )
 // ----- class constructors/destructors -------------------------------- //
 // --------------------------------------------------------------------- //
 
+MergedRunReader::MergedRunReader( const ArrayOfStrings &runFiles ) : m_current(nullptr)
+{
+	doEnterFunctionEx(gakLogging::llInfo,"MergedRunReader::MergedRunReader");
+	for(
+		ArrayOfStrings::const_iterator it = runFiles.cbegin(), endIT = runFiles.cend();
+		it != endIT;
+		++it
+	)
+	{
+		m_runs.push_back( std::unique_ptr<RunCursor>( new RunCursor( *it ) ) );
+	}
+	selectNext();
+}
+
+#if WATCH_MODE
+SourceWatcher::SourceWatcher( const STRING &sourcePath, const F_STRING &excludes )
+: m_sourcePath( sourcePath ), m_excludes( excludes )
+{
+	doEnterFunctionEx(gakLogging::llInfo,"SourceWatcher::SourceWatcher");
+
+	m_fd = inotify_init1( IN_CLOEXEC );
+	if( m_fd < 0 )
+	{
+		throw std::runtime_error( std::string( "inotify: " ) + strerror( errno ) );
+	}
+	addWatches( NULL_STRING );
+}
+
+SourceWatcher::~SourceWatcher()
+{
+	close( m_fd );
+}
+#endif
+
+CollectorThread::~CollectorThread()
+{
+	for(
+		ArrayOfStrings::const_iterator it = m_runFiles.cbegin(), endIT = m_runFiles.cend();
+		it != endIT;
+		++it
+	)
+	{
+		strRemove( *it );
+	}
+}
+
 // --------------------------------------------------------------------- //
 // ----- class static functions ---------------------------------------- //
 // --------------------------------------------------------------------- //
@@ -985,6 +1717,307 @@ static int mirror( const CommandLine &cmdLine )
 // ----- class privates ------------------------------------------------ //
 // --------------------------------------------------------------------- //
 
+void MergedRunReader::selectNext()
+{
+	m_current = nullptr;
+	for( std::size_t i=0; i<m_runs.size(); ++i )
+	{
+		RunCursor	*run = m_runs[i].get();
+		if( run->valid && (!m_current || run->current < m_current->current) )
+		{
+			m_current = run;
+		}
+	}
+}
+
+/*
+	copies only the data regions of a sparse file and leaves the holes
+	unallocated. Returns false, if the file is not sparse or the system
+	cannot tell, the caller uses the normal fcopy then.
+*/
+bool CopyThread::sparseCopy( const STRING &src, const STRING &dest )
+{
+#if SPARSE_COPY
+	doEnterFunctionEx(gakLogging::llDetail,"CopyThread::sparseCopy");
+
+	int	srcFD = open( src, O_RDONLY );
+	if( srcFD < 0 )
+	{
+		return false;
+	}
+
+	struct stat	srcStat;
+	if( fstat( srcFD, &srcStat ) || !S_ISREG( srcStat.st_mode )
+	|| off_t(srcStat.st_blocks) * 512 >= srcStat.st_size )
+	{
+		close( srcFD );
+		return false;
+	}
+
+	int	destFD = open( dest, O_WRONLY|O_CREAT|O_TRUNC, srcStat.st_mode & 07777 );
+	if( destFD < 0 )
+	{
+		close( srcFD );
+		return false;
+	}
+
+	const off_t				fileSize = srcStat.st_size;
+	std::unique_ptr<char[]>	buffer( new char[SPARSE_BUFFER_SIZE] );
+	const char				*error = nullptr;
+	off_t					dataStart = 0;
+
+	while( !error && dataStart < fileSize )
+	{
+		dataStart = lseek( srcFD, dataStart, SEEK_DATA );
+		if( dataStart < 0 )
+		{
+			if( errno != ENXIO )	// ENXIO: no more data, only a hole
+				error = "SEEK_DATA";
+			break;
+		}
+		off_t	dataEnd = lseek( srcFD, dataStart, SEEK_HOLE );
+		if( dataEnd < 0 )
+		{
+			error = "SEEK_HOLE";
+			break;
+		}
+
+		while( dataStart < dataEnd )
+		{
+			std::size_t	toRead = std::size_t(
+				std::min( off_t(SPARSE_BUFFER_SIZE), dataEnd - dataStart )
+			);
+			ssize_t	numRead = pread( srcFD, buffer.get(), toRead, dataStart );
+			if( numRead <= 0 )
+			{
+				error = "read";
+				break;
+			}
+			if( pwrite( destFD, buffer.get(), numRead, dataStart ) != numRead )
+			{
+				error = "write";
+				break;
+			}
+			dataStart += numRead;
+
+			// the meter sees the data bytes only
+			(*this)( unsigned( dataStart * 1000 / fileSize ), std::size_t(numRead) );
+		}
+	}
+
+	// a trailing hole does not extend the file by itself
+	if( !error && ftruncate( destFD, fileSize ) )
+	{
+		error = "truncate";
+	}
+	// the mode of open is reduced by the umask and ignored for an existing file
+	if( !error && fchmod( destFD, srcStat.st_mode & 07777 ) )
+	{
+		error = "mode";
+	}
+	if( !error )
+	{
+#ifdef __APPLE__
+		struct timespec	times[2] = { srcStat.st_atimespec, srcStat.st_mtimespec };
+#else
+		struct timespec	times[2] = { srcStat.st_atim, srcStat.st_mtim };
+#endif
+		if( futimens( destFD, times ) )
+			error = "time";
+	}
+
+	int	errorCode = errno;
+	close( srcFD );
+	if( close( destFD ) && !error )
+	{
+		errorCode = errno;
+		error = "close";
+	}
+
+	if( error )
+	{
+		throw std::runtime_error(
+			std::string( "sparse copy " ) + error + ' ' + (const char *)dest + ": " + strerror( errorCode )
+		);
+	}
+
+	return true;
+#else
+	return false;
+#endif
+}
+
+#if WATCH_MODE
+void SourceWatcher::addWatches( const F_STRING &relPath )
+{
+	doEnterFunctionEx(gakLogging::llDetail,"SourceWatcher::addWatches");
+
+	const STRING	dir = m_sourcePath + relPath;
+	// IN_MODIFY for files that are written but kept open, e.g. logs
+	const uint32_t	mask = IN_MODIFY|IN_CLOSE_WRITE|IN_CREATE|IN_DELETE|IN_MOVED_FROM|IN_MOVED_TO|IN_ATTRIB|IN_ONLYDIR;
+
+	int	wd = inotify_add_watch( m_fd, dir, mask );
+	if( wd < 0 )
+	{
+		if( errno == ENOSPC )
+			throw std::runtime_error( "inotify: too many directories, increase fs.inotify.max_user_watches" );
+
+		s_logStrings.push( STRING("Cannot watch ") + dir + ": " + strerror( errno ) );
+		return;
+	}
+	m_watches[wd] = relPath;
+
+	DirectoryList	dirList;
+	try
+	{
+		dirList.dirlist( dir );
+	}
+	catch( std::exception &e )
+	{
+		s_logStrings.push( e.what() );
+	}
+	for(
+		DirectoryList::const_iterator it = dirList.cbegin(), endIT = dirList.cend();
+		it != endIT;
+		++it
+	)
+	{
+		const STRING	&file = it->fileName;
+		if( it->directory && file != "." && file != ".." )
+		{
+			F_STRING	subPath = relPath + DIRECTORY_DELIMITER + file;
+			if( !isExcluded( m_sourcePath + subPath, m_excludes ) )
+			{
+				addWatches( subPath );
+			}
+		}
+	}
+}
+
+/// a directory deleted or moved away, its subdirectories are gone, too
+void SourceWatcher::removeWatches( const F_STRING &relPath )
+{
+	doEnterFunctionEx(gakLogging::llDetail,"SourceWatcher::removeWatches");
+
+	const F_STRING	subPath = relPath + DIRECTORY_DELIMITER;
+	for( std::map<int, F_STRING>::iterator it = m_watches.begin(); it != m_watches.end(); )
+	{
+		if( it->second == relPath || it->second.beginsWith( subPath ) )
+		{
+			inotify_rm_watch( m_fd, it->first );
+			it = m_watches.erase( it );
+		}
+		else
+		{
+			++it;
+		}
+	}
+}
+#endif
+
+/*
+	true, if a parent of relPath is a new directory that is read completely.
+	Parents are sorted before their contents, so they are known already.
+*/
+static bool isInScannedTree( F_STRING relPath, const ChangedPaths &scanned )
+{
+	std::size_t	slashPos;
+	while( (slashPos = relPath.searchRChar( DIRECTORY_DELIMITER )) != relPath.no_index && slashPos > 0 )
+	{
+		relPath = relPath.leftString( slashPos );
+		if( scanned.hasElement( relPath ) )
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+void CollectorThread::collectChanges()
+{
+	doEnterFunctionEx(gakLogging::llInfo,"CollectorThread::collectChanges");
+
+	ChangedPaths	scanned;
+	for(
+		ChangedPaths::const_iterator it = m_changes->cbegin(), endIT = m_changes->cend();
+		it != endIT;
+		++it
+	)
+	{
+		STRING	file = m_sourcePath + it->getKey();
+
+		// found by scanDirectory already
+		if( isInScannedTree( it->getKey(), scanned ) )
+		{
+			continue;
+		}
+		if( !exists( file ) || isExcluded( file, m_excludes ) )
+		{
+			continue;
+		}
+
+		DirectoryEntry	fileEntry;
+		{
+			ProfileScope	scope( m_profile, psStat );
+			fileEntry.findFile( file );
+		}
+		fileEntry.fileName = file;
+
+		if( !fileEntry.directory && fileEntry.modifiedDate > m_latestDate )
+		{
+			m_latestDate = fileEntry.modifiedDate;
+			m_latestFile = fileEntry.fileName;
+		}
+
+		m_completeList.addElement( fileEntry );
+		pushEntry( fileEntry, 1000 );
+		m_count++;
+
+		if( fileEntry.directory && it->getValue() )
+		{
+			scanDirectory( file, m_excludes );
+			scanned[it->getKey()] = true;
+		}
+	}
+}
+
+void CollectorThread::flushRun()
+{
+	doEnterFunctionEx(gakLogging::llInfo,"CollectorThread::flushRun");
+
+	if( m_runBuffer.size() )
+	{
+		std::sort( m_runBuffer.begin(), m_runBuffer.end() );
+
+		STRING	runFile = getTempPath() + DIRECTORY_DELIMITER + "mirror_";
+		runFile += formatNumber( GetCurrentProcessId() );
+		runFile += '_';
+		runFile += m_runTag;
+		runFile += '_';
+		runFile += formatNumber( m_runFiles.size() );
+		runFile += ".run";
+
+		std::ofstream	stream( runFile, std::ios_base::binary );
+		for(
+			std::vector<SortedEntry>::const_iterator it = m_runBuffer.begin(), endIT = m_runBuffer.end();
+			it != endIT;
+			++it
+		)
+		{
+			it->toBinaryStream( stream );
+		}
+		stream.close();
+		if( stream.fail() )
+		{
+			m_errorCount++;
+			s_logStrings.push( "Cannot write " + runFile );
+		}
+
+		m_runFiles.addElement( runFile );
+		m_runBuffer.clear();
+	}
+}
+
 void CollectorThread::scanDirectory( const STRING &dir, const F_STRING &excludes )
 {
 	doEnterFunctionEx(gakLogging::llDetail,"CollectorThread::scanDirectory");
@@ -994,6 +2027,7 @@ void CollectorThread::scanDirectory( const STRING &dir, const F_STRING &excludes
 
 	try
 	{
+		ProfileScope	scope( m_profile, psStat );
 		dirList.dirlist( dir );
 	}
 	catch( std::exception &e )
@@ -1041,12 +2075,20 @@ void CollectorThread::scanDirectory( const STRING &dir, const F_STRING &excludes
 				m_latestFile = fileEntry.fileName;
 			}
 
-			m_fileQueue.push( fileEntry );
-			m_completeList.addElement( fileEntry );
-
-			while( m_maxQueueLen && m_fileQueue.size() >= m_maxQueueLen )
+			if( m_runSize )
 			{
-				Sleep( 1000 );
+				m_runBuffer.push_back(
+					SortedEntry( getDestFilePath( newDir, m_sourcePath, NULL_STRING ), fileEntry )
+				);
+				if( m_runBuffer.size() >= m_runSize )
+				{
+					flushRun();
+				}
+			}
+			else
+			{
+				m_completeList.addElement( fileEntry );
+				pushEntry( fileEntry, 1000 );
 			}
 
 			m_count++;
@@ -1064,6 +2106,120 @@ void CollectorThread::scanDirectory( const STRING &dir, const F_STRING &excludes
 	}
 }
 
+void MetaDataThread::directoryChanged( const STRING &directory )
+{
+	m_changedDirectories[getDestFilePath( directory, m_copier->getSource(), NULL_STRING )] = true;
+}
+
+bool MetaDataThread::copyMetaData(
+	const DirectoryEntry &theSourceEntry, const STRING &theDestFile,
+	std::ostream &errFile
+)
+{
+	doEnterFunctionEx(gakLogging::llDetail,"MetaDataThread::copyMetaData");
+
+	const STRING	&theSourceFile = theSourceEntry.fileName;
+	bool			success = true;
+
+#ifndef _Windows
+	// chown clears the setuid and setgid bits, do it before the mode is copied
+	struct stat	srcStat;
+	if( !lstat( theSourceFile, &srcStat )
+	&& lchown( theDestFile, srcStat.st_uid, srcStat.st_gid )
+	&& errno != EPERM )		// only root may change the owner
+	{
+		success = false;
+		errFile << "chown " << theDestFile << ": " << strerror( errno ) << std::endl;
+	}
+#endif
+
+	try
+	{
+		copyACLs( theSourceFile, theDestFile );
+	}
+	catch( std::exception &e )
+	{
+		success = false;
+		errFile << "ACLs " << e.what() << std::endl;
+	}
+
+#ifndef _Windows
+	ssize_t	namesLen = llistxattr( theSourceFile, nullptr, 0 );
+	if( namesLen > 0 )
+	{
+		std::unique_ptr<char[]>	names( new char[namesLen] );
+		namesLen = llistxattr( theSourceFile, names.get(), namesLen );
+		for(
+			const char *name = names.get(), *endName = names.get() + (namesLen > 0 ? namesLen : 0);
+			name < endName;
+			name += strlen( name ) + 1
+		)
+		{
+			if( strncmp( name, "user.", 5 ) )
+			{
+				continue;		// system attributes (ACLs) are handled by copyACLs
+			}
+			ssize_t	valueLen = lgetxattr( theSourceFile, name, nullptr, 0 );
+			if( valueLen >= 0 )
+			{
+				std::unique_ptr<char[]>	value( new char[valueLen+1] );
+				valueLen = lgetxattr( theSourceFile, name, value.get(), valueLen );
+				if( valueLen < 0 || lsetxattr( theDestFile, name, value.get(), valueLen, 0 ) )
+				{
+					success = false;
+					errFile << "xattr " << name << ' ' << theDestFile << ": " << strerror( errno ) << std::endl;
+				}
+			}
+		}
+	}
+#endif
+
+	if( theSourceEntry.directory )
+	{
+		try
+		{
+			setModTime( theDestFile, time_t( theSourceEntry.modifiedDate.getUtcUnixSeconds() ) );
+		}
+		catch( std::exception &e )
+		{
+			success = false;
+			errFile << "Time " << e.what() << std::endl;
+		}
+	}
+
+	return success;
+}
+
+void MetaDataThread::processBatch( const MetaDataBatch &batch )
+{
+	doEnterFunctionEx(gakLogging::llDetail,"MetaDataThread::processBatch");
+
+	const STRING		&source = m_copier->getSource();
+	const STRING		&destination = m_copier->getDestination();
+	std::ostringstream	errors;
+	std::size_t			errorCount = 0;
+
+	const ProfileClock::time_point	start = ProfileClock::now();
+	for( std::size_t i=0; i<batch.entries.size(); ++i )
+	{
+		const DirectoryEntry	&theSourceEntry = batch.entries[i];
+		STRING theDestFile = getDestFilePath(
+			theSourceEntry.fileName, source, destination
+		);
+		if( !copyMetaData( theSourceEntry, theDestFile, errors ) )
+		{
+			errorCount++;
+		}
+	}
+	const ProfileClock::time_point	end = ProfileClock::now();
+
+	CriticalScope	scope( m_workerCritical );
+	m_workerProfile.add( psMeta, start, end );
+	m_count += batch.entries.size();
+	m_errorCount += errorCount;
+	m_errFile << errors.str();
+}
+
 // --------------------------------------------------------------------- //
 // ----- class protected ----------------------------------------------- //
 // --------------------------------------------------------------------- //
@@ -1076,9 +2232,30 @@ void CollectorThread::ExecuteThread()
 {
 	doEnterFunctionEx(gakLogging::llInfo,"CollectorThread::ExecuteThread");
 
+	m_profile.start();
 	m_count = 0;
-	scanDirectory( m_sourcePath, m_excludes );
+	if( m_changes )
+		collectChanges();
+	else
+		scanDirectory( m_sourcePath, m_excludes );
 	doLogValueEx( gakLogging::llInfo, m_count );
+
+	if( m_runSize )
+	{
+		flushRun();
+		{
+			std::lock_guard<std::mutex>	lock( m_runsMutex );
+			m_runsComplete = true;
+		}
+		m_runsDone.notify_all();
+
+		// now feed our filter in sorted order
+		for( MergedRunReader reader( m_runFiles ); reader.isValid(); reader.next() )
+		{
+			pushEntry( reader.current().toDirectoryEntry( m_sourcePath ), 1000 );
+		}
+	}
+	m_profile.stop();
 }
 
 
@@ -1102,7 +2279,13 @@ void CopyFilterThread::ExecuteThread()
 	bool		addFile;
 	STRING		reason;
 
-	if( m_theDstCollector )
+	std::unique_ptr<MergedRunReader>	dstRuns;
+	if( m_theDstCollector && m_theDstCollector->isMergeMode() )
+	{
+		doEnterFunctionEx(gakLogging::llDetail,"CopyFilterThread::ExecuteThread::waitForRuns");
+		dstRuns.reset( new MergedRunReader( m_theDstCollector->waitForRuns() ) );
+	}
+	else if( m_theDstCollector )
 	{
 		doEnterFunctionEx(gakLogging::llDetail,"CopyFilterThread::ExecuteThread::join");
 		join( m_theDstCollector );
@@ -1113,6 +2296,7 @@ void CopyFilterThread::ExecuteThread()
 
 	const STRING	&source = m_theSrcCollector->getSource();
 
+	m_profile.start();
 	while( m_theSrcCollector->isRunning || inputQueue.size() )
 	{
 		if( !m_theSrcCollector->isRunning && !inputLocked )
@@ -1121,12 +2305,12 @@ void CopyFilterThread::ExecuteThread()
 			inputLocked = true;
 		}
 		bool waited = false;
-		if( (inputQueue.size()>0) || (waited=inputQueue.pwait(2000))==true )
+		if( (inputQueue.size()>0) || (waited=profiledPWait(inputQueue, m_profile))==true )
 		{
 			doEnterFunctionEx(gakLogging::llDetail,"CopyFilterThread::ExecuteThread::processor");
 			addFile = false;
 			reason = nullptr;
-			DirectoryEntry theSourceEntry = inputQueue.pop();
+			DirectoryEntry theSourceEntry = profiledPop( inputQueue, m_profile );
 			const STRING &theSourceFile = theSourceEntry.fileName;
 			if( waited )
 			{
@@ -1137,9 +2321,26 @@ void CopyFilterThread::ExecuteThread()
 				theSourceFile, source, m_destinationPath
 			);
 
-			if( m_theDstCollector )
+			if( dstRuns )
+			{
+				doEnterFunctionEx(gakLogging::llDetail,"CopyFilterThread::ExecuteThread::merge");
+				ProfileScope	scope( m_profile, psStat );
+				const SortedEntry *tmp = dstRuns->find(
+					getDestFilePath( theSourceFile, source, NULL_STRING )
+				);
+				if( tmp )
+				{
+					theDestEntry = tmp->toDirectoryEntry( m_destinationPath );
+				}
+				else
+				{
+					addFile = true;
+				}
+			}
+			else if( m_theDstCollector )
 			{
 				doEnterFunctionEx(gakLogging::llDetail,"CopyFilterThread::ExecuteThread::findElement");
+				ProfileScope	scope( m_profile, psStat );
 				const DirectoryEntry *tmp = m_theDstCollector->findElement( theDestFile );
 				if( tmp )
 				{
@@ -1153,6 +2354,7 @@ void CopyFilterThread::ExecuteThread()
 			else
 			{
 				doEnterFunctionEx(gakLogging::llDetail,"CopyFilterThread::ExecuteThread::findFile");
+				ProfileScope	scope( m_profile, psStat );
 				theDestEntry.findFile( theDestFile );
 			}
 
@@ -1194,8 +2396,11 @@ void CopyFilterThread::ExecuteThread()
 					SharedObjectPointer<CheckSumThread> md5Source = new CheckSumThread( theSourceFile );
 					SharedObjectPointer<CheckSumThread> md5Dest = new CheckSumThread( theDestFile );
 
-					md5Source->join();
-					md5Dest->join();
+					{
+						ProfileScope	scope( m_profile, psHash );
+						md5Source->join();
+						md5Dest->join();
+					}
 
 					if( waitForThreads() )
 					{
@@ -1253,13 +2458,8 @@ void CopyFilterThread::ExecuteThread()
 			{
 				if( addFile )
 				{
-					m_fileQueue.push( theSourceEntry );
-
 					m_count++;
-					while( m_maxQueueLen && m_fileQueue.size() >= m_maxQueueLen )
-					{
-						Sleep( 10000 );
-					}
+					pushEntry( theSourceEntry, 10000 );
 				}
 #ifdef _Windows
 				else if( m_archiveMode )
@@ -1276,6 +2476,7 @@ void CopyFilterThread::ExecuteThread()
 			}
 		}
 	}
+	m_profile.stop();
 }
 
 void DeleteFilterThread::ExecuteThread()
@@ -1287,12 +2488,18 @@ void DeleteFilterThread::ExecuteThread()
 	const STRING	&destination = m_theDstCollector->getSource();
 	STRING			logEntry;
 
-	if( m_theSrcCollector )
+	if( m_theSrcCollector && m_theSrcCollector->isMergeMode() )
+	{
+		doEnterFunctionEx(gakLogging::llDetail,"DeleteFilterThread::ExecuteThread::waitForRuns");
+		m_srcRuns.reset( new MergedRunReader( m_theSrcCollector->waitForRuns() ) );
+	}
+	else if( m_theSrcCollector )
 	{
 		doEnterFunctionEx(gakLogging::llDetail,"DeleteFilterThread::ExecuteThread::join");
 		join( m_theSrcCollector );
 	}
 
+	m_profile.start();
 	while( m_theDstCollector->isRunning || inputQueue.size() )
 	{
 		if( !m_theDstCollector->isRunning && !inputLocked )
@@ -1301,10 +2508,10 @@ void DeleteFilterThread::ExecuteThread()
 			inputLocked = true;
 		}
 		bool waited = false;
-		if( (inputQueue.size()>0) || (waited=inputQueue.wait(2000))==true )
+		if( (inputQueue.size()>0) || (waited=profiledWait(inputQueue, m_profile))==true )
 		{
 			doEnterFunctionEx(gakLogging::llDetail,"DeleteFilterThread::ExecuteThread::processor");
-			DirectoryEntry theDestFile = inputQueue.pop();
+			DirectoryEntry theDestFile = profiledPop( inputQueue, m_profile );
 			if( waited )
 			{
 				inputQueue.unlock();
@@ -1313,7 +2520,12 @@ void DeleteFilterThread::ExecuteThread()
 			STRING theSourceFile = getDestFilePath(
 				theDestFile.fileName, destination, m_sourcePath
 			);
-			if( !exists( theSourceFile ) )
+			bool	found;
+			{
+				ProfileScope	scope( m_profile, psStat );
+				found = exists( theSourceFile, getDestFilePath( theDestFile.fileName, destination, NULL_STRING ) );
+			}
+			if( !found )
 			{
 				m_count++;
 				if( m_compareMode )
@@ -1325,16 +2537,12 @@ void DeleteFilterThread::ExecuteThread()
 				}
 				else
 				{
-					m_fileQueue.push( theDestFile );
-
-					while( m_maxQueueLen && m_fileQueue.size() >= m_maxQueueLen )
-					{
-						Sleep( 1000 );
-					}
+					pushEntry( theDestFile, 1000 );
 				}
 			}
 		}
 	}
+	m_profile.stop();
 }
 
 void CopyThread::ExecuteThread()
@@ -1365,6 +2573,7 @@ void CopyThread::ExecuteThread()
 
 	logFile << "Copy from " << source << " to " << destination << '\n';
 
+	m_profile.start();
 	while( m_filter->isRunning || copyQueue.size() )
 	{
 		if( !m_filter->isRunning && !inputLocked )
@@ -1373,14 +2582,14 @@ void CopyThread::ExecuteThread()
 			inputLocked = true;
 		}
 		bool waited = false;
-		if( (copyQueue.size()>0) || (waited=copyQueue.wait(2000))==true )
+		if( (copyQueue.size()>0) || (waited=profiledWait(copyQueue, m_profile))==true )
 		{
 			if( !m_startTick )
 			{
 				m_startTick = std::clock();
 			}
 
-			DirectoryEntry	theSourceFile = copyQueue.pop();
+			DirectoryEntry	theSourceFile = profiledPop( copyQueue, m_profile );
 			if( waited )
 			{
 				copyQueue.unlock();
@@ -1429,23 +2638,18 @@ void CopyThread::ExecuteThread()
 					makePath( theDestFile );
 					try
 					{
-						makeDirectory( theDestFile );
+						{
+							ProfileScope	scope( m_profile, psCopy );
+							makeDirectory( theDestFile );
+						}
+						ProfileScope	scope( m_profile, psQueue );
+						m_metaDataQueue.push( theSourceFile );
 					}
 					catch( std::exception &e )
 					{
 						m_errorCount++;
 						errFile << "mkdir " << e.what() << std::endl;
 					}
-						
-					try
-					{
-						copyACLs( theSourceFile.fileName, theDestFile );
-					}
-					catch( std::exception &e )
-					{
-						m_aclErrorCount++;
-						errFile << "ACLs " << e.what() << std::endl;
-					}
 				}
 			}
 			else	// if( isDirectory( theSourceFile.fileName ) )
@@ -1489,7 +2693,14 @@ void CopyThread::ExecuteThread()
 
 				try
 				{
-					fcopy( theSourceFile.fileName, theDestFile );
+					{
+						ProfileScope	scope( m_profile, psCopy );
+						fcopy( theSourceFile.fileName, theDestFile );
+					}
+					{
+						ProfileScope	scope( m_profile, psQueue );
+						m_metaDataQueue.push( theSourceFile );
+					}
 #ifdef _Windows
 					if( m_archiveMode )
 					{
@@ -1517,21 +2728,12 @@ void CopyThread::ExecuteThread()
 						mail::appendMail( mailSubject, errorMessage );
 					}
 				}
-
-				try
-				{
-					copyACLs( theSourceFile.fileName, theDestFile );
-				}
-				catch( std::exception &e )
-				{
-					m_aclErrorCount++;
-					errFile << "ACLs " << e.what() << std::endl;
-				}
 			}	// if( isDirectory( theSourceFile.fileName ) )
 
 			m_count++;
 		}
 	}
+	m_profile.stop();
 	doLogValueEx(gakLogging::llInfo, m_filter->isRunning);
 	doLogValueEx(gakLogging::llInfo, copyQueue.size());
 	logFile << "Finished copy from " << source << " to " << destination << '\n';
@@ -1556,6 +2758,7 @@ void DeleteThread::ExecuteThread()
 	logFile << "Delete from " << destination << '\n';
 
 	m_count = 0;
+	m_profile.start();
 	while( m_filter->isRunning || deleteQueue.size() )
 	{
 		if( !m_filter->isRunning && !inputLocked )
@@ -1564,9 +2767,9 @@ void DeleteThread::ExecuteThread()
 			inputLocked = true;
 		}
 		bool waited=false;
-		if( (deleteQueue.size()>0) || (waited=deleteQueue.wait(2000))==true )
+		if( (deleteQueue.size()>0) || (waited=profiledWait(deleteQueue, m_profile))==true )
 		{
-			DirectoryEntry theDestFile = deleteQueue.pop();
+			DirectoryEntry theDestFile = profiledPop( deleteQueue, m_profile );
 			if( waited )
 			{
 				deleteQueue.unlock();
@@ -1578,6 +2781,7 @@ void DeleteThread::ExecuteThread()
 			}
 			else
 			{
+				ProfileScope	scope( m_profile, psDelete );
 				if( m_maxAge )
 				{
 					if( m_theTreeCreator )
@@ -1599,6 +2803,7 @@ void DeleteThread::ExecuteThread()
 				{
 					strRemove( theDestFile.fileName );
 				}
+				directoryChanged( theDestFile.fileName );
 				logFile << theDestFile.fileName << '\n';
 
 				m_count++;
@@ -1608,14 +2813,160 @@ void DeleteThread::ExecuteThread()
 	while( m_directories.size() )
 	{
 		STRING directory = m_directories.pop();
-		strRmdir( directory );
+		{
+			ProfileScope	scope( m_profile, psDelete );
+			strRmdir( directory );
+		}
+		directoryChanged( directory );
 		logFile << directory << '\n';
 
 		m_count++;
 	}
+	m_profile.stop();
 	logFile << "Finished deletion from " << destination << '\n';
 }
 
+void MetaDataThread::ExecuteThread()
+{
+	doEnterFunctionEx(gakLogging::llInfo,"MetaDataThread::ExecuteThread");
+
+	bool			inputLocked = false;
+	DirectoryQueue	&metaDataQueue = m_copier->getQueue();
+	const STRING	&source = m_copier->getSource();
+	const STRING	&destination = m_copier->getDestination();
+	STRING			tmp = getTempPath();
+	STRING			errorLog = tmp + DIRECTORY_DELIMITER + "mirror_";
+
+	errorLog += formatNumber( GetCurrentProcessId() );
+	errorLog += "_meta_error.log";
+
+	m_errFile.open( errorLog );
+
+	ThreadPool<MetaDataBatchPtr>	pool( NUM_META_WORKERS, "MetaDataPool" );
+	MetaDataBatchPtr				batch;
+	STRING							batchDirectory;
+
+	pool.start();
+	m_profile.start();
+	m_workerProfile.start();
+	while( m_copier->isRunning || metaDataQueue.size() )
+	{
+		if( !m_copier->isRunning && !inputLocked )
+		{
+			metaDataQueue.getLocker().lock();
+			inputLocked = true;
+		}
+		bool waited = false;
+		if( (metaDataQueue.size()>0) || (waited=profiledWait(metaDataQueue, m_profile))==true )
+		{
+			DirectoryEntry theSourceEntry = profiledPop( metaDataQueue, m_profile );
+			if( waited )
+			{
+				metaDataQueue.unlock();
+			}
+
+			// the queue is in scan order, the files of a directory arrive together
+			STRING	directory = theSourceEntry.fileName.leftString(
+				theSourceEntry.fileName.searchRChar( DIRECTORY_DELIMITER )
+			);
+			if( theSourceEntry.directory )
+			{
+				// the contents will change the directory, process it later
+				m_directories.push( theSourceEntry );
+				// a new subdirectory changes its parent, too
+				directoryChanged( directory );
+				continue;
+			}
+
+			if( batch && (directory != batchDirectory || batch->entries.size() >= META_BATCH_SIZE) )
+			{
+				ProfileScope	scope( m_profile, psQueue );
+				pool.process( batch );
+				batch = MetaDataBatchPtr();
+			}
+			if( !batch )
+			{
+				batch = MetaDataBatchPtr::makeShared( this );
+				batchDirectory = directory;
+				directoryChanged( directory );
+			}
+			batch->entries.addElement( theSourceEntry );
+		}
+	}
+	if( batch )
+	{
+		pool.process( batch );
+	}
+
+	// the directories are changed by the deletions, too
+	{
+		ProfileScope	scope( m_profile, psWait );
+		join( m_deleter );
+	}
+	const TreeMap<F_STRING, bool>	&deleted = m_deleter->getChangedDirectories();
+	for(
+		TreeMap<F_STRING, bool>::const_iterator it = deleted.cbegin(), endIT = deleted.cend();
+		it != endIT;
+		++it
+	)
+	{
+		STRING	directory = getDestFilePath( it->getKey(), destination, source );
+		if( isDirectory( directory ) )
+		{
+			directoryChanged( directory );
+		}
+	}
+
+	// the new directories have their entry already, the others are read now
+	Array<DirectoryEntry>	directories;
+	while( m_directories.size() )
+	{
+		DirectoryEntry theSourceEntry = m_directories.pop();
+		m_changedDirectories[getDestFilePath( theSourceEntry.fileName, source, NULL_STRING )] = false;
+		directories.addElement( theSourceEntry );
+	}
+	for(
+		TreeMap<F_STRING, bool>::const_iterator it = m_changedDirectories.cbegin(), endIT = m_changedDirectories.cend();
+		it != endIT;
+		++it
+	)
+	{
+		if( it->getValue() )
+		{
+			DirectoryEntry	theSourceEntry;
+			STRING			directory = source + it->getKey();
+			{
+				ProfileScope	scope( m_profile, psStat );
+				theSourceEntry.findFile( directory );
+			}
+			theSourceEntry.fileName = directory;
+			directories.addElement( theSourceEntry );
+		}
+	}
+
+	// the file entries have to be complete before the directory times are set
+	{
+		ProfileScope	scope( m_profile, psWait );
+		pool.flush();
+	}
+	for( std::size_t i=0; i<directories.size(); i += META_BATCH_SIZE )
+	{
+		batch = MetaDataBatchPtr::makeShared( this );
+		for( std::size_t j=i; j<directories.size() && j<i+META_BATCH_SIZE; ++j )
+		{
+			batch->entries.addElement( directories[j] );
+		}
+		pool.process( batch );
+	}
+	{
+		ProfileScope	scope( m_profile, psWait );
+		pool.flush();
+	}
+	pool.shutdown();
+	m_workerProfile.stop();
+	m_profile.stop();
+}
+
 void CheckSumThread::ExecuteThread()
 {
 	doEnterFunctionEx(gakLogging::llDetail,"CheckSumThread::ExecuteThread");
@@ -1639,6 +2990,171 @@ void CheckSumThread::ExecuteThread()
 // ----- class publics ------------------------------------------------- //
 // --------------------------------------------------------------------- //
 
+#if WATCH_MODE
+/*
+	waits for the first change, then collects until the source is quiet
+	for debounce milliseconds. Returns false, if the kernel has lost
+	events and a complete mirror is required.
+*/
+bool SourceWatcher::collect( ChangedPaths *changes, unsigned debounce )
+{
+	doEnterFunctionEx(gakLogging::llInfo,"SourceWatcher::collect");
+
+	const std::size_t	eventBufferSize = 64*1024;
+	std::unique_ptr<char[]>	buffer( new char[eventBufferSize] );
+	bool			complete = true;
+	int				timeout = -1;
+	time_t			maxTime = 0;
+
+	while( !maxTime || time( nullptr ) < maxTime )
+	{
+		struct pollfd	pfd = { m_fd, POLLIN, 0 };
+		int				result = poll( &pfd, 1, timeout );
+		if( result < 0 && errno == EINTR )
+		{
+			continue;
+		}
+		if( result <= 0 )
+		{
+			if( changes->size() || !complete )
+			{
+				break;		// quiet for debounce milliseconds
+			}
+			timeout = -1;	// nothing of interest, wait again
+			maxTime = 0;
+			continue;
+		}
+		if( !maxTime )
+		{
+			maxTime = time( nullptr ) + (debounce*MAX_DEBOUNCE_FACTOR)/1000 + 1;
+		}
+
+		ssize_t	len = read( m_fd, buffer.get(), eventBufferSize );
+		if( len <= 0 )
+		{
+			continue;
+		}
+
+		for(
+			const char *ptr = buffer.get();
+			ptr < buffer.get() + len;
+			ptr += sizeof(struct inotify_event) + reinterpret_cast<const struct inotify_event *>(ptr)->len
+		)
+		{
+			const struct inotify_event	*event = reinterpret_cast<const struct inotify_event *>(ptr);
+
+			if( event->mask & IN_Q_OVERFLOW )
+			{
+				complete = false;
+				continue;
+			}
+			std::map<int, F_STRING>::const_iterator	watch = m_watches.find( event->wd );
+			if( watch == m_watches.end() )
+			{
+				continue;
+			}
+			if( event->mask & IN_IGNORED )
+			{
+				// the directory watched is gone
+				m_watches.erase( watch );
+				continue;
+			}
+			if( !event->len )
+			{
+				continue;
+			}
+
+			F_STRING	relPath = watch->second + DIRECTORY_DELIMITER + event->name;
+			bool		subTree = (event->mask & IN_ISDIR)
+				&& (event->mask & (IN_CREATE|IN_DELETE|IN_MOVED_FROM|IN_MOVED_TO));
+
+			if( changes->hasElement( relPath ) )
+				subTree = subTree || (*changes)[relPath];
+			(*changes)[relPath] = subTree;
+
+			if( (event->mask & IN_ISDIR) && (event->mask & (IN_DELETE|IN_MOVED_FROM)) )
+			{
+				removeWatches( relPath );
+			}
+			if( (event->mask & IN_ISDIR) && (event->mask & (IN_CREATE|IN_MOVED_TO))
+			&& !isExcluded( m_sourcePath + relPath, m_excludes ) )
+			{
+				addWatches( relPath );
+			}
+		}
+		timeout = int(debounce);
+	}
+
+	return complete;
+}
+#endif
+
+/*
+	the lookups must be done in ascending order, the reader skips all
+	entries smaller than relPath, like a merge join
+*/
+const SortedEntry *MergedRunReader::find( const F_STRING &relPath )
+{
+	SortedEntry	key;
+	key.relPath = relPath;
+
+	while( isValid() && current() < key )
+	{
+		next();
+	}
+
+	return isValid() && !current().compare( key ) ? &current() : nullptr;
+}
+
+/*
+	prints one line with the milliseconds spent in each stage, the rest of
+	the wall time is spent outside of the measured stages
+*/
+void StageProfile::print( std::ostream &out ) const
+{
+	int64	wallMillis = std::chrono::duration_cast<std::chrono::milliseconds>( m_stop - m_start ).count();
+	int64	restMillis = wallMillis;
+
+	out << std::setw(14) << std::left << m_name << std::right;
+	for( int i=0; i<psNumStages; ++i )
+	{
+		int64	millis = m_nanos[i] / 1000000;
+
+		out << std::setw(9) << millis;
+		restMillis -= millis;
+	}
+	out << std::setw(9) << (restMillis > 0 ? restMillis : 0);
+	out << std::setw(9) << wallMillis << '\n';
+}
+
+/*
+	writes the events in the chrome trace event format, use
+	chrome://tracing or https://ui.perfetto.dev to view them
+*/
+void StageProfile::writeTrace( std::ostream &out, int tid, bool *first ) const
+{
+	unsigned long	pid = GetCurrentProcessId();
+
+	out << (*first ? "\n" : ",\n");
+	*first = false;
+	out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid
+		<< ",\"tid\":" << tid
+		<< ",\"args\":{\"name\":\"" << m_name << "\"}}";
+
+	for(
+		std::vector<TraceEvent>::const_iterator it = m_events.begin(), endIT = m_events.end();
+		it != endIT;
+		++it
+	)
+	{
+		out << ",\n{\"name\":\"" << s_stageNames[it->stage]
+			<< "\",\"ph\":\"X\",\"ts\":" << it->start
+			<< ",\"dur\":" << it->duration
+			<< ",\"pid\":" << pid
+			<< ",\"tid\":" << tid << '}';
+	}
+}
+
 void TreeCreator::perform( const STRING &backupPath )
 {
 	doEnterFunctionEx(gakLogging::llInfo,"TreeCreator::perform");
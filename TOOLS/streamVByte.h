@@ -0,0 +1,361 @@
+/*
+		Project:		GAK_CLI
+		Module:			streamVByte.h
+		Description:	Stream VByte integer compression
+		Author:			Martin Gckler
+		Address:		Hofmannsthalweg 14, A-4030 Linz
+		Web:			https://www.gaeckler.at/
+
+		Copyright:		(c) 1988-2025 Martin Gckler
+
+		This program is free software: you can redistribute it and/or modify  
+		it under the terms of the GNU General Public License as published by  
+		the Free Software Foundation, version 3.
+
+		You should have received a copy of the GNU General Public License 
+		along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+		THIS SOFTWARE IS PROVIDED BY Martin Gckler, Austria, Linz ``AS IS''
+		AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+		TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+		PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR
+		CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+		SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+		LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+		USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+		ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+		OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+		OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+		SUCH DAMAGE.
+*/
+
+#ifndef STREAM_VBYTE_H
+#define STREAM_VBYTE_H
+
+// --------------------------------------------------------------------- //
+// ----- switches ------------------------------------------------------ //
+// --------------------------------------------------------------------- //
+
+#if defined( __GNUC__ ) && (defined( __x86_64__ ) || defined( __i386__ ))
+#	define SVB_SSSE3_KERNEL	1		// pshufb decoder, checked at runtime
+#else
+#	define SVB_SSSE3_KERNEL	0
+#endif
+
+#if defined( __GNUC__ ) && defined( __aarch64__ )
+#	define SVB_NEON_KERNEL	1		// tbl decoder, always available
+#else
+#	define SVB_NEON_KERNEL	0
+#endif
+
+// --------------------------------------------------------------------- //
+// ----- includes ------------------------------------------------------ //
+// --------------------------------------------------------------------- //
+
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+#include <gak/types.h>
+
+#if SVB_SSSE3_KERNEL
+#	include <immintrin.h>
+#	include <cpuid.h>
+#endif
+
+#if SVB_NEON_KERNEL
+#	include <arm_neon.h>
+#endif
+
+// --------------------------------------------------------------------- //
+// ----- imported datas ------------------------------------------------ //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- module switches ----------------------------------------------- //
+// --------------------------------------------------------------------- //
+
+#ifdef __BORLANDC__
+#	pragma option -RT-
+#	pragma option -b
+#	pragma option -a4
+#	pragma option -pc
+#endif
+
+// --------------------------------------------------------------------- //
+// ----- constants ----------------------------------------------------- //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- macros -------------------------------------------------------- //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- type definitions ---------------------------------------------- //
+// --------------------------------------------------------------------- //
+
+/*
+	decodes count values, the data starts behind the control bytes and ends
+	at dataEnd. If delta is true, each value is added to the previous one,
+	starting with prev. Returns the end of the data used.
+*/
+typedef const gak::uint8 *(*SvbDecodeFunc)(
+	const gak::uint8 *control, const gak::uint8 *data, const gak::uint8 *dataEnd,
+	std::size_t count, bool delta, gak::uint32 prev, gak::uint32 *out
+);
+
+// --------------------------------------------------------------------- //
+// ----- class definitions --------------------------------------------- //
+// --------------------------------------------------------------------- //
+
+/*
+	Stream VByte: the lengths of four values (1 to 4 bytes) are packed into
+	one control byte, all control bytes are stored before the value bytes.
+	So four values are decoded with one shuffle by a table indexed by the
+	control byte.
+*/
+class SvbTables
+{
+	public:
+	gak::uint8	length[256];		// of the four values of a control byte
+	gak::uint8	shuffle[256][16];	// value byte -> position in four uint32
+
+	SvbTables()
+	{
+		for( unsigned control=0; control<256; ++control )
+		{
+			unsigned	src = 0;
+			for( unsigned i=0; i<4; ++i )
+			{
+				const unsigned	len = ((control >> (2*i)) & 3) + 1;
+				for( unsigned j=0; j<4; ++j )
+				{
+					shuffle[control][4*i+j] = gak::uint8( j < len ? src + j : 0x80 );
+				}
+				src += len;
+			}
+			length[control] = gak::uint8( src );
+		}
+	}
+
+	static const SvbTables &get()
+	{
+		static const SvbTables	tables;
+		return tables;
+	}
+};
+
+// --------------------------------------------------------------------- //
+// ----- module functions ---------------------------------------------- //
+// --------------------------------------------------------------------- //
+
+inline std::size_t svbControlSize( std::size_t count )
+{
+	return (count + 3) / 4;
+}
+
+/// appends count values, if delta is true the differences of the ascending values
+inline void svbEncode(
+	const gak::uint32 *in, std::size_t count, bool delta, std::vector<gak::uint8> *out, gak::uint32 prev=0
+)
+{
+	const std::size_t	controlStart = out->size();
+	out->resize( controlStart + svbControlSize( count ), 0 );
+
+	for( std::size_t i=0; i<count; ++i )
+	{
+		const gak::uint32	value = delta ? in[i] - prev : in[i];
+		const unsigned		len = value < (1U<<8) ? 1 : value < (1U<<16) ? 2 : value < (1U<<24) ? 3 : 4;
+
+		prev = in[i];
+		(*out)[controlStart + i/4] |= gak::uint8( (len-1) << (2*(i&3)) );
+		for( unsigned j=0; j<len; ++j )
+		{
+			out->push_back( gak::uint8( value >> (8*j) ) );
+		}
+	}
+}
+
+/// decodes the values, that the SIMD decoders leave
+inline const gak::uint8 *svbDecodeScalar(
+	const gak::uint8 *control, const gak::uint8 *data, const gak::uint8 *,
+	std::size_t count, bool delta, gak::uint32 prev, gak::uint32 *out
+)
+{
+	for( std::size_t i=0; i<count; ++i )
+	{
+		const unsigned	len = ((control[i/4] >> (2*(i&3))) & 3) + 1;
+		gak::uint32		value = 0;
+
+		for( unsigned j=0; j<len; ++j )
+		{
+			value |= gak::uint32( data[j] ) << (8*j);
+		}
+		data += len;
+		out[i] = prev = delta ? prev + value : value;
+	}
+	return data;
+}
+
+#if SVB_SSSE3_KERNEL
+__attribute__((target("ssse3")))
+static const gak::uint8 *svbDecodeSSSE3(
+	const gak::uint8 *control, const gak::uint8 *data, const gak::uint8 *dataEnd,
+	std::size_t count, bool delta, gak::uint32 prev, gak::uint32 *out
+)
+{
+	const SvbTables	&tables = SvbTables::get();
+	__m128i			prevVec = _mm_set1_epi32( int(prev) );
+	std::size_t		i = 0;
+
+	// each load reads 16 bytes, they must be inside the data
+	for( ; i+4 <= count && dataEnd - data >= 16; i += 4 )
+	{
+		const gak::uint8	c = control[i/4];
+		__m128i				values = _mm_shuffle_epi8(
+			_mm_loadu_si128( (const __m128i*)data ),
+			_mm_loadu_si128( (const __m128i*)tables.shuffle[c] )
+		);
+		if( delta )
+		{
+			values = _mm_add_epi32( values, _mm_slli_si128( values, 4 ) );
+			values = _mm_add_epi32( values, _mm_slli_si128( values, 8 ) );
+			values = _mm_add_epi32( values, prevVec );
+			prevVec = _mm_shuffle_epi32( values, 0xFF );
+		}
+		_mm_storeu_si128( (__m128i*)(out+i), values );
+		data += tables.length[c];
+	}
+	if( i )
+	{
+		prev = out[i-1];
+	}
+	return svbDecodeScalar( control + i/4, data, dataEnd, count-i, delta, prev, out+i );
+}
+
+static bool hasSSSE3()
+{
+	unsigned	eax, ebx, ecx, edx;
+
+	return __get_cpuid( 1, &eax, &ebx, &ecx, &edx ) && (ecx & bit_SSSE3);
+}
+#endif	// SVB_SSSE3_KERNEL
+
+#if SVB_NEON_KERNEL
+static const gak::uint8 *svbDecodeNEON(
+	const gak::uint8 *control, const gak::uint8 *data, const gak::uint8 *dataEnd,
+	std::size_t count, bool delta, gak::uint32 prev, gak::uint32 *out
+)
+{
+	const SvbTables	&tables = SvbTables::get();
+	const uint32x4_t	zero = vdupq_n_u32( 0 );
+	uint32x4_t			prevVec = vdupq_n_u32( prev );
+	std::size_t			i = 0;
+
+	for( ; i+4 <= count && dataEnd - data >= 16; i += 4 )
+	{
+		const gak::uint8	c = control[i/4];
+		uint32x4_t			values = vreinterpretq_u32_u8(
+			vqtbl1q_u8( vld1q_u8( data ), vld1q_u8( tables.shuffle[c] ) )
+		);
+		if( delta )
+		{
+			values = vaddq_u32( values, vextq_u32( zero, values, 3 ) );
+			values = vaddq_u32( values, vextq_u32( zero, values, 2 ) );
+			values = vaddq_u32( values, prevVec );
+			prevVec = vdupq_laneq_u32( values, 3 );
+		}
+		vst1q_u32( out+i, values );
+		data += tables.length[c];
+	}
+	if( i )
+	{
+		prev = out[i-1];
+	}
+	return svbDecodeScalar( control + i/4, data, dataEnd, count-i, delta, prev, out+i );
+}
+#endif	// SVB_NEON_KERNEL
+
+/// the fastest decoder of this CPU
+inline SvbDecodeFunc getSvbDecoder()
+{
+#if SVB_SSSE3_KERNEL
+	static const SvbDecodeFunc	decoder = hasSSSE3() ? svbDecodeSSSE3 : svbDecodeScalar;
+	return decoder;
+#elif SVB_NEON_KERNEL
+	return svbDecodeNEON;
+#else
+	return svbDecodeScalar;
+#endif
+}
+
+/// decodes count values from a block written by svbEncode, returns its end
+inline const gak::uint8 *svbDecode(
+	const gak::uint8 *block, const gak::uint8 *blockEnd, std::size_t count, bool delta, gak::uint32 *out,
+	gak::uint32 prev=0
+)
+{
+	const gak::uint8	*data = block + svbControlSize( count );
+	return getSvbDecoder()( block, data, blockEnd, count, delta, prev, out );
+}
+
+// --------------------------------------------------------------------- //
+// ----- exported datas ------------------------------------------------ //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- module static data -------------------------------------------- //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- class static data --------------------------------------------- //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- prototypes ---------------------------------------------------- //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- module functions ---------------------------------------------- //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- class inlines ------------------------------------------------- //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- class constructors/destructors -------------------------------- //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- class static functions ---------------------------------------- //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- class privates ------------------------------------------------ //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- class protected ----------------------------------------------- //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- class virtuals ------------------------------------------------ //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- class publics ------------------------------------------------- //
+// --------------------------------------------------------------------- //
+
+// --------------------------------------------------------------------- //
+// ----- entry points -------------------------------------------------- //
+// --------------------------------------------------------------------- //
+
+#ifdef __BORLANDC__
+#	pragma option -RT.
+#	pragma option -b.
+#	pragma option -a.
+#	pragma option -p.
+#endif
+
+#endif //  STREAM_VBYTE_H